@@ -0,0 +1,712 @@
+/*
+ * Zenity cURL wrapper - manifest batch downloads
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Manifest: one download per line, fields separated by blanks:
+ *   URL OUTPUT [SIZE [PRIORITY]]
+ * SIZE is in bytes ("-" if unknown), higher PRIORITY entries are started
+ * first (default 0). Empty lines and lines starting with '#' are ignored.
+ *
+ * Up to N curl children run at once. Their stderr pipes are the streams of
+ * the filter event loop (cw_filter_multi() with hooks): a job slot is a
+ * stream, given the stderr of next child when its curl is done. Aggregate
+ * progress is written in c2z format (zenity percent and text lines),
+ * latency breakdown of each transfer (timing record) on stdout.
+ *
+ * Segmented download: one file is split in byte ranges, fetched by as many
+ * curl children at once. Each child writes its range (on stdout) straight
+ * at its offset in the preallocated output file.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <inttypes.h>
+#include <strings.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "batch.h"
+
+#define BATCH_UPDATE_MS 200   /* minimum delay between two outputs */
+#define SEGMENT_MIN_SIZE (1024 * 1024)
+
+typedef struct {
+  char *url;                /* NULL: given by common curl arguments */
+  char *output;
+  uint64_t size;            /* 0 if unknown */
+  long priority;
+  unsigned int line;        /* manifest line number */
+  uint64_t offset;          /* segment: first byte, written at this offset */
+  char range[48];           /* segment: "FIRST-LAST", empty for whole file */
+} entry_t;
+
+typedef struct {
+  entry_t *entry;
+  pid_t pid;
+  int fd;                   /* curl's stderr, -1 when job slot is free */
+  uint64_t bytes;           /* transferred */
+  uint64_t total;           /* size reported by curl, 0 if unknown */
+  uint64_t speed;
+} job_t;
+
+typedef struct {
+  entry_t *entries;
+  unsigned int count;
+  unsigned int next;        /* first entry not started */
+  unsigned int finished;
+  unsigned int failed;
+  uint64_t done_bytes;      /* transferred by finished children */
+  uint64_t done_total;      /* size of finished entries */
+  int out_fd;               /* -1 if silent or once reader is gone */
+  uint64_t last_ms;
+  bool dirty;               /* progress changed since last output */
+  char last[128];           /* last text written */
+  const char *unit;         /* what entries are ("files") */
+  job_t *jobs;              /* job slots (filter streams) */
+  unsigned int slots;
+  int argc;                 /* common curl arguments */
+  char **argv;
+  bool timing;              /* print latency breakdown of each transfer */
+} batch_t;
+
+/* Higher priority first, manifest order otherwise */
+static int entry_compare (const void *a, const void *b)
+{
+  const entry_t *e1 = a, *e2 = b;
+
+  if (e1->priority != e2->priority)
+    return (e1->priority > e2->priority) ? -1 : 1;
+  return (e1->line > e2->line) - (e1->line < e2->line);
+}
+
+/**
+ * Load manifest file.
+ *
+ * \param[in] path manifest file, "-" for stdin
+ * \param[out] b batch (entries and count)
+ * \return 0 on success, -1 on error
+ */
+static int manifest_load (const char *path, batch_t *b)
+{
+  char *line = NULL, *url, *output, *size, *prio, *end, *save;
+  unsigned int allocated = 0, lineno = 0;
+  size_t len = 0;
+  entry_t *e;
+  FILE *fp;
+  int ret = 0;
+
+  fp = (strcmp(path, "-") == 0) ? stdin : fopen(path, "r");
+  if (!fp) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    return -1;
+  }
+
+  while (getline(&line, &len, fp) != -1) {
+    lineno++;
+
+    url = strtok_r(line, " \t\r\n", &save);
+    if (!url || *url == '#')
+      continue;
+
+    output = strtok_r(NULL, " \t\r\n", &save);
+    size = strtok_r(NULL, " \t\r\n", &save);
+    prio = strtok_r(NULL, " \t\r\n", &save);
+    if (!output || strtok_r(NULL, " \t\r\n", &save)) {
+      CW_ERROR("%s:%u: expecting URL OUTPUT [SIZE [PRIORITY]]", path, lineno);
+      ret = -1;
+      break;
+    }
+
+    if (b->count == allocated) {
+      allocated = (allocated) ? allocated * 2 : 64;
+      e = realloc(b->entries, allocated * sizeof(entry_t));
+      if (!e) {
+        CW_ERROR_ERRNO(errno, "realloc");
+        ret = -1;
+        break;
+      }
+      b->entries = e;
+    }
+
+    e = &b->entries[b->count];
+    memset(e, 0, sizeof(*e));
+    e->line = lineno;
+
+    if (size && strcmp(size, "-") != 0) {
+      errno = 0;
+      e->size = strtoull(size, &end, 10);
+      if (errno || *end != '\0') {
+        CW_ERROR("%s:%u: %s: invalid size", path, lineno, size);
+        ret = -1;
+        break;
+      }
+    }
+    if (prio) {
+      errno = 0;
+      e->priority = strtol(prio, &end, 10);
+      if (errno || *end != '\0') {
+        CW_ERROR("%s:%u: %s: invalid priority", path, lineno, prio);
+        ret = -1;
+        break;
+      }
+    }
+
+    e->url = strdup(url);
+    e->output = strdup(output);
+    b->count++;
+    if (!e->url || !e->output) {
+      CW_ERROR_ERRNO(errno, "strdup");
+      ret = -1;
+      break;
+    }
+  }
+
+  free(line);
+  if (fp != stdin)
+    fclose(fp);
+
+  if (ret == 0 && b->count == 0) {
+    CW_ERROR("%s: no download", path);
+    ret = -1;
+  }
+
+  if (ret == 0)
+    qsort(b->entries, b->count, sizeof(entry_t), entry_compare);
+
+  return ret;
+}
+
+/**
+ * Fork a curl child: curl [common options] -o OUTPUT URL, or for a segment
+ * curl [common options] -r RANGE (stdout is output file at segment offset)
+ *
+ * \param[in] b batch (common curl arguments)
+ * \param[in,out] j free job slot
+ * \return 0 on success, -1 on error
+ */
+static int job_start (batch_t *b, job_t *j)
+{
+  entry_t *e = &b->entries[b->next++];
+  int apipe[2], argc = b->argc;
+  char **args, **argv = b->argv;
+
+  if (pipe2(apipe, O_CLOEXEC) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    return -1;
+  }
+
+  j->pid = fork();
+  if (j->pid == (pid_t)-1) {
+    CW_ERROR_ERRNO(errno, "fork");
+    close(apipe[0]);
+    close(apipe[1]);
+    return -1;
+  }
+
+  if (j->pid == 0) { /* child */
+    int saved_stderr = dup(STDERR_FILENO), fd;
+
+    cw_signals_reset();
+
+    args = calloc((size_t)argc + 5, sizeof(char *));
+    if (args) {
+      args[0] = "curl";
+      memcpy(&args[1], &argv[1], (size_t)(argc - 1) * sizeof(char *));
+      if (e->url) {
+        args[argc] = "-o";
+        args[argc + 1] = e->output;
+        args[argc + 2] = e->url;
+      } else {
+        args[argc] = "-r";
+        args[argc + 1] = e->range;
+      }
+    }
+
+    if (b->out_fd >= 0 && b->out_fd != STDERR_FILENO)
+      close(b->out_fd);
+
+    /* Segment: curl writes its range on stdout, at its place in file */
+    if (!e->url) {
+      fd = open(e->output, O_WRONLY);
+      if (fd == -1 || lseek(fd, (off_t)e->offset, SEEK_SET) == (off_t)-1 ||
+          dup2(fd, STDOUT_FILENO) == -1) {
+        CW_ERROR_ERRNO(errno, "%s", e->output);
+        exit(EXIT_FAILURE);
+      }
+      close(fd);
+    }
+
+    /* We want to catch statistics data from stderr (dup2 clears CLOEXEC) */
+    if (!args || dup2(apipe[1], STDERR_FILENO) == -1) {
+      CW_ERROR_ERRNO(errno, "dup2");
+    } else if (execvp("curl", args) == -1) {
+      dup2(saved_stderr, STDERR_FILENO); /* restore stderr */
+      CW_ERROR_ERRNO(errno, "execvp curl");
+    }
+
+    exit(EXIT_FAILURE);
+  }
+
+  close(apipe[1]);
+
+  j->entry = e;
+  j->fd = apipe[0];
+  j->bytes = j->total = j->speed = 0;
+  return 0;
+}
+
+/**
+ * curl has closed its stderr: collect exit status.
+ *
+ * \param[in,out] b batch
+ * \param[in,out] j job slot, freed
+ * \param[in] timing latency breakdown of the transfer, NULL if none
+ */
+static void job_end (batch_t *b, job_t *j, const cw_timing_t *timing)
+{
+  const char *name = (j->entry->url) ? j->entry->url : j->entry->output;
+  char text[160];
+  bool ok = false;
+  int status;
+
+  close(j->fd);
+  j->fd = -1;
+
+  if (waitpid(j->pid, &status, 0) == -1)
+    CW_ERROR_ERRNO(errno, "waitpid");
+  else if (!WIFEXITED(status))
+    CW_ERROR("%s%s: curl terminated abnormally", name, j->entry->range);
+  else if (WEXITSTATUS(status) != 0)
+    CW_ERROR("%s%s: curl exited with status=%d", name, j->entry->range,
+        WEXITSTATUS(status));
+  else
+    ok = true;
+
+  /* Segment: curl's downloaded size must be the range one, a server
+   * answering 200 sends the whole file (written over next segments) */
+  if (ok && *j->entry->range && (!timing || timing->size != j->entry->size)) {
+    CW_ERROR("%s %s: %" PRIu64 " bytes received, %" PRIu64 " expected", name,
+        j->entry->range, (timing) ? timing->size : 0, j->entry->size);
+    ok = false;
+  }
+
+  if (!ok)
+    b->failed++;
+
+  /* Latency breakdown of each transfer on stdout (curl writes to files) */
+  if (timing && b->timing)
+    fprintf(stdout, "%s%s%s: %s\n", j->entry->output, (*j->entry->range) ? " " : "",
+        j->entry->range, cw_format_timing(text, sizeof(text), timing));
+
+  /* curl's meter is rounded (k, M units): a complete download is worth its
+   * size, a failed one only what has been transferred. */
+  if (ok && (j->entry->size || j->total))
+    j->bytes = (j->entry->size) ? j->entry->size : j->total;
+
+  b->finished++;
+  b->done_bytes += j->bytes;
+  b->done_total += j->bytes;
+  b->dirty = true;
+}
+
+/* Filter hook: parsed result of a job */
+static void batch_progress (void *data, unsigned int index, const cw_progress_t *r)
+{
+  batch_t *b = data;
+  job_t *j = &b->jobs[index];
+
+  if (r->fields & CW_FIELD_METER) {
+    j->bytes = r->received + r->uploaded;
+    j->total = r->total;
+    j->speed = r->speed;
+  } else if (j->entry->size) { /* progress bar: percent only */
+    j->bytes = j->entry->size * (uint64_t)r->percent / 100;
+  }
+  b->dirty = true;
+}
+
+/* Filter hook: job is done, slot takes next entry of work queue */
+static int batch_close (void *data, unsigned int index, const cw_timing_t *timing)
+{
+  batch_t *b = data;
+  job_t *j = &b->jobs[index];
+
+  job_end(b, j, timing);
+
+  while (b->next < b->count) {
+    if (job_start(b, j) == 0)
+      return j->fd;
+    b->failed++;
+    b->finished++;
+  }
+
+  return -1;
+}
+
+/**
+ * Write aggregate progress: transferred bytes over known sizes (number of
+ * finished downloads if a size is unknown), overall rate, files left.
+ *
+ * \param[in,out] b batch
+ * \param[in] now current time (milliseconds)
+ */
+static void batch_output (batch_t *b, uint64_t now)
+{
+  uint64_t bytes = b->done_bytes, total = b->done_total, speed = 0;
+  char text[sizeof(b->last)], size[8], sum[8], rate[8], eta[10];
+  const job_t *jobs = b->jobs;
+  bool sized = true;
+  int percent, len;
+
+  b->dirty = false;
+  if (b->out_fd < 0)
+    return;
+
+  for (unsigned int i = 0; i < b->slots; i++) {
+    if (jobs[i].fd < 0)
+      continue;
+    bytes += jobs[i].bytes;
+    speed += jobs[i].speed;
+    if (jobs[i].entry->size || jobs[i].total)
+      total += (jobs[i].entry->size) ? jobs[i].entry->size : jobs[i].total;
+    else
+      sized = false;
+  }
+  for (unsigned int i = b->next; i < b->count && sized; i++) {
+    total += b->entries[i].size;
+    sized = (b->entries[i].size != 0);
+  }
+
+  if (sized && total)
+    percent = (int)((bytes < total ? bytes : total) * 100 / total);
+  else
+    percent = (int)(b->finished * 100 / b->count);
+
+  /* Zenity closes dialog at 100: keep it for the final write */
+  if (percent == 100 && b->finished < b->count)
+    percent = 99;
+
+  cw_format_size(size, sizeof(size), bytes);
+  cw_format_size(rate, sizeof(rate), speed);
+  len = snprintf(text, sizeof(text), "%d\n# %u/%u %s left, %s", percent,
+      b->count - b->finished, b->count, b->unit, size);
+  if (sized && total)
+    len += snprintf(text + len, sizeof(text) - (size_t)len, "/%s",
+        cw_format_size(sum, sizeof(sum), total));
+  len += snprintf(text + len, sizeof(text) - (size_t)len, " (%s/s", rate);
+  if (sized && total && speed && bytes < total)
+    len += snprintf(text + len, sizeof(text) - (size_t)len, ", ETA %s",
+        cw_format_time(eta, sizeof(eta), (int64_t)((total - bytes) / speed)));
+  snprintf(text + len, sizeof(text) - (size_t)len, ")\n");
+
+  if (strcmp(text, b->last) == 0)
+    return;
+
+  if (write(b->out_fd, text, strlen(text)) == -1 && errno == EPIPE)
+    b->out_fd = -1;
+  strcpy(b->last, text);
+  b->last_ms = now;
+}
+
+/* Filter hook: write progress, at most every BATCH_UPDATE_MS */
+static int batch_tick (void *data, uint64_t now)
+{
+  batch_t *b = data;
+
+  if (!b->dirty)
+    return -1;
+  if (now - b->last_ms < BATCH_UPDATE_MS)
+    return (int)(b->last_ms + BATCH_UPDATE_MS - now);
+
+  batch_output(b, now);
+  return -1;
+}
+
+/**
+ * Download all batch entries, at most jobs at once.
+ *
+ * \param[in,out] b batch, entries are loaded
+ * \param[in] jobs maximum number of concurrent curl children
+ * \param[in] argc number of common curl arguments
+ * \param[in] argv common curl arguments (argv[0] is ignored)
+ * \param[in] mode non zero for curl's progress bar (-#)
+ * \return number of failed downloads, -1 on error (or interrupted)
+ */
+static int batch_loop (batch_t *b, unsigned int jobs, int argc, char *argv[],
+    int mode)
+{
+  cw_hooks_t hooks = { .data = b, .progress = batch_progress,
+    .close = batch_close, .tick = batch_tick };
+  cw_options_t opts = { .mode = mode, .hooks = &hooks };
+  int *fds, ret = 0;
+  job_t *j;
+
+  if (jobs > b->count)
+    jobs = b->count;
+
+  b->argc = argc;
+  b->argv = argv;
+  b->jobs = calloc(jobs, sizeof(job_t));
+  fds = calloc(jobs, sizeof(int));
+  if (!b->jobs || !fds) {
+    CW_ERROR_ERRNO(errno, "calloc");
+    free(b->jobs);
+    free(fds);
+    return -1;
+  }
+
+  /* First jobs: slots are filled in order, they are the filter streams */
+  while (b->slots < jobs && b->next < b->count) {
+    j = &b->jobs[b->slots];
+    if (job_start(b, j) < 0) {
+      b->failed++;
+      b->finished++;
+      continue;
+    }
+    fds[b->slots++] = j->fd;
+  }
+
+  /* Blocking loop inside, results only go to hooks (silent: no output) */
+  if (b->slots > 0)
+    ret = cw_filter_multi(fds, b->slots,
+        (b->out_fd >= 0) ? b->out_fd : STDERR_FILENO, &opts);
+
+  /* Error or signal: stop running children */
+  for (unsigned int i = 0; i < b->slots; i++) {
+    j = &b->jobs[i];
+    if (j->fd < 0)
+      continue;
+    kill(j->pid, SIGTERM);
+    close(j->fd);
+    j->fd = -1;
+    waitpid(j->pid, NULL, 0);
+  }
+
+  if (ret == 0) {
+    batch_output(b, 0);
+    ret = (int)b->failed;
+  } else {
+    ret = -1;
+  }
+
+  free(b->jobs);
+  free(fds);
+  return ret;
+}
+
+/**
+ * Download all manifest entries, at most jobs at once.
+ *
+ * \param[in] manifest manifest path ("-" for stdin)
+ * \param[in] jobs maximum number of concurrent curl children
+ * \param[in] argc number of common curl arguments
+ * \param[in] argv common curl arguments (argv[0] is ignored)
+ * \param[in] mode non zero for curl's progress bar (-#)
+ * \param[in] out_fd output fd (zenity or stderr), -1 for no progress
+ * \return number of failed downloads, -1 on error
+ */
+int batch_run (const char *manifest, unsigned int jobs, int argc, char *argv[],
+    int mode, int out_fd)
+{
+  batch_t b;
+  int ret = -1;
+
+  memset(&b, 0, sizeof(b));
+  b.out_fd = out_fd;
+  b.unit = "files";
+  b.timing = true;
+
+  if (manifest_load(manifest, &b) == 0)
+    ret = batch_loop(&b, jobs, argc, argv, mode);
+
+  for (unsigned int i = 0; i < b.count; i++) {
+    free(b.entries[i].url);
+    free(b.entries[i].output);
+  }
+  free(b.entries);
+  return ret;
+}
+
+/**
+ * Get file size and check range support: fetch first byte only.
+ *
+ * \param[in] argc number of curl arguments
+ * \param[in] argv curl arguments, URL included (argv[0] is ignored)
+ * \param[out] size file size, 0 if ranges are not supported
+ * \return 0 on success, -1 on error
+ */
+static int range_probe (int argc, char *argv[], uint64_t *size)
+{
+  char **args, *line = NULL;
+  unsigned long long total;
+  int apipe[2], status;
+  size_t len = 0;
+  FILE *fp;
+  pid_t pid;
+
+  if (pipe2(apipe, O_CLOEXEC) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    return -1;
+  }
+
+  pid = fork();
+  if (pid == (pid_t)-1) {
+    CW_ERROR_ERRNO(errno, "fork");
+    close(apipe[0]);
+    close(apipe[1]);
+    return -1;
+  }
+
+  if (pid == 0) { /* child: headers on stdout, no write-out */
+    cw_signals_reset();
+    args = calloc((size_t)argc + 11, sizeof(char *));
+    if (args) {
+      args[0] = "curl";
+      memcpy(&args[1], &argv[1], (size_t)(argc - 1) * sizeof(char *));
+      memcpy(&args[argc], (char *[]){ "-s", "-S", "-r", "0-0", "-D", "-",
+          "-o", "/dev/null", "-w", "" }, 10 * sizeof(char *));
+    }
+
+    if (!args || dup2(apipe[1], STDOUT_FILENO) == -1)
+      CW_ERROR_ERRNO(errno, "dup2");
+    else if (execvp("curl", args) == -1)
+      CW_ERROR_ERRNO(errno, "execvp curl");
+
+    exit(EXIT_FAILURE);
+  }
+
+  close(apipe[1]);
+  fp = fdopen(apipe[0], "r");
+  if (!fp) {
+    CW_ERROR_ERRNO(errno, "fdopen");
+    close(apipe[0]);
+    waitpid(pid, NULL, 0);
+    return -1;
+  }
+
+  /* "Content-Range: bytes 0-0/12345", last response wins (redirects) */
+  *size = 0;
+  while (getline(&line, &len, fp) != -1) {
+    if (strncasecmp(line, "HTTP/", 5) == 0)
+      *size = 0;
+    else if (strncasecmp(line, "Content-Range:", 14) == 0 &&
+        sscanf(line + 14, " bytes 0-0/%llu", &total) == 1)
+      *size = (uint64_t)total;
+  }
+
+  free(line);
+  fclose(fp);
+
+  if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) ||
+      WEXITSTATUS(status) != 0) {
+    CW_ERROR("range request failed");
+    return -1;
+  }
+
+  return 0;
+}
+
+/**
+ * Download a single file in segments, all at once. curl must write the
+ * timing record (CW_TIMING_WRITE_OUT): received size of each segment is
+ * checked. Output file is removed if a segment fails.
+ *
+ * \param[in] output output file
+ * \param[in] segments maximum number of segments (and curl children)
+ * \param[in] argc number of curl arguments
+ * \param[in] argv curl arguments, URL included, output excluded (argv[0] is
+ *                 ignored)
+ * \param[in] mode non zero for curl's progress bar (-#)
+ * \param[in] timing print latency breakdown of each segment
+ * \param[in] out_fd output fd (zenity or stderr), -1 for no progress
+ * \return number of failed segments, -1 on error, BATCH_NO_SEGMENTS if
+ *         file can't be (or is too small to be) segmented
+ */
+int batch_segments (const char *output, unsigned int segments, int argc,
+    char *argv[], int mode, bool timing, int out_fd)
+{
+  uint64_t size, chunk, offset = 0;
+  batch_t b;
+  int fd, ret;
+
+  if (range_probe(argc, argv, &size) < 0)
+    return -1;
+
+  if (size == 0) {
+    CW_WARNING("server doesn't support ranges, downloading in one piece");
+    return BATCH_NO_SEGMENTS;
+  }
+
+  if (segments > size / SEGMENT_MIN_SIZE)
+    segments = (unsigned int)(size / SEGMENT_MIN_SIZE);
+  if (segments < 2)
+    return BATCH_NO_SEGMENTS;
+
+  /* Preallocate: segments are written in place, no merge afterwards */
+  fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", output);
+    return -1;
+  }
+  if (fallocate(fd, 0, 0, (off_t)size) == -1 &&
+      ftruncate(fd, (off_t)size) == -1) {
+    CW_ERROR_ERRNO(errno, "%s", output);
+    close(fd);
+    return -1;
+  }
+  close(fd);
+
+  memset(&b, 0, sizeof(b));
+  b.out_fd = out_fd;
+  b.unit = "segments";
+  b.timing = timing;
+  b.count = segments;
+  b.entries = calloc(segments, sizeof(entry_t));
+  if (!b.entries) {
+    CW_ERROR_ERRNO(errno, "calloc");
+    return -1;
+  }
+
+  chunk = size / segments;
+  for (unsigned int i = 0; i < segments; i++) {
+    b.entries[i].output = (char *)output;
+    b.entries[i].offset = offset;
+    b.entries[i].size = (i == segments - 1) ? size - offset : chunk;
+    b.entries[i].line = i + 1;
+    snprintf(b.entries[i].range, sizeof(b.entries[i].range), "%" PRIu64 "-%" PRIu64,
+        offset, offset + b.entries[i].size - 1);
+    offset += b.entries[i].size;
+  }
+
+  ret = batch_loop(&b, segments, argc, argv, mode);
+  free(b.entries);
+
+  /* Preallocated file has the right size: don't leave holes behind */
+  if (ret != 0)
+    unlink(output);
+  return ret;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,33 @@
+/*
+ * Zenity cURL wrapper - manifest batch downloads
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "common.h"
+
+#define BATCH_DEFAULT_JOBS 4
+#define BATCH_MAX_SEGMENTS 64
+#define BATCH_NO_SEGMENTS -2  /* batch_segments(): download in one piece */
+
+int batch_run (const char *manifest, unsigned int jobs, int argc, char *argv[],
+    int mode, int out_fd);
+int batch_segments (const char *output, unsigned int segments, int argc,
+    char *argv[], int mode, bool timing, int out_fd);
+
+#endif /* BATCH_H */
@@ -0,0 +1,22 @@
+#!/bin/sh
+# Compare cw_filter() I/O wait backends (run by `make bench`).
+# Columns: lines/s: parsed lines per second, cpu_us/upd: CPU time (user+sys)
+# per update, wakeups: voluntary context switches during filter.
+
+set -e
+
+BENCH_LINES=${BENCH_LINES:-100000}
+
+printf '%-8s %-6s %3s %6s %7s %12s %10s %8s %8s\n' backend input str frag rate \
+    lines/s cpu_us/upd wakeups wk/upd
+
+for backend in epoll ppoll pselect uring; do
+  prog=./cwbench-$backend
+  test -x $prog || continue
+  $prog -n $BENCH_LINES              # unthrottled meter
+  $prog -n $BENCH_LINES -#           # unthrottled bar
+  $prog -n $BENCH_LINES -f 7         # heavily fragmented lines
+  $prog -n 2000 -r 1000              # paced meter, 1000 lines/s
+  $prog -n 2000 -r 1000 -c 16        # 16 paced streams
+  $prog -n 2000 -r 1000 -c 16 -R 10  # same, output limited to 10 updates/s
+done
@@ -16,68 +16,476 @@
  * along with this program.  If not, see <http://www.gnu.org/licenses/>.
  */
 
+#define _GNU_SOURCE
+#include <ctype.h>
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
 
 #include "common.h"
+#include "batch.h"
+#include "digest.h"
+#include "inproc.h"
+#include "serve.h"
 
 //#define CW_KEEP_ZENITY_ERRORS
 
-int main (int argc, char *argv[])
+#define C2Z_PREFIX "--c2z-"
+#define C2Z_LOW_SPEED_SECS 30
+#define C2Z_RETRIES 3
+
+/* c2z own options (given as --c2z-NAME[=VALUE], not passed to curl) */
+typedef struct {
+  bool exec;                /* always execute curl (no in-process transfer) */
+  bool no_timing;           /* don't add timing write-out to curl command-line */
+  const char *shm_path;     /* shared memory progress export */
+  const char *record_path;  /* binary progress recording */
+  const char *manifest;     /* batch mode: downloads list */
+  unsigned int jobs;        /* batch mode: concurrent downloads */
+  uint64_t low_speed;       /* restart curl under this speed (bytes/s) */
+  unsigned int low_speed_secs; /* ... for that long */
+  unsigned int retries;     /* maximum number of restarts */
+  unsigned int segments;    /* segmented download: number of ranges */
+  const char *sha256;       /* expected payload digest, "-" to print only */
+  const char *crc32;        /* expected payload checksum, "-" to print only */
+  const char *serve;        /* download daemon: socket to listen to */
+  const char *daemon;       /* download daemon: socket to send requests to */
+} c2z_options_t;
+
+/* Check an expected digest argument: "-" or len hexadecimal digits */
+static bool parse_digest (const char *str, size_t len)
 {
-  int ret, status = 0;
-  pid_t pid[2];
-  int apipe[2];
-  bool curl_hash_flag, zenity_fork;
+  if (strcmp(str, "-") == 0)
+    return true;
 
-  /* Check provided cURL command-line */
-  const char *switches[5] = {
-    [0] = "-s",
-    [1] = "--silent",
-    [2] = "-#",
-    [3] = "-v",
-    [4] = "--verbose"
-  };
+  if (strlen(str) != len)
+    return false;
+  for (size_t i = 0; i < len; i++)
+    if (!isxdigit((unsigned char)str[i]))
+      return false;
 
-  if (argc <= 1) {
-    fprintf(stderr, "Usage: c2z [curl_options...] URL...\n");
-    return 0;
+  return true;
+}
+
+/* Parse a speed argument: bytes per second with optional k or M suffix */
+static bool parse_speed (const char *str, uint64_t *speed)
+{
+  unsigned long long val;
+  char *end;
+
+  errno = 0;
+  val = strtoull(str, &end, 10);
+  if (errno || end == str)
+    return false;
+
+  if (*end == 'k' || *end == 'K')
+    val <<= 10, end++;
+  else if (*end == 'm' || *end == 'M')
+    val <<= 20, end++;
+
+  if (*end != '\0' || val == 0)
+    return false;
+
+  *speed = (uint64_t)val;
+  return true;
+}
+
+/**
+ * Extract c2z options from command-line.
+ *
+ * \param[in] argc number of arguments
+ * \param[in,out] argv arguments, c2z ones are removed
+ * \param[out] opts c2z options
+ * \return new number of arguments, -1 on error
+ */
+static int parse_options (int argc, char *argv[], c2z_options_t *opts)
+{
+  const char *name;
+  char *end;
+  int i, j;
+
+  memset(opts, 0, sizeof(*opts));
+  opts->jobs = BATCH_DEFAULT_JOBS;
+  opts->low_speed_secs = C2Z_LOW_SPEED_SECS;
+  opts->retries = C2Z_RETRIES;
+
+  for (i = j = 1; i < argc; i++) {
+    if (strncmp(argv[i], C2Z_PREFIX, strlen(C2Z_PREFIX)) != 0) {
+      argv[j++] = argv[i];
+      continue;
+    }
+
+    name = argv[i] + strlen(C2Z_PREFIX);
+    if (strcmp(name, "exec") == 0) {
+      opts->exec = true;
+    } else if (strcmp(name, "no-timing") == 0) {
+      opts->no_timing = true;
+    } else if (strncmp(name, "shm=", 4) == 0 && name[4] != '\0') {
+      opts->shm_path = name + 4;
+    } else if (strncmp(name, "record=", 7) == 0 && name[7] != '\0') {
+      opts->record_path = name + 7;
+    } else if (strncmp(name, "serve=", 6) == 0 && name[6] != '\0') {
+      opts->serve = name + 6;
+    } else if (strncmp(name, "daemon=", 7) == 0 && name[7] != '\0') {
+      opts->daemon = name + 7;
+    } else if (strncmp(name, "manifest=", 9) == 0 && name[9] != '\0') {
+      opts->manifest = name + 9;
+    } else if (strncmp(name, "jobs=", 5) == 0) {
+      errno = 0;
+      opts->jobs = (unsigned int)strtoul(name + 5, &end, 10);
+      if (errno || *end != '\0' || opts->jobs == 0 || opts->jobs > 1024) {
+        CW_ERROR("%s: invalid number of jobs", argv[i]);
+        return -1;
+      }
+    } else if (strncmp(name, "low-speed=", 10) == 0) {
+      if (!parse_speed(name + 10, &opts->low_speed)) {
+        CW_ERROR("%s: invalid speed", argv[i]);
+        return -1;
+      }
+    } else if (strncmp(name, "low-speed-time=", 15) == 0) {
+      errno = 0;
+      opts->low_speed_secs = (unsigned int)strtoul(name + 15, &end, 10);
+      if (errno || *end != '\0' || opts->low_speed_secs == 0) {
+        CW_ERROR("%s: invalid duration", argv[i]);
+        return -1;
+      }
+    } else if (strncmp(name, "segments=", 9) == 0) {
+      errno = 0;
+      opts->segments = (unsigned int)strtoul(name + 9, &end, 10);
+      if (errno || *end != '\0' || opts->segments < 2 ||
+          opts->segments > BATCH_MAX_SEGMENTS) {
+        CW_ERROR("%s: invalid number of segments (2 to %d)", argv[i],
+            BATCH_MAX_SEGMENTS);
+        return -1;
+      }
+    } else if (strncmp(name, "sha256=", 7) == 0) {
+      opts->sha256 = name + 7;
+      if (!parse_digest(opts->sha256, 2 * CW_SHA256_SIZE)) {
+        CW_ERROR("%s: invalid digest (64 hexadecimal digits or -)", argv[i]);
+        return -1;
+      }
+    } else if (strncmp(name, "crc32=", 6) == 0) {
+      opts->crc32 = name + 6;
+      if (!parse_digest(opts->crc32, 8)) {
+        CW_ERROR("%s: invalid checksum (8 hexadecimal digits or -)", argv[i]);
+        return -1;
+      }
+    } else if (strncmp(name, "retries=", 8) == 0) {
+      errno = 0;
+      opts->retries = (unsigned int)strtoul(name + 8, &end, 10);
+      if (errno || *end != '\0' || opts->retries > 100) {
+        CW_ERROR("%s: invalid number of retries (0 to 100)", argv[i]);
+        return -1;
+      }
+    } else {
+      CW_ERROR("%s: unknown option", argv[i]);
+      return -1;
+    }
   }
 
-  for (size_t i = 0; i < sizeof(switches)/sizeof(char *); i++)
-    for (int j = 1; j < argc; j++)
-      if (*argv[j] == '-' && strcmp(argv[j], switches[i]) == 0) {
-        status |= 1 << i;
+  argv[j] = NULL;
+  return j;
+}
+
+/* curl short options taking an argument (-oFILE or -o FILE, last of a bundle) */
+#define CURL_SHORT_ARG_OPTIONS "ACDEFHKPQTUXYbcdemortuwxyz"
+
+/* curl long options taking an argument (--expand- prefix excluded) */
+static const char *curl_long_arg_options[] = {
+  "abstract-unix-socket", "alt-svc", "aws-sigv4", "cacert", "capath", "cert",
+  "cert-type", "ciphers", "config", "connect-timeout", "connect-to",
+  "continue-at", "cookie", "cookie-jar", "create-file-mode", "crlfile",
+  "curves", "data", "data-ascii", "data-binary", "data-raw", "data-urlencode",
+  "delegation", "dns-interface", "dns-ipv4-addr", "dns-ipv6-addr",
+  "dns-servers", "doh-url", "dump-header", "ech", "egd-file", "engine",
+  "etag-compare", "etag-save", "expect100-timeout", "form", "form-string",
+  "ftp-account", "ftp-alternative-to-user", "ftp-method", "ftp-port",
+  "ftp-ssl-ccc-mode", "happy-eyeballs-timeout-ms", "haproxy-clientip",
+  "header", "hostpubmd5", "hostpubsha256", "hsts", "interface", "ip-tos",
+  "json", "keepalive-time", "key", "key-type", "knownhosts", "krb", "libcurl",
+  "limit-rate", "local-port", "login-options", "mail-auth", "mail-from",
+  "mail-rcpt", "max-filesize", "max-redirs", "max-time", "netrc-file",
+  "noproxy", "oauth2-bearer", "output", "output-dir", "parallel-max", "pass",
+  "pinnedpubkey", "preproxy", "proto", "proto-default", "proto-redir",
+  "proxy", "proxy-cacert", "proxy-capath", "proxy-cert", "proxy-cert-type",
+  "proxy-ciphers", "proxy-crlfile", "proxy-header", "proxy-key",
+  "proxy-key-type", "proxy-pass", "proxy-pinnedpubkey", "proxy-service-name",
+  "proxy-tls13-ciphers", "proxy-tlsauthtype", "proxy-tlspassword",
+  "proxy-tlsuser", "proxy-user", "proxy1.0", "pubkey", "quote",
+  "random-file", "range", "rate", "referer", "request", "request-target",
+  "resolve", "retry", "retry-delay", "retry-max-time", "sasl-authzid",
+  "service-name", "sigalgs", "socks4", "socks4a", "socks5",
+  "socks5-gssapi-service", "socks5-hostname", "speed-limit", "speed-time",
+  "ssl-sessions", "stderr", "telnet-option", "tftp-blksize", "time-cond",
+  "tls-max", "tls13-ciphers", "tlsauthtype", "tlspassword", "tlsuser",
+  "trace", "trace-ascii", "trace-config", "unix-socket", "upload-file",
+  "upload-flags", "url", "url-query", "user", "user-agent", "variable",
+  "vlan-priority", "write-out",
+};
+
+/**
+ * Tell whether a write-out template is given on curl command-line (-w or
+ * --write-out). Option arguments are skipped: they are never taken as
+ * options themselves.
+ *
+ * \param[in] argc number of arguments
+ * \param[in] argv arguments
+ * \return true if curl is given -w
+ */
+static bool has_write_out (int argc, char *argv[])
+{
+  const char *arg;
+
+  for (int i = 1; i < argc; i++) {
+    arg = argv[i];
+    if (arg[0] != '-' || arg[1] == '\0') /* URL or stdin */
+      continue;
+    if (strcmp(arg, "--") == 0)
+      break;
+
+    if (arg[1] == '-') {
+      arg += 2;
+      if (strncmp(arg, "expand-", 7) == 0)
+        arg += 7;
+      if (strcmp(arg, "write-out") == 0)
+        return true;
+      for (size_t k = 0; k < sizeof(curl_long_arg_options)/sizeof(char *); k++)
+        if (strcmp(arg, curl_long_arg_options[k]) == 0) {
+          i++;
+          break;
+        }
+      continue;
+    }
+
+    /* Short options bundle: first one with an argument ends it */
+    for (arg++; *arg; arg++) {
+      if (*arg == 'w')
+        return true;
+      if (strchr(CURL_SHORT_ARG_OPTIONS, *arg)) {
+        if (arg[1] == '\0')
+          i++;
         break;
       }
+    }
+  }
 
-  /* curl silent flag detected, don't perform 2nd fork */
-  zenity_fork = !(status & 3);
+  return false;
+}
+
+/**
+ * Check that curl can write the timing record to stderr (%{stderr},
+ * curl 7.63.0 or later). Older ones would write it with the data.
+ * Version is found at configure time, curl is only run when unknown
+ * (warning is printed once per process).
+ *
+ * \return true if curl is recent enough
+ */
+static bool curl_stderr_write_out (void)
+{
+  static int supported = -1;
+#ifndef CURL_STDERR_WRITE_OUT
+  unsigned int major = 0, minor = 0;
+  char line[128];
+  FILE *fp;
+#endif
 
-  curl_hash_flag = status & 4;
+  if (supported >= 0)
+    return supported;
+
+#ifdef CURL_STDERR_WRITE_OUT
+  supported = CURL_STDERR_WRITE_OUT;
+#else
+  supported = 0;
+  fp = popen("curl --version 2>/dev/null", "re");
+  if (fp) {
+    if (fgets(line, sizeof(line), fp) &&
+        sscanf(line, "curl %u.%u", &major, &minor) == 2)
+      supported = (major > 7 || (major == 7 && minor >= 63));
+    pclose(fp);
+  }
+#endif
+
+  if (!supported)
+    CW_WARNING("curl 7.63.0 or later is needed for latency breakdown "
+        "(--c2z-no-timing to disable)");
+  return supported;
+}
+
+/**
+ * Append timing record write-out (see CW_TIMING_WRITE_OUT) to curl
+ * command-line. Being the last one, it replaces any other.
+ *
+ * \param[in,out] argc number of arguments
+ * \param[in] argv arguments
+ * \return new arguments array, NULL on error
+ */
+static char **write_out_args (int *argc, char *argv[])
+{
+  char **args;
+
+  args = malloc(((size_t)*argc + 3) * sizeof(char *));
+  if (!args) {
+    CW_ERROR_ERRNO(errno, "malloc");
+    return NULL;
+  }
+
+  memcpy(args, argv, (size_t)*argc * sizeof(char *));
+  args[(*argc)++] = "-w";
+  args[(*argc)++] = CW_TIMING_WRITE_OUT;
+  args[*argc] = NULL;
+  return args;
+}
+
+/**
+ * Append timing record write-out to curl command-line, unless one is
+ * already given or curl is too old.
+ *
+ * \param[in,out] argc number of arguments
+ * \param[in] argv arguments
+ * \return arguments to use (argv or a new array), NULL on error
+ */
+static char **timing_args (int *argc, char *argv[])
+{
+  if (has_write_out(*argc, argv) || !curl_stderr_write_out())
+    return argv;
+
+  return write_out_args(argc, argv);
+}
+
+/**
+ * Find curl output file (last -o option).
+ *
+ * \param[in] argc number of arguments
+ * \param[in] argv arguments
+ * \return file name, NULL if none (standard output)
+ */
+static const char *output_file (int argc, char *argv[])
+{
+  const char *file = NULL;
+
+  for (int i = 1; i < argc; i++) {
+    if ((strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0) &&
+        i + 1 < argc)
+      file = argv[++i];
+    else if (strncmp(argv[i], "-o", 2) == 0 && argv[i][2] != '\0')
+      file = argv[i] + 2;
+  }
+
+  return (file && strcmp(file, "-") != 0) ? file : NULL;
+}
+
+/**
+ * Remove output options (-o) from curl command-line.
+ *
+ * \param[in] argc number of arguments
+ * \param[in] argv arguments
+ * \return new arguments array (argc is updated), NULL on error
+ */
+static char **strip_output (int *argc, char *argv[])
+{
+  char **args;
+  int j = 0;
+
+  args = malloc(((size_t)*argc + 1) * sizeof(char *));
+  if (!args) {
+    CW_ERROR_ERRNO(errno, "malloc");
+    return NULL;
+  }
+
+  for (int i = 0; i < *argc; i++) {
+    if (i > 0 && (strcmp(argv[i], "-o") == 0 || strcmp(argv[i], "--output") == 0)) {
+      i++;
+      continue;
+    }
+    if (i > 0 && strncmp(argv[i], "-o", 2) == 0 && argv[i][2] != '\0')
+      continue;
+    args[j++] = argv[i];
+  }
+
+  args[j] = NULL;
+  *argc = j;
+  return args;
+}
+
+/**
+ * Append resume option (-C -) to curl command-line: transfer restarts
+ * from current output file size.
+ *
+ * \param[in] argc number of arguments
+ * \param[in] argv arguments
+ * \return new arguments array, NULL on error
+ */
+static char **resume_args (int argc, char *argv[])
+{
+  char **args;
+
+  args = malloc(((size_t)argc + 3) * sizeof(char *));
+  if (!args) {
+    CW_ERROR_ERRNO(errno, "malloc");
+    return NULL;
+  }
+
+  memcpy(args, argv, (size_t)argc * sizeof(char *));
+  args[argc] = "-C";
+  args[argc + 1] = "-";
+  args[argc + 2] = NULL;
+  return args;
+}
+
+/* Exit code of a child: its own, or 128 + signal number if killed */
+static int exit_code (int status)
+{
+  if (WIFEXITED(status))
+    return WEXITSTATUS(status);
+  if (WIFSIGNALED(status))
+    return 128 + WTERMSIG(status);
+  return EXIT_FAILURE;
+}
+
+/**
+ * Launch curl, its stderr is connected to a pipe.
+ *
+ * \param[in] argv curl command-line
+ * \param[in] close_fd fd not to be inherited (zenity pipe), -1 for none
+ * \param[in] body_fd fd to connect curl stdout to, -1 to keep it
+ * \param[out] in_fd read end of pipe connected to curl stderr
+ * \return curl pid, (pid_t)-1 on failure
+ */
+static pid_t spawn_curl (char *argv[], int close_fd, int body_fd, int *in_fd)
+{
+  int apipe[2];
+  pid_t pid;
 
   if (pipe(apipe) == -1) {
     CW_ERROR_ERRNO(errno, "pipe");
-    exit(EXIT_FAILURE);
+    return (pid_t)-1;
   }
 
-  /* First fork (curl) */
-  pid[0] = fork();
-  if (pid[0] == (pid_t)-1) {
+  pid = fork();
+  if (pid == (pid_t)-1) {
     CW_ERROR_ERRNO(errno, "fork");
-    exit(EXIT_FAILURE);
+    return pid;
   }
 
-  if (pid[0] == 0) { /* child */
+  if (pid == 0) { /* child */
     int saved_stderr = dup(STDERR_FILENO);
 
+    cw_signals_reset();
+    if (close_fd >= 0)
+      close(close_fd);
+
     /* We want to catch statistics data from stderr */
-    if (dup2(apipe[1], STDERR_FILENO) == -1) {
+    if (dup2(apipe[1], STDERR_FILENO) == -1 ||
+        (body_fd >= 0 && dup2(body_fd, STDOUT_FILENO) == -1)) {
       CW_ERROR_ERRNO(errno, "dup2");
     } else {
       close(apipe[0]);
@@ -89,75 +497,404 @@ int main (int argc, char *argv[])
     }
 
     exit(EXIT_FAILURE);
+  }
 
-  } else {
-    int bpipe[2];
+  close(apipe[1]);
+  *in_fd = apipe[0];
+  return pid;
+}
 
-    if (zenity_fork) {
-      if (pipe(bpipe) == -1) {
-        CW_ERROR_ERRNO(errno, "pipe");
-        exit(EXIT_FAILURE);
-      }
+/**
+ * Launch payload hasher: curl output is copied to file and hashed on the
+ * way. Digests are printed on stdout (like `sha256sum --tag`).
+ *
+ * \param[in] output output file
+ * \param[in] opts c2z options (digests to compute and expected values)
+ * \param[in] close_fd fd not to be inherited (zenity pipe), -1 for none
+ * \param[out] body_fd write end of pipe to connect curl stdout to
+ * \return hasher pid (exit status 0: digests match), (pid_t)-1 on failure
+ */
+static pid_t spawn_digest (const char *output, const c2z_options_t *opts,
+    int close_fd, int *body_fd)
+{
+  char sha256[2 * CW_SHA256_SIZE + 1], crc32[9];
+  cw_digest_t d;
+  int dpipe[2], fd, ret;
+  pid_t pid;
 
-      /* Second fork (zenity) */
-      pid[1] = fork();
-      if (pid[1] == (pid_t)-1) {
-        CW_ERROR_ERRNO(errno, "fork");
-        exit(EXIT_FAILURE);
+  fd = open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+  if (fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", output);
+    return (pid_t)-1;
+  }
+
+  if (pipe2(dpipe, O_CLOEXEC) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    close(fd);
+    return (pid_t)-1;
+  }
+
+  pid = fork();
+  if (pid == (pid_t)-1) {
+    CW_ERROR_ERRNO(errno, "fork");
+    return pid;
+  }
+
+  if (pid == 0) { /* child */
+    cw_signals_reset();
+    if (close_fd >= 0)
+      close(close_fd);
+    close(dpipe[1]);
+
+    cw_digest_init(&d, opts->sha256 != NULL, opts->crc32 != NULL);
+    ret = cw_digest_copy(&d, dpipe[0], fd);
+    if (close(fd) == -1 && ret == 0) {
+      CW_ERROR_ERRNO(errno, "%s", output);
+      ret = -1;
+    }
+    if (ret < 0)
+      exit(EXIT_FAILURE);
+
+    cw_digest_hex(&d, sha256, crc32);
+    if (opts->sha256) {
+      printf("SHA256 (%s) = %s\n", output, sha256);
+      fflush(stdout);
+      if (strcmp(opts->sha256, "-") != 0 && strcasecmp(opts->sha256, sha256) != 0) {
+        CW_ERROR("%s: SHA-256 mismatch, expected %s", output, opts->sha256);
+        ret = -1;
       }
+    }
+    if (opts->crc32) {
+      printf("CRC32 (%s) = %s\n", output, crc32);
+      fflush(stdout);
+      if (strcmp(opts->crc32, "-") != 0 && strcasecmp(opts->crc32, crc32) != 0) {
+        CW_ERROR("%s: CRC-32 mismatch, expected %s", output, opts->crc32);
+        ret = -1;
+      }
+    }
+
+    exit((ret == 0) ? 0 : EXIT_FAILURE);
+  }
+
+  close(fd);
+  close(dpipe[0]);
+  *body_fd = dpipe[1];
+  return pid;
+}
+
+/**
+ * Launch zenity progress dialog.
+ *
+ * \param[out] out_fd write end of pipe connected to zenity stdin
+ * \return zenity pid, (pid_t)-1 on failure
+ */
+static pid_t spawn_zenity (int *out_fd)
+{
+  int bpipe[2];
+  pid_t pid;
+
+  if (pipe(bpipe) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    return (pid_t)-1;
+  }
+
+  pid = fork();
+  if (pid == (pid_t)-1) {
+    CW_ERROR_ERRNO(errno, "fork");
+    return pid;
+  }
+
+  if (pid == 0) { /* child */
+    cw_signals_reset();
+
+    if (dup2(bpipe[0], STDIN_FILENO) == -1) {
+      CW_ERROR_ERRNO(errno, "dup2");
     } else {
-      bpipe[1] = STDERR_FILENO;
-      pid[1] = (pid_t)-1;
-    }
-
-    if (pid[1] == 0) { /* child */
-
-      if (dup2(bpipe[0], STDIN_FILENO) == -1) {
-        CW_ERROR_ERRNO(errno, "dup2");
-      } else {
-        close(bpipe[1]);
-        close(STDOUT_FILENO);
-
-        /* Silent zenity errors. For example:
-         * Gtk-Message: GtkDialog mapped without a transient parent. This is discouraged.
-         */
-        #ifndef CW_KEEP_ZENITY_ERRORS
-        close(STDERR_FILENO);
-        #endif
-
-        /* but don't close stderr in case of zenity errors */
-        if (execlp("zenity", "zenity", "--progress", "--no-cancel",
-              "--auto-close", "--title", "cURL wrapper", NULL) == -1) {
-          close(bpipe[0]);
-          CW_ERROR_ERRNO(errno, "execlp zenity");
-        }
+      close(bpipe[1]);
+      close(STDOUT_FILENO);
+
+      /* Silent zenity errors. For example:
+       * Gtk-Message: GtkDialog mapped without a transient parent. This is discouraged.
+       */
+      #ifndef CW_KEEP_ZENITY_ERRORS
+      close(STDERR_FILENO);
+      #endif
+
+      /* but don't close stderr in case of zenity errors */
+      if (execlp("zenity", "zenity", "--progress", "--no-cancel",
+            "--auto-close", "--title", "cURL wrapper", NULL) == -1) {
+        close(bpipe[0]);
+        CW_ERROR_ERRNO(errno, "execlp zenity");
       }
+    }
 
-      exit(EXIT_FAILURE);
+    exit(EXIT_FAILURE);
+  }
+
+  close(bpipe[0]);
+  *out_fd = bpipe[1];
+  return pid;
+}
+
+int main (int argc, char *argv[])
+{
+  int ret, status = 0;
+  pid_t pid[3], w;
+  int in_fd, out_fd, body_fd = -1;
+  bool curl_hash_flag, zenity_fork;
+  const char *output = NULL;
+  struct stat st;
+  c2z_options_t opts;
+  cw_options_t wopts = {0};
+#ifdef HAVE_LIBCURL
+  inproc_request_t req;
+#endif
+
+  /* Check provided cURL command-line */
+  const char *switches[7] = {
+    [0] = "-s",
+    [1] = "--silent",
+    [2] = "-#",
+    [3] = "-v",
+    [4] = "--verbose",
+    [5] = "-Z",
+    [6] = "--parallel"
+  };
+
+  argc = parse_options(argc, argv, &opts);
+  if (argc < 0)
+    return EXIT_FAILURE;
+
+  /* Download daemon: in-process transfers for clients (--c2z-daemon) */
+  if (opts.serve) {
+#ifdef HAVE_LIBCURL
+    return (serve_run(opts.serve, &wopts) == 0) ? 0 : EXIT_FAILURE;
+#else
+    CW_ERROR("--c2z-serve needs libcurl support");
+    return EXIT_FAILURE;
+#endif
+  }
 
-    } else { /* parent process */
-      pid_t w;
+  if (argc <= 1 && !opts.manifest) {
+    fprintf(stderr, "Usage: c2z [--c2z-exec] [--c2z-shm=FILE] [curl_options...] URL...\n"
+        "       c2z --c2z-manifest=FILE [--c2z-jobs=N] [curl_options...]\n"
+        "Other options: --c2z-no-timing --c2z-record=FILE\n"
+        "       --c2z-low-speed=SPEED [--c2z-low-speed-time=SECS] [--c2z-retries=N]\n"
+        "       --c2z-segments=N --c2z-sha256=HEX|- --c2z-crc32=HEX|-\n"
+        "       --c2z-daemon=SOCKET\n"
+        "       c2z --c2z-serve=SOCKET\n");
+    return 0;
+  }
+
+  if (opts.manifest && opts.shm_path) {
+    CW_ERROR("--c2z-shm is not supported with --c2z-manifest");
+    return EXIT_FAILURE;
+  }
 
-      /* Blocking loop inside */
-      ret = cw_filter(apipe[0], bpipe[1], curl_hash_flag);
+  if (opts.manifest && opts.record_path) {
+    CW_ERROR("--c2z-record is not supported with --c2z-manifest");
+    return EXIT_FAILURE;
+  }
+
+  /* Low speed restart: resumed transfer needs an output file */
+  if (opts.low_speed) {
+    output = output_file(argc, argv);
+    if (opts.manifest || !output) {
+      CW_ERROR("--c2z-low-speed needs a single transfer to a file (-o)");
+      return EXIT_FAILURE;
+    }
+  }
 
-      if (ret > 0 && zenity_fork) { /* SIGCHLD */
-        write(bpipe[1], "100\n", 4);
+  /* Segments are written at their offset in output file */
+  if (opts.segments) {
+    output = output_file(argc, argv);
+    if (opts.manifest || opts.low_speed || !output) {
+      CW_ERROR("--c2z-segments needs a single transfer to a file (-o)");
+      return EXIT_FAILURE;
+    }
+  }
+
+  /* Payload digests: curl writes on a pipe, hasher writes the file */
+  if (opts.sha256 || opts.crc32) {
+    output = output_file(argc, argv);
+    if (opts.manifest || opts.segments || opts.low_speed || !output) {
+      CW_ERROR("--c2z-sha256 and --c2z-crc32 need a single transfer to a file (-o)");
+      return EXIT_FAILURE;
+    }
+  }
+
+  for (size_t i = 0; i < sizeof(switches)/sizeof(char *); i++)
+    for (int j = 1; j < argc; j++)
+      if (*argv[j] == '-' && strcmp(argv[j], switches[i]) == 0) {
+        status |= 1 << i;
+        break;
       }
 
-      w = wait(&status);
-      if (w == -1) {
-        CW_ERROR_ERRNO(errno, "waitpid");
-      } else if (WIFEXITED(status)) {
-          ret = WEXITSTATUS(status);
-          if (ret != 0)
-            CW_ERROR("%s exited with status=%d", \
-                (w == pid[0]) ? "curl" : "zenity", ret);
+  /* curl silent flag detected, don't perform 2nd fork */
+  zenity_fork = !(status & 3);
+
+  /* Parallel transfers always use their own meter (detected by cw) */
+  curl_hash_flag = (status & 4) && !(status & (3 << 5));
+
+  /* Progress bar has no speed (nor size) to compare with the limit */
+  if (opts.low_speed && curl_hash_flag) {
+    CW_ERROR("--c2z-low-speed needs curl's progress meter, not -#");
+    return EXIT_FAILURE;
+  }
+
+  wopts.mode = curl_hash_flag;
+  wopts.shm_path = opts.shm_path;
+  wopts.record_path = opts.record_path;
+  wopts.low_speed = opts.low_speed;
+  wopts.low_speed_secs = opts.low_speed_secs;
+
+  if (zenity_fork) {
+    pid[1] = spawn_zenity(&out_fd);
+    if (pid[1] == (pid_t)-1)
+      exit(EXIT_FAILURE);
+  } else {
+    out_fd = STDERR_FILENO;
+    pid[1] = (pid_t)-1;
+  }
+
+  /* Batch mode: one curl per manifest entry, aggregate progress */
+  if (opts.manifest) {
+    if (!opts.no_timing && !(argv = timing_args(&argc, argv)))
+      exit(EXIT_FAILURE);
+    ret = batch_run(opts.manifest, opts.jobs, argc, argv, curl_hash_flag,
+        (zenity_fork) ? out_fd : -1);
+    if (zenity_fork) {
+      write(out_fd, "100\n", 4);
+      close(out_fd);
+      waitpid(pid[1], NULL, 0);
+    }
+    return (ret == 0) ? 0 : EXIT_FAILURE;
+  }
+
+  /* Segmented download: one curl per range, aggregate progress */
+  if (opts.segments) {
+    int count = argc;
+    char **args = strip_output(&count, argv);
+
+    /* Timing record gives received size of each segment, it is checked */
+    if (!args)
+      exit(EXIT_FAILURE);
+    if (!curl_stderr_write_out()) {
+      CW_WARNING("segment sizes can't be checked, downloading in one piece");
+      ret = BATCH_NO_SEGMENTS;
+    } else if (!(args = write_out_args(&count, args))) {
+      exit(EXIT_FAILURE);
+    } else {
+      ret = batch_segments(output, opts.segments, count, args, curl_hash_flag,
+          !opts.no_timing, (zenity_fork) ? out_fd : -1);
+    }
+    if (ret != BATCH_NO_SEGMENTS) {
+      if (zenity_fork) {
+        if (ret == 0)
+          write(out_fd, "100\n", 4);
+        close(out_fd);
+        waitpid(pid[1], NULL, 0);
       }
+      return (ret == 0) ? 0 : EXIT_FAILURE;
     }
   }
 
-  return 0;
+#ifdef HAVE_LIBCURL
+  /* Simple command-lines: transfer in-process, no curl output to parse */
+  if (!opts.exec && !opts.low_speed && !opts.sha256 && !opts.crc32 &&
+      inproc_parse(argc, argv, &req)) {
+    ret = -1;
+    /* Resident daemon: warm connections, progress is relayed */
+    if (opts.daemon && !opts.shm_path && !opts.record_path) {
+      ret = serve_request(opts.daemon, argc, argv, out_fd);
+      if (ret < 0)
+        CW_WARNING("%s: no download daemon, transfer in-process", opts.daemon);
+    }
+    if (ret < 0)
+      ret = inproc_transfer(&req, out_fd, &wopts);
+    if (ret == 0 && zenity_fork)
+      write(out_fd, "100\n", 4);
+
+    if (zenity_fork) {
+      close(out_fd);
+      waitpid(pid[1], NULL, 0);
+    }
+    return ret;
+  }
+#endif
+
+  pid[2] = (pid_t)-1;
+  if (opts.sha256 || opts.crc32) {
+    if (!(argv = strip_output(&argc, argv)))
+      exit(EXIT_FAILURE);
+    pid[2] = spawn_digest(output, &opts, (zenity_fork) ? out_fd : -1, &body_fd);
+    if (pid[2] == (pid_t)-1)
+      exit(EXIT_FAILURE);
+  }
+
+  if (!opts.no_timing && !(argv = timing_args(&argc, argv)))
+    exit(EXIT_FAILURE);
+
+  for (unsigned int attempt = 0; ; attempt++) {
+    pid[0] = spawn_curl(argv, (zenity_fork) ? out_fd : -1, body_fd, &in_fd);
+    if (pid[0] == (pid_t)-1)
+      exit(EXIT_FAILURE);
+    if (body_fd >= 0) {
+      close(body_fd);
+      body_fd = -1;
+    }
+
+    /* Blocking loop inside */
+    ret = cw_filter_multi(&in_fd, 1, out_fd, &wopts);
+    close(in_fd);
+
+    if (ret != CW_FILTER_LOW_SPEED)
+      break;
+
+    kill(pid[0], SIGTERM);
+    waitpid(pid[0], NULL, 0);
+
+    if (attempt == opts.retries) {
+      CW_ERROR("transfer too slow, giving up after %u restarts", attempt);
+      exit(EXIT_FAILURE);
+    }
+
+    /* Restart where it has been left, progress goes on from there */
+    if (attempt == 0 && !(argv = resume_args(argc, argv)))
+      exit(EXIT_FAILURE);
+    wopts.offset = (stat(output, &st) == 0) ? (uint64_t)st.st_size : 0;
+    if (zenity_fork)
+      dprintf(out_fd, "# transfer too slow, resuming (%u/%u)\n", attempt + 1,
+          opts.retries);
+  }
+
+  /* Hasher is done once curl output is closed and the file written */
+  if (pid[2] != (pid_t)-1 && (waitpid(pid[2], &status, 0) == -1 ||
+        !WIFEXITED(status) || WEXITSTATUS(status) != 0)) {
+    if (zenity_fork)
+      dprintf(out_fd, "# payload verification failed\n");
+    unlink(output);
+    exit(EXIT_FAILURE);
+  }
+
+  if (ret > 0 && zenity_fork) { /* SIGCHLD */
+    write(out_fd, "100\n", 4);
+  }
+
+  /* Exit with curl's code, zenity may be done first */
+  do {
+    w = wait(&status);
+    if (w == -1) {
+      CW_ERROR_ERRNO(errno, "waitpid");
+      return EXIT_FAILURE;
+    }
+    ret = exit_code(status);
+    if (ret != 0)
+      CW_ERROR("%s exited with status=%d", \
+          (w == pid[0]) ? "curl" : "zenity", ret);
+  } while (w != pid[0]);
+
+  return ret;
 }
 
 /* vim: set et sw=2 ts=4: */
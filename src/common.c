@@ -20,285 +20,1838 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdarg.h>
 #include <string.h>
 #include <signal.h>
+#include <time.h>
 #include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/resource.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
 
 #include "common.h"        /* HAVE_* defines */
+#include "libcw.h"
+#include "format.h"
+#include "rec.h"
+#include "shm.h"
 
 #ifdef HAVE_CW_PSELECT
 #include <sys/select.h>
 #endif
-#ifdef HAVE_CW_PPOLL
-#include <poll.h>
-#endif
 #ifdef HAVE_CW_EPOLL
 #include <sys/epoll.h>
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif
+#ifdef HAVE_CW_URING
+#include "uring.h"
+#endif
+
+#define WAIT_TIME_SECS    50 /* maximum wait when nothing is held back (in seconds) */
+#define STALL_CHECK_MS  1000 /* stall detection period (statistics enabled) */
+#define STREAM_TAG_SIZE   12 /* "4294967295:" */
+#define OUTPUT_BUFFER_SIZE 4096
+#define OUTPUT_RECORD_MAX  512 /* one formatted result (JSON included) */
+#define METRICS_STREAM_MAX 1536 /* metrics text of one stream */
+#define METRICS_CONNS_MAX     8 /* metrics connections served at once */
+#define METRICS_TIMEOUT_MS 1000 /* lifetime of a metrics connection */
+#define TIMING_PHASES        5 /* dns, connect, tls, wait, transfer */
+#define HISTOGRAM_BUCKETS   40 /* log2 of nanoseconds, up to 9 minutes */
+
+typedef struct {
+  int fd;                              /* -1 when closed */
+  char tag[STREAM_TAG_SIZE];           /* output prefix, empty for single stream */
+  cw_parser_t *parser;
+  cw_stats_t *stats;                   /* NULL if statistics are disabled */
+  bool stalled;                        /* last written stall state */
+
+  /* Rate limiting */
+  cw_progress_t last;                  /* last written result */
+  cw_progress_t pending;               /* result held back by rate limit */
+  bool has_last, has_pending;
+  uint64_t last_ms;                    /* time of last written result */
+  uint64_t slow_ms;                    /* under low speed limit since, 0 if not */
+
+  cw_timing_t timing;                  /* end of transfer record */
+  bool has_timing;
+} cw_stream_t;
+
+/* Metrics connection: response is built at accept, written when writable */
+typedef struct {
+  int fd;                              /* -1 if unused */
+  char *buf;                           /* response */
+  size_t len, off;                     /* response size, bytes written */
+  bool request;                        /* request received (or client shut down) */
+  bool armed;                          /* registered with backend (epoll, io_uring) */
+  bool closing;                        /* shut down, io_uring poll still pending */
+  uint64_t deadline_ms;
+} cw_metrics_conn_t;
+
+/* Latency distribution: bucket i counts values from 2^(i-1) to 2^i - 1 ns */
+typedef struct {
+  uint64_t count, sum, max;
+  uint64_t buckets[HISTOGRAM_BUCKETS];
+} cw_histogram_t;
+
+/* Self instrumentation (--stats) */
+typedef struct {
+  uint64_t reads;                      /* read calls returning data */
+  uint64_t bytes;
+  uint64_t writes, short_writes, write_errors;
+  uint64_t read_ns;                    /* time data being parsed has been read */
+  uint64_t pending_ns;                 /* time oldest buffered output data has been read */
+  cw_histogram_t read;                 /* read syscall */
+  cw_histogram_t parse;                /* parsing of a chunk (results included) */
+  cw_histogram_t emit;                 /* data read to result written */
+} cw_pstats_t;
+
+typedef struct {
+  int out_fd;
+  cw_stream_t *streams;
+  unsigned int count;                  /* number of streams */
+  unsigned int alive;                  /* number of streams not yet closed */
+  char *buffer;                        /* read buffer (shared by all streams) */
+  size_t buffer_size;
+
+  /* Output coalescing: flushed once per wakeup */
+  int format;                          /* CW_OUTPUT_* */
+  char out[OUTPUT_BUFFER_SIZE];
+  size_t out_len;
+  unsigned int interval_ms;            /* minimum delay between two results of a stream */
+
+  /* Low speed detection (transfer restarted by caller) */
+  uint64_t low_speed;                  /* bytes/s, 0 if disabled */
+  uint64_t low_speed_ms;
+  uint64_t offset;                     /* resumed transfer: bytes received before */
+
+  /* Raw input copy: duplicated in kernel (tee, splice) when input is a pipe */
+  int tee_fd;                          /* -1 if disabled */
+  int tee_pipe[2];                     /* intermediate pipe, -1 when tee_fd is a pipe */
+  bool tee_splice;                     /* false: read then write */
+
+  cw_shm_t *shm;                       /* progress export, NULL if disabled */
+  cw_rec_t *rec;                       /* progress recording, NULL if disabled */
+
+  int metrics_fd;                      /* listening socket, -1 if disabled */
+  const char *metrics_path;
+  cw_metrics_conn_t metrics_conns[METRICS_CONNS_MAX];
+
+  cw_pstats_t *pstats;                 /* self instrumentation, NULL if disabled */
+  const cw_hooks_t *hooks;             /* streams handled by caller, NULL if none */
+} cw_context_t;
+
+/* Signal state before filter, restored when it returns */
+typedef struct {
+  bool saved;
+  sigset_t mask;
+#ifndef HAVE_CW_EPOLL
+  unsigned int count;                  /* number of handlers installed */
+  int signals[4];
+  struct sigaction actions[4];
+#endif
+} cw_sigstate_t;
+
+volatile sig_atomic_t exit_request = 0;
+volatile sig_atomic_t dump_request = 0;  /* SIGUSR1 (--stats) */
+
+#ifndef HAVE_CW_EPOLL
+/* Signal handler. */
+static void signal_handler (int sig)
+{
+  //CW_WARNING("signal %d received", sig);
+  if (sig == SIGUSR1)
+    dump_request = 1;
+  else
+    exit_request = (sig == SIGCHLD) ? 1 : -1;
+}
+#endif
+
+/* Monotonic clock in milliseconds */
+static uint64_t now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Monotonic clock in nanoseconds (self instrumentation) */
+static uint64_t now_ns (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+}
+
+static void histogram_add (cw_histogram_t *h, uint64_t ns)
+{
+  int i = (ns) ? 64 - __builtin_clzll(ns) : 0;
+
+  h->buckets[(i < HISTOGRAM_BUCKETS) ? i : HISTOGRAM_BUCKETS - 1]++;
+  h->count++;
+  h->sum += ns;
+  if (ns > h->max)
+    h->max = ns;
+}
+
+/* Upper bound of the bucket holding given fraction (per mille) of values */
+static uint64_t histogram_percentile (const cw_histogram_t *h, unsigned int permille)
+{
+  uint64_t rank = (h->count * permille + 999) / 1000, n = 0;
+
+  for (int i = 0; i < HISTOGRAM_BUCKETS; i++) {
+    n += h->buckets[i];
+    if (n >= rank && n > 0)
+      return ((uint64_t)1 << i) - 1 < h->max ? ((uint64_t)1 << i) - 1 : h->max;
+  }
+  return h->max;
+}
+
+static char *format_ns (char *buf, size_t len, uint64_t ns)
+{
+  if (ns < 10000)
+    snprintf(buf, len, "%" PRIu64 "ns", ns);
+  else if (ns < 10000000)
+    snprintf(buf, len, "%" PRIu64 "us", ns / 1000);
+  else
+    snprintf(buf, len, "%" PRIu64 "ms", ns / 1000000);
+  return buf;
+}
+
+/**
+ * Write output buffer content.
+ *
+ * \param[in] ctx filter context
+ */
+static void output_flush (cw_context_t *ctx)
+{
+  size_t off = 0;
+  ssize_t n;
+
+  while (off < ctx->out_len) {
+    n = write(ctx->out_fd, &ctx->out[off], ctx->out_len - off);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      CW_ERROR_ERRNO(errno, "write");
+      if (ctx->pstats)
+        ctx->pstats->write_errors++;
+      break;
+    }
+    if (ctx->pstats) {
+      ctx->pstats->writes++;
+      if ((size_t)n < ctx->out_len - off)
+        ctx->pstats->short_writes++;
+    }
+    off += (size_t)n;
+  }
+
+  if (ctx->pstats && ctx->out_len > 0)
+    histogram_add(&ctx->pstats->emit, now_ns() - ctx->pstats->pending_ns);
+  ctx->out_len = 0;
+}
+
+/* Make room for one record in output buffer */
+static void output_reserve (cw_context_t *ctx)
+{
+  if (ctx->out_len + OUTPUT_RECORD_MAX > sizeof(ctx->out))
+    output_flush(ctx);
+  /* Results written by periodic work: nothing has just been read */
+  if (ctx->pstats && ctx->out_len == 0)
+    ctx->pstats->pending_ns = (ctx->pstats->read_ns) ? ctx->pstats->read_ns : now_ns();
+}
+
+/**
+ * Append formatted text to output buffer.
+ */
+static void output_printf (cw_context_t *ctx, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  output_reserve(ctx);
+
+  va_start(ap, fmt);
+  n = vsnprintf(&ctx->out[ctx->out_len], sizeof(ctx->out) - ctx->out_len, fmt, ap);
+  va_end(ap);
+
+  if (n > 0)
+    ctx->out_len += ((size_t)n < sizeof(ctx->out) - ctx->out_len) ? (size_t)n :
+        sizeof(ctx->out) - ctx->out_len - 1;
+}
+
+/* Wall clock in milliseconds since Epoch (machine readable output) */
+static uint64_t wall_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + (uint64_t)ts.tv_nsec / 1000000;
+}
+
+static void record_init (cw_record_t *r, cw_context_t *ctx, cw_stream_t *s,
+    uint32_t type)
+{
+  memset(r, 0, sizeof(*r));
+  r->type = type;
+  r->stream = (uint32_t)(s - ctx->streams) + 1;
+  r->time = wall_ms();
+}
+
+/**
+ * Append a machine readable record to output buffer: copied as is
+ * (binary) or as a JSON object on its own line.
+ *
+ * \param[in] ctx filter context
+ * \param[in] r record
+ */
+static void output_record (cw_context_t *ctx, const cw_record_t *r)
+{
+  static const char *types[] = { "", "progress", "timing", "summary", "end" };
+
+  if (ctx->format == CW_OUTPUT_BINARY) {
+    output_reserve(ctx);
+    memcpy(&ctx->out[ctx->out_len], r, sizeof(*r));
+    ctx->out_len += sizeof(*r);
+    return;
+  }
+
+  switch (r->type) {
+    case CW_RECORD_PROGRESS:
+      output_printf(ctx, "{\"type\":\"%s\",\"stream\":%" PRIu32 ",\"time\":%" PRIu64
+          ",\"fields\":%" PRIu32 ",\"percent\":%" PRId32 ",\"total\":%" PRIu64
+          ",\"received\":%" PRIu64 ",\"uploaded\":%" PRIu64 ",\"speed\":%" PRIu64
+          ",\"dl_speed\":%" PRIu64 ",\"ul_speed\":%" PRIu64 ",\"time_total\":%" PRId64
+          ",\"time_spent\":%" PRId64 ",\"time_left\":%" PRId64 ",\"avg_speed\":%" PRIu64
+          ",\"eta\":%" PRId64 ",\"transfers\":%" PRIu32 ",\"live\":%" PRIu32
+          ",\"stalled\":%s}\n", types[r->type], r->stream, r->time,
+          r->u.progress.fields, r->u.progress.percent, r->u.progress.total,
+          r->u.progress.received, r->u.progress.uploaded, r->u.progress.speed,
+          r->u.progress.dl_speed, r->u.progress.ul_speed, r->u.progress.time_total,
+          r->u.progress.time_spent, r->u.progress.time_left, r->u.progress.avg_speed,
+          r->u.progress.eta, r->u.progress.transfers, r->u.progress.live,
+          (r->u.progress.flags & CW_RECORD_STALLED) ? "true" : "false");
+      break;
+    case CW_RECORD_TIMING:
+      output_printf(ctx, "{\"type\":\"%s\",\"stream\":%" PRIu32 ",\"time\":%" PRIu64
+          ",\"dns_us\":%" PRId64 ",\"connect_us\":%" PRId64 ",\"tls_us\":%" PRId64
+          ",\"wait_us\":%" PRId64 ",\"transfer_us\":%" PRId64 ",\"speed\":%" PRIu64
+          ",\"size\":%" PRIu64 "}\n", types[r->type], r->stream, r->time,
+          r->u.timing.dns_us, r->u.timing.connect_us, r->u.timing.tls_us,
+          r->u.timing.wait_us, r->u.timing.transfer_us, r->u.timing.speed,
+          r->u.timing.size);
+      break;
+    case CW_RECORD_SUMMARY:
+      output_printf(ctx, "{\"type\":\"%s\",\"stream\":%" PRIu32 ",\"time\":%" PRIu64
+          ",\"avg\":%" PRIu64 ",\"min\":%" PRIu64 ",\"p50\":%" PRIu64 ",\"p95\":%" PRIu64
+          ",\"max\":%" PRIu64 ",\"samples\":%" PRIu64 "}\n", types[r->type], r->stream,
+          r->time, r->u.summary.avg, r->u.summary.min, r->u.summary.p50,
+          r->u.summary.p95, r->u.summary.max, r->u.summary.samples);
+      break;
+    default:
+      output_printf(ctx, "{\"type\":\"%s\",\"stream\":%" PRIu32 ",\"time\":%" PRIu64
+          "}\n", types[r->type], r->stream, r->time);
+      break;
+  }
+}
+
+/* Progress record (machine readable output) */
+static void record_progress (cw_context_t *ctx, cw_stream_t *s,
+    const cw_progress_t *result)
+{
+  cw_summary_t summary;
+  cw_record_t r;
+
+  record_init(&r, ctx, s, CW_RECORD_PROGRESS);
+  r.u.progress.fields = result->fields;
+  r.u.progress.percent = result->percent;
+  r.u.progress.total = result->total;
+  r.u.progress.received = result->received;
+  r.u.progress.uploaded = result->uploaded;
+  r.u.progress.speed = result->speed;
+  r.u.progress.dl_speed = result->dl_speed;
+  r.u.progress.ul_speed = result->ul_speed;
+  r.u.progress.time_total = result->time_total;
+  r.u.progress.time_spent = result->time_spent;
+  r.u.progress.time_left = result->time_left;
+  r.u.progress.transfers = result->transfers;
+  r.u.progress.live = result->live;
+  r.u.progress.eta = -1;
+
+  if (s->stats) {
+    cw_stats_get(s->stats, now_ms(), &summary);
+    s->stalled = summary.stalled;
+    r.u.progress.avg_speed = (uint64_t)summary.ewma;
+    r.u.progress.eta = summary.eta;
+    r.u.progress.flags = (summary.stalled) ? CW_RECORD_STALLED : 0;
+  }
+
+  output_record(ctx, &r);
+}
+
+/* Percentage is meaningful: total size is known (or all sizes of -Z) */
+static bool progress_sized (const cw_progress_t *r)
+{
+  return r->total > 0 ||
+      ((r->fields & CW_FIELD_PARALLEL) && (r->fields & CW_FIELD_PERCENT));
+}
+
+/**
+ * Write parsed result (to output buffer).
+ *
+ * \param[in] ctx filter context
+ * \param[in] s stream the result comes from
+ * \param[in] result progress data
+ */
+static void write_progress (cw_context_t *ctx, cw_stream_t *s,
+    const cw_progress_t *result)
+{
+  const char *tag = &s->tag[0];
+  char size[8], speed[8], avg[8], eta[10];
+  cw_summary_t summary;
+  bool sized = progress_sized(result);
+
+  if (ctx->format != CW_OUTPUT_ZENITY) {
+    record_progress(ctx, s, result);
+    goto done;
+  }
+
+  if (!(result->fields & CW_FIELD_METER)) {
+    output_printf(ctx, "%s%d\n%s# %d%%\n", tag, result->percent,
+        tag, result->percent);
+    goto done;
+  }
+
+  cw_format_size(speed, sizeof(speed), result->speed);
+  cw_format_size(size, sizeof(size), (result->received) ?
+      result->received : result->uploaded);
+
+  if (sized)
+    output_printf(ctx, "%s%d\n", tag, result->percent);
+
+  if (!s->stats) {
+    if (sized)
+      output_printf(ctx, "%s# %d%% (%s/s)\n", tag, result->percent, speed);
+    else /* Unknown size: no percentage, report transferred bytes */
+      output_printf(ctx, "%s# %s (%s/s)\n", tag, size, speed);
+    goto done;
+  }
+
+  cw_stats_get(s->stats, now_ms(), &summary);
+  s->stalled = summary.stalled;
+  cw_format_size(avg, sizeof(avg), (uint64_t)summary.ewma);
+
+  if (summary.stalled && sized)
+    output_printf(ctx, "%s# %d%% (stalled for %" PRId64 "s)\n", tag,
+        result->percent, summary.idle);
+  else if (summary.stalled)
+    output_printf(ctx, "%s# %s (stalled for %" PRId64 "s)\n", tag, size,
+        summary.idle);
+  else if (sized)
+    output_printf(ctx, "%s# %d%% (%s/s, avg %s/s, ETA %s)\n", tag,
+        result->percent, speed, avg, cw_format_time(eta, sizeof(eta), summary.eta));
+  else
+    output_printf(ctx, "%s# %s (%s/s, avg %s/s)\n", tag, size, speed, avg);
+
+done:
+  s->last = *result;
+  s->has_last = true;
+  s->has_pending = false;
+  s->last_ms = now_ms();
+}
+
+/**
+ * Write speed statistics summary of a stream (end of transfer).
+ */
+static void write_summary (cw_context_t *ctx, cw_stream_t *s)
+{
+  char avg[8], min[8], p50[8], p95[8], max[8];
+  cw_summary_t summary;
+
+  cw_stats_get(s->stats, now_ms(), &summary);
+  if (summary.samples == 0)
+    return;
+
+  if (ctx->format != CW_OUTPUT_ZENITY) {
+    cw_record_t r;
+
+    record_init(&r, ctx, s, CW_RECORD_SUMMARY);
+    r.u.summary.avg = (uint64_t)summary.ewma;
+    r.u.summary.min = summary.min;
+    r.u.summary.p50 = summary.p50;
+    r.u.summary.p95 = summary.p95;
+    r.u.summary.max = summary.max;
+    r.u.summary.samples = summary.samples;
+    output_record(ctx, &r);
+    return;
+  }
+
+  output_printf(ctx, "%s# avg %s/s (min %s/s, p50 %s/s, p95 %s/s, max %s/s)\n",
+      s->tag, cw_format_size(avg, sizeof(avg), (uint64_t)summary.ewma),
+      cw_format_size(min, sizeof(min), summary.min),
+      cw_format_size(p50, sizeof(p50), summary.p50),
+      cw_format_size(p95, sizeof(p95), summary.p95),
+      cw_format_size(max, sizeof(max), summary.max));
+}
+
+/* Split cumulative curl timings into phase durations (microseconds) */
+static void timing_phases (const cw_timing_t *t, int64_t phases[TIMING_PHASES])
+{
+  int64_t connected = (t->appconnect_us > 0) ? t->appconnect_us : t->connect_us;
+
+  phases[0] = t->namelookup_us;
+  phases[1] = t->connect_us - t->namelookup_us;
+  phases[2] = (t->appconnect_us > 0) ? t->appconnect_us - t->connect_us : 0;
+  phases[3] = t->starttransfer_us - connected;
+  phases[4] = t->total_us - t->starttransfer_us;
+
+  for (int i = 0; i < TIMING_PHASES; i++)
+    if (phases[i] < 0) /* connection reused, redirections */
+      phases[i] = 0;
+}
+
+static char *format_us (char *buf, size_t len, int64_t us)
+{
+  if (us < 10000000)
+    snprintf(buf, len, "%" PRId64 "ms", us / 1000);
+  else
+    snprintf(buf, len, "%" PRId64 ".%ds", us / 1000000, (int)(us / 100000 % 10));
+  return buf;
+}
+
+/**
+ * Format per phase latency breakdown of a finished transfer.
+ *
+ * \param[out] buf output string
+ * \param[in] len size of buf
+ * \param[in] t timing record
+ * \return buf
+ */
+char *cw_format_timing (char *buf, size_t len, const cw_timing_t *t)
+{
+  char d[TIMING_PHASES][24], speed[8], size[8];
+  int64_t phases[TIMING_PHASES];
+
+  timing_phases(t, phases);
+  for (int i = 0; i < TIMING_PHASES; i++)
+    format_us(d[i], sizeof(d[i]), phases[i]);
+
+  snprintf(buf, len, "dns %s, connect %s, tls %s, wait %s, transfer %s (%s/s, %s)",
+      d[0], d[1], d[2], d[3], d[4], cw_format_size(speed, sizeof(speed), t->speed),
+      cw_format_size(size, sizeof(size), t->size));
+  return buf;
+}
+
+static void write_timing (cw_context_t *ctx, cw_stream_t *s,
+    const cw_timing_t *t)
+{
+  char text[OUTPUT_RECORD_MAX - STREAM_TAG_SIZE - 4];
+  int64_t phases[TIMING_PHASES];
+  cw_record_t r;
+
+  if (ctx->format != CW_OUTPUT_ZENITY) {
+    timing_phases(t, phases);
+    record_init(&r, ctx, s, CW_RECORD_TIMING);
+    r.u.timing.dns_us = phases[0];
+    r.u.timing.connect_us = phases[1];
+    r.u.timing.tls_us = phases[2];
+    r.u.timing.wait_us = phases[3];
+    r.u.timing.transfer_us = phases[4];
+    r.u.timing.speed = t->speed;
+    r.u.timing.size = t->size;
+    output_record(ctx, &r);
+  } else {
+    output_printf(ctx, "%s# %s\n", s->tag, cw_format_timing(text, sizeof(text), t));
+  }
+  s->timing = *t;
+  s->has_timing = true;
+}
+
+/* Compare what is written of two results */
+static bool progress_equal (const cw_progress_t *a, const cw_progress_t *b)
+{
+  return (a->percent == b->percent && a->speed == b->speed &&
+      a->fields == b->fields && (progress_sized(a) ||
+      (a->received == b->received && a->uploaded == b->uploaded)));
+}
+
+/* Current stall state of a stream */
+static bool stream_stalled (cw_stream_t *s)
+{
+  cw_summary_t summary;
+
+  cw_stats_get(s->stats, now_ms(), &summary);
+  return summary.stalled;
+}
+
+/**
+ * Publish latest state of a stream (shared memory export). Every parsed
+ * result is published: no rate limiting, no duplicate removal.
+ */
+static void stream_export (cw_context_t *ctx, cw_stream_t *s,
+    const cw_progress_t *result)
+{
+  cw_summary_t summary = {0};
+
+  if (!ctx->shm)
+    return;
+
+  if (s->stats)
+    cw_stats_get(s->stats, now_ms(), &summary);
+
+  cw_shm_publish(ctx->shm, (unsigned int)(s - ctx->streams), result,
+      (uint64_t)summary.ewma, (summary.stalled) ? CW_SHM_STALLED : CW_SHM_RUNNING);
+}
+
+/**
+ * Handle a new parsed result: drop it if nothing changed, hold it back
+ * if stream has been updated too recently.
+ *
+ * \param[in] ctx filter context
+ * \param[in] s stream the result comes from
+ * \param[in] result progress data
+ */
+static void emit_progress (cw_context_t *ctx, cw_stream_t *s,
+    const cw_progress_t *result)
+{
+  if (ctx->hooks) {
+    ctx->hooks->progress(ctx->hooks->data, (unsigned int)(s - ctx->streams), result);
+    return;
+  }
+
+  if (s->stats)
+    cw_stats_update(s->stats, result, now_ms());
+  stream_export(ctx, s, result);
+  if (ctx->rec)
+    cw_rec_append(ctx->rec, (unsigned int)(s - ctx->streams), result);
+
+  /* Transfer not started yet */
+  if ((result->fields & CW_FIELD_METER) && result->percent == 0 &&
+      result->received == 0 && result->uploaded == 0)
+    return;
+
+  if (s->has_last && progress_equal(&s->last, result) &&
+      !(s->stats && stream_stalled(s) != s->stalled)) {
+    s->has_pending = false;
+    return;
+  }
+
+  if (ctx->interval_ms && s->has_last &&
+      now_ms() - s->last_ms < ctx->interval_ms) {
+    s->pending = *result;
+    s->has_pending = true;
+    return;
+  }
+
+  write_progress(ctx, s, result);
+}
+
+/* One line per latency histogram */
+static void pstats_histogram (const char *name, const cw_histogram_t *h)
+{
+  char p50[24], p90[24], p99[24], max[24], avg[24];
+
+  fprintf(stderr, "stats: %-5s %" PRIu64 " samples, avg %s, p50 %s, p90 %s, "
+      "p99 %s, max %s\n", name, h->count,
+      format_ns(avg, sizeof(avg), (h->count) ? h->sum / h->count : 0),
+      format_ns(p50, sizeof(p50), histogram_percentile(h, 500)),
+      format_ns(p90, sizeof(p90), histogram_percentile(h, 900)),
+      format_ns(p99, sizeof(p99), histogram_percentile(h, 990)),
+      format_ns(max, sizeof(max), h->max));
+}
+
+/**
+ * Write self instrumentation report (stderr): counters, CPU time and
+ * latency histograms (read syscall, parsing, read to output write).
+ *
+ * \param[in] ctx filter context
+ */
+static void pstats_dump (cw_context_t *ctx)
+{
+  const cw_pstats_t *ps = ctx->pstats;
+  unsigned long lines = 0, results = 0, overflows = 0;
+  cw_counters_t counters;
+  struct rusage ru;
+  uint64_t cpu_us = 0;
+  char cpu[24], per[24];
+
+  for (unsigned int i = 0; i < ctx->count; i++) {
+    cw_parser_counters(ctx->streams[i].parser, &counters);
+    lines += counters.lines;
+    results += counters.results;
+    overflows += counters.overflows;
+  }
+
+  if (getrusage(RUSAGE_SELF, &ru) == 0)
+    cpu_us = (uint64_t)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 +
+        (uint64_t)(ru.ru_utime.tv_usec + ru.ru_stime.tv_usec);
+
+  fprintf(stderr, "stats: reads %" PRIu64 ", bytes %" PRIu64 ", lines %lu, "
+      "results %lu, overflows %lu\n"
+      "stats: writes %" PRIu64 ", short writes %" PRIu64 ", write errors %" PRIu64 "\n"
+      "stats: cpu %s (%s per result)\n", ps->reads, ps->bytes, lines, results,
+      overflows, ps->writes, ps->short_writes, ps->write_errors,
+      format_ns(cpu, sizeof(cpu), cpu_us * 1000),
+      format_ns(per, sizeof(per), (results) ? cpu_us * 1000 / results : 0));
+  pstats_histogram("read", &ps->read);
+  pstats_histogram("parse", &ps->parse);
+  pstats_histogram("emit", &ps->emit);
+}
+
+/**
+ * Create listening Unix socket for metrics. A stale socket file is
+ * replaced, any other file is left untouched.
+ *
+ * \param[in] path socket path
+ * \return listening socket, -1 on failure
+ */
+static int metrics_listen (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    CW_ERROR("%s: socket path too long", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, 8) == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Metrics of one stream, each family line comes from it */
+#define METRICS_VALUES 11
+
+typedef struct {
+  int64_t values[METRICS_VALUES];  /* same order as metrics_families[] */
+  bool has_timing;
+  int64_t phases[TIMING_PHASES];
+} cw_metrics_sample_t;
+
+static const struct {
+  const char *name;
+  const char *type;
+  const char *help;
+} metrics_families[METRICS_VALUES + 1] = {
+  { "cw_up", "gauge", "1 while input is open, 0 once it is closed." },
+  { "cw_transferred_bytes", "gauge", "Bytes received and sent so far." },
+  { "cw_size_bytes", "gauge", "Transfer size, 0 if unknown." },
+  { "cw_progress_percent", "gauge", "Transfer progress (0 to 100)." },
+  { "cw_speed_bytes_per_second", "gauge", "Current transfer speed." },
+  { "cw_eta_seconds", "gauge", "Estimated time left, -1 if unknown." },
+  { "cw_input_bytes_total", "counter", "Bytes read from input." },
+  { "cw_lines_total", "counter", "Input lines read." },
+  { "cw_results_total", "counter", "Progress results parsed from input." },
+  { "cw_parse_errors_total", "counter", "Input lines which are not progress data." },
+  { "cw_overflows_total", "counter",
+    "Input lines with a field too long to be progress data." },
+  { "cw_phase_seconds", "gauge",
+    "Latency breakdown of finished transfer (dns, connect, tls, wait, transfer)." },
+};
+
+/* Take metrics of a stream */
+static void metrics_sample (cw_stream_t *s, cw_metrics_sample_t *m)
+{
+  const cw_progress_t *r = (s->has_pending) ? &s->pending : &s->last;
+  bool known = (s->has_last || s->has_pending);
+  int64_t eta = (r->fields & CW_FIELD_METER) ? r->time_left : -1;
+  cw_counters_t counters;
+  cw_summary_t summary;
+
+  cw_parser_counters(s->parser, &counters);
+
+  if (s->stats) {
+    cw_stats_get(s->stats, now_ms(), &summary);
+    eta = summary.eta;
+  }
+
+  m->values[0] = (s->fd >= 0) ? 1 : 0;
+  m->values[1] = (known) ? (int64_t)(r->received + r->uploaded) : 0;
+  m->values[2] = (known) ? (int64_t)r->total : 0;
+  m->values[3] = (known) ? r->percent : 0;
+  m->values[4] = (known) ? (int64_t)r->speed : 0;
+  m->values[5] = (known) ? eta : -1;
+  m->values[6] = (int64_t)counters.bytes;
+  m->values[7] = (int64_t)counters.lines;
+  m->values[8] = (int64_t)counters.results;
+  m->values[9] = (int64_t)(counters.lines - counters.results);
+  m->values[10] = (int64_t)counters.overflows;
+
+  m->has_timing = s->has_timing;
+  if (s->has_timing)
+    timing_phases(&s->timing, m->phases);
+}
+
+/* Append text to metrics buffer, nothing if it doesn't fit */
+static void metrics_printf (char *buf, size_t size, size_t *len, const char *fmt, ...)
+{
+  va_list ap;
+  int n;
+
+  va_start(ap, fmt);
+  n = vsnprintf(buf + *len, size - *len, fmt, ap);
+  va_end(ap);
+
+  if (n > 0 && (size_t)n < size - *len)
+    *len += (size_t)n;
+  else
+    buf[*len] = '\0';
+}
+
+/*
+ * Build metrics response (HTTP header included), NULL on failure.
+ * Prometheus text format: lines of a family are grouped, after its HELP
+ * and TYPE lines.
+ */
+static char *metrics_response (cw_context_t *ctx, size_t *len)
+{
+  static const char header[] =
+      "HTTP/1.0 200 OK\r\n"
+      "Content-Type: text/plain; version=0.0.4\r\n"
+      "Connection: close\r\n\r\n";
+  static const char *phases[TIMING_PHASES] = { "dns", "connect", "tls", "wait",
+    "transfer" };
+  size_t size = sizeof(header) + (METRICS_VALUES + 1) * 256 +
+      ctx->count * METRICS_STREAM_MAX;
+  cw_metrics_sample_t *samples;
+  char *buf;
+
+  buf = malloc(size);
+  samples = malloc(ctx->count * sizeof(*samples));
+  if (!buf || !samples) {
+    free(buf);
+    free(samples);
+    return NULL;
+  }
+
+  for (unsigned int i = 0; i < ctx->count; i++)
+    metrics_sample(&ctx->streams[i], &samples[i]);
+
+  memcpy(buf, header, sizeof(header));
+  *len = sizeof(header) - 1;
+  for (unsigned int k = 0; k <= METRICS_VALUES; k++) {
+    metrics_printf(buf, size, len, "# HELP %s %s\n# TYPE %s %s\n",
+        metrics_families[k].name, metrics_families[k].help,
+        metrics_families[k].name, metrics_families[k].type);
+
+    for (unsigned int i = 0; i < ctx->count; i++) {
+      if (k < METRICS_VALUES) {
+        metrics_printf(buf, size, len, "%s{stream=\"%u\"} %" PRId64 "\n",
+            metrics_families[k].name, i + 1, samples[i].values[k]);
+        continue;
+      }
+      for (int j = 0; j < TIMING_PHASES && samples[i].has_timing; j++)
+        metrics_printf(buf, size, len,
+            "%s{stream=\"%u\",phase=\"%s\"} %" PRId64 ".%06d\n",
+            metrics_families[k].name, i + 1, phases[j],
+            samples[i].phases[j] / 1000000, (int)(samples[i].phases[j] % 1000000));
+    }
+  }
+
+  free(samples);
+  return buf;
+}
+
+/**
+ * Release a metrics connection. A socket with an io_uring poll pending
+ * is only shut down: it is closed when the poll completes.
+ *
+ * \param[in] c metrics connection
+ */
+static void metrics_close (cw_metrics_conn_t *c)
+{
+  free(c->buf);
+  c->buf = NULL;
+
+#ifdef HAVE_CW_URING
+  if (c->armed && !c->closing) {
+    shutdown(c->fd, SHUT_RDWR);
+    c->closing = true;
+    return;
+  }
+#endif
+
+  close(c->fd);
+  c->fd = -1;
+  c->armed = c->closing = false;
+}
+
+/**
+ * Serve a metrics connection (non-blocking). Request content is ignored
+ * (same answer for any path) but it is read: client can't send it once
+ * connection is closed. Connection is closed when response is written
+ * and request is received.
+ *
+ * \param[in] c metrics connection
+ * \return true if connection is still open
+ */
+static bool metrics_io (cw_metrics_conn_t *c)
+{
+  char request[512];
+  ssize_t n;
+
+  while (c->off < c->len) {
+    n = write(c->fd, &c->buf[c->off], c->len - c->off);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EAGAIN)
+      break;
+    if (n <= 0) {
+      metrics_close(c);
+      return false;
+    }
+    c->off += (size_t)n;
+  }
+
+  while ((n = read(c->fd, request, sizeof(request))) != 0) {
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno != EAGAIN) {
+      metrics_close(c);
+      return false;
+    }
+    if (n < 0)
+      break;
+    c->request = true;
+  }
+  if (n == 0)
+    c->request = true;
+
+  if (c->off == c->len && c->request) {
+    metrics_close(c);
+    return false;
+  }
+
+  return true;
+}
+
+/**
+ * Accept pending metrics connections. Response is built now (snapshot of
+ * current state) and written by metrics_io(). Connections beyond
+ * METRICS_CONNS_MAX are dropped.
+ *
+ * \param[in] ctx filter context
+ */
+static void metrics_accept (cw_context_t *ctx)
+{
+  cw_metrics_conn_t *c;
+  int fd;
+
+  while ((fd = accept4(ctx->metrics_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    c = NULL;
+    for (unsigned int i = 0; !c && i < METRICS_CONNS_MAX; i++)
+      if (ctx->metrics_conns[i].fd < 0)
+        c = &ctx->metrics_conns[i];
+
+    if (!c || !(c->buf = metrics_response(ctx, &c->len))) {
+      CW_WARNING("metrics connection dropped");
+      close(fd);
+      continue;
+    }
+
+    c->fd = fd;
+    c->off = 0;
+    c->request = false;
+    c->deadline_ms = now_ms() + METRICS_TIMEOUT_MS;
+    metrics_io(c); /* response usually fits in socket buffer */
+  }
+}
+
+#ifndef HAVE_CW_EPOLL
+/* Events a metrics connection waits for (poll flags) */
+static short metrics_events (const cw_metrics_conn_t *c)
+{
+  return (c->off < c->len) ? (POLLIN | POLLOUT) : POLLIN;
+}
 #endif
 
-#define LINE_BUFFER_SIZE 128 /* cURL seems to have fixed it to 79, but let's be tolerant */
-#define WAIT_TIME_SECS    50 /* pselect/ppoll (in seconds) */
+/* Close expired metrics connections, return delay to next deadline */
+static int metrics_tick (cw_context_t *ctx, uint64_t now, int timeout)
+{
+  cw_metrics_conn_t *c;
+
+  for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+    c = &ctx->metrics_conns[i];
+    if (c->fd < 0 || c->closing)
+      continue;
+    if (c->deadline_ms <= now)
+      metrics_close(c);
+    else if ((int)(c->deadline_ms - now) < timeout)
+      timeout = (int)(c->deadline_ms - now);
+  }
+
+  return timeout;
+}
+
+/**
+ * Periodic work: write held back results which are now due, report
+ * stalled streams and flush output buffer. To be called after each wakeup.
+ *
+ * \param[in] ctx filter context
+ * \return delay (milliseconds) before next call is needed,
+ *         WAIT_TIME_SECS (in milliseconds) if nothing is scheduled
+ */
+static int context_tick (cw_context_t *ctx)
+{
+  uint64_t now = now_ms(), due;
+  int timeout = WAIT_TIME_SECS * 1000;
+  cw_stream_t *s;
+
+  if (dump_request && ctx->pstats) {
+    dump_request = 0;
+    output_flush(ctx);
+    pstats_dump(ctx);
+  }
+
+  for (unsigned int i = 0; i < ctx->count; i++) {
+    s = &ctx->streams[i];
+
+    /* Stall is detected even if curl doesn't write anything. Result is
+     * written again every period while stalled (idle time). */
+    if (s->stats && s->fd >= 0) {
+      if (s->has_last && !s->has_pending && (s->stalled || stream_stalled(s))) {
+        write_progress(ctx, s, &s->last);
+        stream_export(ctx, s, &s->last);
+      }
+      timeout = STALL_CHECK_MS;
+    }
+
+    /* Give up as soon as a stream is too slow for too long */
+    if (s->slow_ms && s->fd >= 0) {
+      if (now - s->slow_ms >= ctx->low_speed_ms) {
+        exit_request = CW_FILTER_LOW_SPEED;
+      } else if ((int)(s->slow_ms + ctx->low_speed_ms - now) < timeout) {
+        timeout = (int)(s->slow_ms + ctx->low_speed_ms - now);
+      }
+    }
+
+    if (!s->has_pending)
+      continue;
+
+    due = s->last_ms + ctx->interval_ms;
+    if (due <= now)
+      write_progress(ctx, s, &s->pending);
+    else if ((int)(due - now) < timeout)
+      timeout = (int)(due - now);
+  }
+
+  if (ctx->metrics_fd >= 0)
+    timeout = metrics_tick(ctx, now, timeout);
+
+  if (ctx->hooks && ctx->hooks->tick) {
+    int delay = ctx->hooks->tick(ctx->hooks->data, now);
+
+    if (delay >= 0 && delay < timeout)
+      timeout = delay;
+  }
+
+  output_flush(ctx);
+  return timeout;
+}
+
+/*
+ * Resumed transfer: curl reports remaining part only, make it look like
+ * the whole file. Nothing is changed until total size is known.
+ */
+static void progress_offset (cw_progress_t *r, uint64_t offset)
+{
+  if (r->total == 0)
+    return;
+
+  r->total += offset;
+  r->received += offset;
+  r->percent = r->received_percent = (int)(r->received * 100 / r->total);
+}
+
+/* Track time spent under low speed limit */
+static void low_speed_update (cw_context_t *ctx, cw_stream_t *s,
+    const cw_progress_t *result)
+{
+  if (result->speed >= ctx->low_speed)
+    s->slow_ms = 0;
+  else if (s->slow_ms == 0)
+    s->slow_ms = now_ms();
+}
+
+/**
+ * Feed raw data to a stream parser and write results.
+ *
+ * \param[in] ctx filter context
+ * \param[in] s stream the data has been read from
+ * \param[in] p input data
+ * \param[in] sz number of bytes of input data
+ */
+static void process_chunk (cw_context_t *ctx, cw_stream_t *s, const char *p, size_t sz)
+{
+  cw_progress_t result;
+  cw_timing_t timing;
+  uint64_t start = 0;
+  size_t n;
+
+  if (ctx->pstats) {
+    start = now_ns();
+    ctx->pstats->reads++;
+    ctx->pstats->bytes += sz;
+    if (!ctx->pstats->read_ns)
+      ctx->pstats->read_ns = start;
+  }
+
+  while (sz > 0) {
+    n = cw_parser_push(s->parser, p, sz);
+    while (cw_parser_pull(s->parser, &result)) {
+      if (result.fields & CW_FIELD_METER) {
+        if (ctx->offset)
+          progress_offset(&result, ctx->offset);
+        if (ctx->low_speed)
+          low_speed_update(ctx, s, &result);
+      }
+      emit_progress(ctx, s, &result);
+    }
+    p += n;
+    sz -= n;
+  }
+
+  /* End of transfer: final result first (hooks get it at close) */
+  if (!ctx->hooks && cw_parser_timing(s->parser, &timing)) {
+    if (s->has_pending)
+      write_progress(ctx, s, &s->pending);
+    write_timing(ctx, s, &timing);
+  }
+
+  if (ctx->pstats) {
+    histogram_add(&ctx->pstats->parse, now_ns() - start);
+    ctx->pstats->read_ns = 0;
+  }
+}
+
+/* Write a whole buffer, -1 on error */
+static int write_full (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+static void tee_disable (cw_context_t *ctx)
+{
+  CW_ERROR_ERRNO(errno, "tee output, raw data won't be copied anymore");
+  ctx->tee_fd = -1;
+}
+
+/**
+ * Move bytes from intermediate pipe to tee output.
+ *
+ * \param[in] ctx filter context
+ * \param[in] len number of bytes in intermediate pipe
+ * \return 0 on success, -1 on write error
+ */
+static int tee_drain (cw_context_t *ctx, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = splice(ctx->tee_pipe[0], NULL, ctx->tee_fd, NULL, len, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EINVAL) {
+      /* Output can't be spliced to (tty for example): copy */
+      n = read(ctx->tee_pipe[0], ctx->buffer, (len < ctx->buffer_size) ?
+          len : ctx->buffer_size);
+      if (n <= 0 || write_full(ctx->tee_fd, ctx->buffer, (size_t)n) < 0)
+        return -1;
+      ctx->tee_splice = false;
+    } else if (n <= 0) {
+      return -1;
+    }
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/**
+ * Read available data of a stream and copy it to tee output.
+ * Bytes are first duplicated (they stay in input pipe), then exactly
+ * the same bytes are read for parsing.
+ *
+ * \param[in] ctx filter context
+ * \param[in] s stream to read from
+ * \return same as read()
+ */
+static ssize_t tee_read (cw_context_t *ctx, cw_stream_t *s)
+{
+  ssize_t n, sz;
+
+  if (ctx->tee_splice) {
+    n = tee(s->fd, (ctx->tee_pipe[1] >= 0) ? ctx->tee_pipe[1] : ctx->tee_fd,
+        ctx->buffer_size, 0);
+    if (n > 0) {
+      if (ctx->tee_pipe[0] >= 0 && tee_drain(ctx, (size_t)n) < 0)
+        tee_disable(ctx);
+      return read(s->fd, ctx->buffer, (size_t)n);
+    }
+
+    if (n < 0 && errno == EINVAL) /* input or output is not a pipe */
+      ctx->tee_splice = false;
+    else if (n < 0 && errno == EPIPE)
+      tee_disable(ctx);
+    else if (n < 0) /* EINTR, EAGAIN */
+      return n;
+  }
+
+  sz = read(s->fd, ctx->buffer, ctx->buffer_size);
+  if (sz > 0 && ctx->tee_fd >= 0 &&
+      write_full(ctx->tee_fd, ctx->buffer, (size_t)sz) < 0)
+    tee_disable(ctx);
+
+  return sz;
+}
+
+/**
+ * Read available data of a stream and parse it.
+ *
+ * \param[in] ctx filter context
+ * \param[in] s stream to read from
+ * \return -1 when stream is exhausted (end of file or read error), 0 otherwise
+ */
+static inline int process_read (cw_context_t *ctx, cw_stream_t *s)
+{
+  uint64_t start = (ctx->pstats) ? now_ns() : 0;
+  ssize_t sz;
+
+  if (ctx->tee_fd >= 0)
+    sz = tee_read(ctx, s);
+  else
+    sz = read(s->fd, ctx->buffer, ctx->buffer_size);
+  if (ctx->pstats) {
+    uint64_t now = now_ns();
+
+    histogram_add(&ctx->pstats->read, now - start);
+    if (sz > 0)
+      ctx->pstats->read_ns = now;
+  }
+  if (sz < 0) {
+    if (errno == EINTR || errno == EAGAIN)
+      return 0;
+    CW_ERROR_ERRNO(errno, "read");
+    return -1;
+  }
+  if (sz == 0)
+    return -1;
+
+  process_chunk(ctx, s, ctx->buffer, (size_t)sz);
+  return 0;
+}
+
+/**
+ * Mark a stream as closed. File descriptor is left open (owned by caller).
+ * With hooks, caller may give next input of the stream: s->fd is then a
+ * new file descriptor to watch.
+ */
+static void stream_close (cw_context_t *ctx, cw_stream_t *s)
+{
+  cw_timing_t timing;
+  int fd;
+
+  if (ctx->hooks) {
+    fd = ctx->hooks->close(ctx->hooks->data, (unsigned int)(s - ctx->streams),
+        (cw_parser_timing(s->parser, &timing)) ? &timing : NULL);
+    if (fd >= 0) {
+      cw_parser_reset(s->parser);
+      s->has_last = s->has_pending = s->has_timing = false;
+      s->slow_ms = 0;
+      s->fd = fd;
+      return;
+    }
+    s->fd = -1;
+    ctx->alive--;
+    return;
+  }
+
+  if (s->has_pending)
+    write_progress(ctx, s, &s->pending);
+
+  if (s->stats)
+    write_summary(ctx, s);
+
+  if (ctx->format != CW_OUTPUT_ZENITY) {
+    cw_record_t r;
+
+    record_init(&r, ctx, s, CW_RECORD_END);
+    output_record(ctx, &r);
+  } else if (s->tag[0] != '\0') {
+    output_printf(ctx, "%s100\n", s->tag);
+  }
+
+  if (ctx->shm)
+    cw_shm_set_state(ctx->shm, (unsigned int)(s - ctx->streams), CW_SHM_DONE);
+
+  s->fd = -1;
+  ctx->alive--;
+}
+
+static void context_free (cw_context_t *ctx)
+{
+  /* Final flush: nothing held back is lost */
+  for (unsigned int i = 0; i < ctx->count; i++)
+    if (ctx->streams[i].has_pending)
+      write_progress(ctx, &ctx->streams[i], &ctx->streams[i].pending);
+  output_flush(ctx);
+
+  if (ctx->pstats) {
+    pstats_dump(ctx);
+    free(ctx->pstats);
+    ctx->pstats = NULL;
+  }
+
+  for (unsigned int i = 0; i < ctx->count; i++) {
+    cw_parser_free(ctx->streams[i].parser);
+    cw_stats_free(ctx->streams[i].stats);
+  }
+  free(ctx->streams);
+  free(ctx->buffer);
+  ctx->streams = NULL;
+  ctx->buffer = NULL;
+
+  if (ctx->tee_pipe[0] >= 0) {
+    close(ctx->tee_pipe[0]);
+    close(ctx->tee_pipe[1]);
+    ctx->tee_pipe[0] = ctx->tee_pipe[1] = -1;
+  }
+
+  if (ctx->shm) {
+    for (unsigned int i = 0; i < ctx->count; i++)
+      cw_shm_set_state(ctx->shm, i, CW_SHM_DONE);
+    cw_shm_close(ctx->shm);
+    ctx->shm = NULL;
+  }
+
+  if (ctx->metrics_fd >= 0) {
+    for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+      if (ctx->metrics_conns[i].fd >= 0) {
+        ctx->metrics_conns[i].armed = false;
+        metrics_close(&ctx->metrics_conns[i]);
+      }
+    }
+    close(ctx->metrics_fd);
+    unlink(ctx->metrics_path);
+    ctx->metrics_fd = -1;
+  }
+
+  cw_rec_close(ctx->rec);
+  ctx->rec = NULL;
+}
+
+/**
+ * Initialize filter context.
+ *
+ * \param[out] ctx filter context
+ * \param[in] in_fds input fds, NULL when results don't come from a stream
+ * \param[in] count number of input fds
+ * \param[in] out_fd output fd
+ * \param[in] opts filter options
+ * \return 0 on success, -1 on failure
+ */
+static int context_init (cw_context_t *ctx, const int *in_fds, unsigned int count,
+    int out_fd, const cw_options_t *opts)
+{
+  struct stat st;
+
+  if (count == 0 || out_fd < 0)
+    return -1;
+
+  for (unsigned int i = 0; in_fds && i < count; i++)
+    if (in_fds[i] < 0)
+      return -1;
+
+  ctx->streams = calloc(count, sizeof(cw_stream_t));
+  if (!ctx->streams) {
+    CW_ERROR_ERRNO(errno, "calloc");
+    return -1;
+  }
+
+  ctx->out_fd = out_fd;
+  ctx->out_len = 0;
+  ctx->interval_ms = (opts->rate) ? 1000 / opts->rate : 0;
+  ctx->format = opts->format;
+  ctx->low_speed = opts->low_speed;
+  ctx->hooks = opts->hooks;
+  ctx->low_speed_ms = (uint64_t)opts->low_speed_secs * 1000;
+  ctx->offset = opts->offset;
+  exit_request = 0; /* previous filter may have been interrupted */
+  ctx->count = count;
+  ctx->alive = count;
+
+  ctx->shm = NULL;
+  ctx->rec = NULL;
+  ctx->pstats = NULL;
+  ctx->metrics_fd = -1;
+  ctx->metrics_path = opts->metrics_path;
+  for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+    ctx->metrics_conns[i].fd = -1;
+    ctx->metrics_conns[i].buf = NULL;
+    ctx->metrics_conns[i].armed = ctx->metrics_conns[i].closing = false;
+  }
+  ctx->tee_fd = (in_fds && opts->tee_fd > 0) ? opts->tee_fd : -1;
+  ctx->tee_pipe[0] = ctx->tee_pipe[1] = -1;
+  ctx->tee_splice = (ctx->tee_fd >= 0);
+  if (ctx->tee_fd >= 0 && fstat(ctx->tee_fd, &st) == 0 && !S_ISFIFO(st.st_mode) &&
+      pipe2(ctx->tee_pipe, O_CLOEXEC) == -1) {
+    CW_WARNING("pipe2 failed (%s), raw data will be copied", strerror(errno));
+    ctx->tee_splice = false;
+  }
+
+  ctx->buffer_size = (opts->read_size) ? opts->read_size : READ_BUFFER_SIZE;
+  ctx->buffer = (in_fds) ? malloc(ctx->buffer_size) : NULL;
+  if (in_fds && !ctx->buffer) {
+    CW_ERROR_ERRNO(errno, "malloc");
+    context_free(ctx);
+    return -1;
+  }
+
+  if (opts->shm_path) {
+    ctx->shm = cw_shm_create(opts->shm_path, count);
+    if (!ctx->shm) {
+      context_free(ctx);
+      return -1;
+    }
+  }
+
+  if (opts->record_path) {
+    ctx->rec = cw_rec_create(opts->record_path, count);
+    if (!ctx->rec) {
+      context_free(ctx);
+      return -1;
+    }
+  }
+
+  /* Metrics are served by event loop: stream filters only */
+  if (in_fds && opts->metrics_path) {
+    ctx->metrics_fd = metrics_listen(opts->metrics_path);
+    if (ctx->metrics_fd < 0) {
+      context_free(ctx);
+      return -1;
+    }
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    ctx->streams[i].fd = (in_fds) ? in_fds[i] : -1;
+    /* Tag output lines only when there is something to distinguish */
+    if (count > 1)
+      snprintf(&ctx->streams[i].tag[0], STREAM_TAG_SIZE, "%u:", i + 1);
+
+    ctx->streams[i].parser = cw_parser_new((opts->mode) ? CW_FORMAT_BAR :
+        CW_FORMAT_METER);
+    if (!ctx->streams[i].parser) {
+      CW_ERROR_ERRNO(errno, "cw_parser_new");
+      context_free(ctx);
+      return -1;
+    }
+
+    if (opts->smooth) {
+      ctx->streams[i].stats = cw_stats_new(0, opts->stall_secs);
+      if (!ctx->streams[i].stats) {
+        CW_ERROR_ERRNO(errno, "cw_stats_new");
+        context_free(ctx);
+        return -1;
+      }
+    }
+  }
+
+  if (opts->pstats) {
+    ctx->pstats = calloc(1, sizeof(cw_pstats_t));
+    if (!ctx->pstats) {
+      CW_ERROR_ERRNO(errno, "calloc");
+      context_free(ctx);
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+#ifdef HAVE_CW_EPOLL
+/**
+ * Block SIGINT, SIGTERM and SIGCHLD and create a file descriptor to
+ * receive them (no signal handler involved).
+ *
+ * \param[out] orig signal state before this call (see signals_restore)
+ * \param[in] ctx filter context: SIGUSR1 too for statistics dump, no
+ *                SIGCHLD with hooks (children are caller's business)
+ * \return signalfd, -1 on failure
+ */
+static int signals_fd_setup (cw_sigstate_t *orig, const cw_context_t *ctx)
+{
+  sigset_t mask;
+  int fd;
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  if (!ctx->hooks)
+    sigaddset(&mask, SIGCHLD);
+  if (ctx->pstats)
+    sigaddset(&mask, SIGUSR1);
 
-typedef struct {
-  int in_fd;
-  int out_fd;
-  int (*cw_parsing_func)(int fd, const char *str, size_t len);
-} cw_context_t;
+  if (sigprocmask(SIG_BLOCK, &mask, &orig->mask) < 0) {
+    CW_ERROR_ERRNO(errno, "sigprocmask");
+    return -1;
+  }
+  orig->saved = true;
 
-volatile sig_atomic_t exit_request = 0;
+  fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+  if (fd == -1)
+    CW_ERROR_ERRNO(errno, "signalfd");
 
-/* Signal handler. */
-static void signal_handler (int sig)
+  return fd;
+}
+
+/* Read pending signals, set exit_request accordingly */
+static void signals_fd_read (int fd)
 {
-  //CW_WARNING("signal %d received", sig);
-  exit_request = (sig == SIGCHLD) ? 1 : -1;
+  struct signalfd_siginfo si;
+
+  while (read(fd, &si, sizeof(si)) == sizeof(si)) {
+    if (si.ssi_signo == SIGUSR1)
+      dump_request = 1;
+    else
+      exit_request = (si.ssi_signo == SIGCHLD) ? 1 : -1;
+  }
 }
 
 /**
- * Parse cURL progress meter.
- *
- * It looks like this:
- *   % Total    % Received % Xferd  Average Speed   Time    Time     Time  Current
- *                                  Dload  Upload   Total   Spent    Left  Speed
- *  28 20.0M   28 5936k    0     0  2970k      0  0:00:06  0:00:01  0:00:05 2969k
+ * Arm timer (one-shot, absolute time). Timer is reprogrammed only if
+ * deadline is earlier than current one: an early expiration costs one
+ * wakeup, a syscall per wakeup costs more.
  *
- * \param[in] fd write output to fd stream descriptor
- * \param[in] str '\0' terminated string
- * \param[in] len string length (strlen, ending '\0' not counted)
- * \return parsed number (percent)
+ * \param[in] fd timerfd
+ * \param[in] ms delay in milliseconds, nothing scheduled if WAIT_TIME_SECS or more
+ * \param[in,out] armed current deadline (milliseconds), 0 if not armed
  */
-static int parse_curl_progress_meter (int fd, const char *str, size_t len)
+static void timer_set (int fd, int ms, uint64_t *armed)
 {
-  char tmp[8];
-  int percent, i;
+  struct itimerspec its = {0};
+  uint64_t deadline;
 
-  /* First number is integer (from 0 to 100) */
-  strncpy(&tmp[0], str, 4);
-  percent = atoi(tmp);
+  if (ms >= WAIT_TIME_SECS * 1000)
+    return;
 
-  if (percent > 0) {
-    /* Grab last number (speed) */
-    i = 1;
-    while (i < (int)sizeof(tmp) && str[len - i] != ' ')
-      i++;
-    memcpy(&tmp[0], &str[len - i + 1], i - 1);
-    if (i > 2 && tmp[i-2] == ' ')
-      i--;
-    tmp[i-1] = '\0';
+  deadline = now_ms() + (uint64_t)ms;
+  if (*armed && *armed <= deadline)
+    return;
 
-    dprintf(fd, "%d\n# %d%% (%s/s)\n", percent, percent, tmp);
+  its.it_value.tv_sec = (time_t)(deadline / 1000);
+  its.it_value.tv_nsec = (long)(deadline % 1000) * 1000000L;
+  if (timerfd_settime(fd, TFD_TIMER_ABSTIME, &its, NULL) == -1) {
+    CW_ERROR_ERRNO(errno, "timerfd_settime");
+    return;
   }
 
-  return 0;
+  *armed = deadline;
 }
-
+#else
 /**
- * Parse cURL progress bar.
- *
- * It looks like this:
- * ################                                                          23,3%
- * ############################################                              61,1%
- * #############################################################             85,9%
+ * Block SIGINT, SIGTERM and SIGCHLD (they will be unblocked during wait
+ * syscall only) and install handlers.
  *
- * \param[in] write output (parsed results) to fd stream descriptor
- * \param[in] str '\0' terminated string
- * \param[in] len string length (strlen, ending '\0' not counted)
- * \return parsed (rounded) number (percent)
+ * \param[out] orig signal state before this call (see signals_restore)
+ * \param[in] ctx filter context: SIGUSR1 too for statistics dump, no
+ *                SIGCHLD with hooks (children are caller's business)
+ * \return 0 on success, -1 on failure
  */
-static int parse_curl_progress_bar (int fd, const char *str, size_t len)
+static int signals_setup (cw_sigstate_t *orig, const cw_context_t *ctx)
 {
-  char tmp[8] = {61};
-  int percent;
+  sigset_t mask;
+  struct sigaction sa;
+  unsigned int n = 0;
+
+  orig->signals[n++] = SIGINT;
+  orig->signals[n++] = SIGTERM;
+  if (!ctx->hooks)
+    orig->signals[n++] = SIGCHLD;
+  if (ctx->pstats)
+    orig->signals[n++] = SIGUSR1;
+
+  sigemptyset(&mask);
+  for (unsigned int i = 0; i < n; i++)
+    sigaddset(&mask, orig->signals[i]);
+
+  if (sigprocmask(SIG_BLOCK, &mask, &orig->mask) < 0) {
+    CW_ERROR_ERRNO(errno, "sigprocmask");
+    return -1;
+  }
+  orig->saved = true;
+  orig->count = 0;
+
+  sa.sa_handler = signal_handler;
+  sa.sa_flags = 0;
+  sigemptyset(&sa.sa_mask); // signals to be blocked while the handler runs
 
-  memcpy(&tmp[0], str + len - 6, 6);
-  if (tmp[3] == ',' && tmp[5] == '%') {
-    tmp[3] = '\0';
-    percent = atoi(tmp);
-    dprintf(fd, "%d\n# %d%%\n", percent, percent);
+  for (unsigned int i = 0; i < n; i++) {
+    if (sigaction(orig->signals[i], &sa, &orig->actions[i])) {
+      CW_ERROR_ERRNO(errno, "sigaction");
+      return -1;
+    }
+    orig->count++;
   }
 
   return 0;
 }
+#endif
 
 /**
- * Read line (seek until delim character).
+ * Undo signals setup: callers (and children they start afterwards) get
+ * their signals back. Handlers are restored first, a signal still pending
+ * is delivered to its original handler.
  *
- * \param[in] buffer input data
- * \param[in,out] length number of bytes of buffer. Decreased by eaten value.
- * \param[out] eaten number of bytes treated (between 1 to length, delim character is included)
- * \param[in] delim Character to search in buffer
- * \return true is delim has been found in buffer
+ * \param[in] orig signal state saved by setup
  */
-static bool scan_character (char *buffer, size_t *length, size_t *eaten, const char delim)
+static void signals_restore (const cw_sigstate_t *orig)
 {
-  char *p = buffer;
-  size_t sz = *length;
-
-  while (sz > 0 && *p != delim)
-    sz--, p++;
-
-  if (sz > 0) {
-    *eaten = *length - sz + 1;
-    *length = sz - 1;
-  } else {
-    *eaten = *length;
-    *length = 0;
-  }
+#ifndef HAVE_CW_EPOLL
+  for (unsigned int i = 0; i < orig->count; i++)
+    sigaction(orig->signals[i], &orig->actions[i], NULL);
+#endif
 
-  return (sz > 0);
+  if (orig->saved)
+    sigprocmask(SIG_SETMASK, &orig->mask, NULL);
 }
 
-static inline int process_read (cw_context_t *ctx)
+/* Child process: unblock signals a filter may have blocked (before exec) */
+void cw_signals_reset (void)
 {
-  ssize_t orig_sz;
-  size_t sz, eaten, tmp;
-  char *p;
-
-  static char buffer[LINE_BUFFER_SIZE * 2];
-  static bool sync = false;                    /* synchronisation character is \r */
-  static char stats_buffer[LINE_BUFFER_SIZE];  /* cURL line to analyse */
-  static size_t stats_offset = 0;
-
-  orig_sz = read(ctx->in_fd, &buffer[0], sizeof(buffer));
-  if (orig_sz == 0)
-    return -1;
-
-  sz = (size_t)orig_sz;
-  p = &buffer[0];
-
-  while (sz > 0) {
-    if (scan_character(p, &sz, &eaten, '\r')) {
-      sync = true;
-      tmp = eaten;
-
-      if (stats_offset > 0) {
+  sigset_t mask;
 
-        if ((stats_offset + tmp) > sizeof(stats_buffer)) {
-          CW_ERROR("%s: stats_buffer overflow, bytes will be lost", __func__);
-          tmp = sizeof(stats_buffer) - stats_offset;
-          sync = false;
-        }
+  sigemptyset(&mask);
+  sigprocmask(SIG_SETMASK, &mask, NULL);
+}
 
-        if (tmp > 0) {
-          memcpy(&stats_buffer[stats_offset], p, tmp - 1); /* don't copy ending \r */
-          stats_offset += tmp;
-          stats_buffer[stats_offset - 1] = '\0';
-          ctx->cw_parsing_func(ctx->out_fd, &stats_buffer[0], stats_offset - 1);
-        }
+#ifdef HAVE_CW_EPOLL
+#define MAX_EVENTS 16
 
-        stats_offset = 0;
-      }
+/* Watch accepted metrics connections (edge triggered: metrics_io drains) */
+static void metrics_epoll_add (int epollfd, cw_context_t *ctx)
+{
+  struct epoll_event ev = { .events = EPOLLIN | EPOLLOUT | EPOLLET };
+  cw_metrics_conn_t *c;
 
-    } else if (sync) {
-      /* Check for overflow */
-      if ((stats_offset + eaten) > sizeof(stats_buffer)) {
-        sync = false;
-        stats_offset = 0;
-      } else {
-        memcpy(&stats_buffer[stats_offset], p, eaten);
-        stats_offset += eaten;
-      }
+  for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+    c = &ctx->metrics_conns[i];
+    if (c->fd < 0 || c->armed)
+      continue;
+    ev.data.ptr = c;
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, c->fd, &ev) == -1) {
+      CW_ERROR_ERRNO(errno, "epoll_ctl");
+      metrics_close(c);
+    } else {
+      c->armed = true;
     }
+  }
+}
 
-    p += eaten;
+/**
+ * Watch a stream. A regular file can't be polled but is always readable:
+ * it is read at once. Stream may get a new input when closed (hooks).
+ *
+ * \param[in] epollfd epoll instance
+ * \param[in] ctx filter context
+ * \param[in] s stream to watch
+ * \return 0 on success, -1 on failure
+ */
+static int epoll_watch (int epollfd, cw_context_t *ctx, cw_stream_t *s)
+{
+  struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+
+  while (s->fd >= 0) {
+    if (epoll_ctl(epollfd, EPOLL_CTL_ADD, s->fd, &ev) == 0)
+      return 0;
+    if (errno != EPERM) {
+      CW_ERROR_ERRNO(errno, "epoll_ctl");
+      return -1;
+    }
+    while (process_read(ctx, s) == 0)
+      ;
+    stream_close(ctx, s);
   }
 
   return 0;
 }
 
-#ifdef HAVE_CW_EPOLL
+/* Metrics connection an event belongs to, NULL if none */
+static cw_metrics_conn_t *metrics_conn (cw_context_t *ctx, void *ptr)
+{
+  for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++)
+    if (ptr == &ctx->metrics_conns[i])
+      return &ctx->metrics_conns[i];
+  return NULL;
+}
+
 /**
  * Read, parse data and write results.
- * This is a blocking function using epoll (Linux) syscall.
+ * This is a blocking function using epoll (Linux) syscall. Signals and
+ * periodic work (held back results, stall detection) are received as
+ * file descriptor events too (signalfd, timerfd).
  *
- * \param[in] in_fd input fd to read (raw statistics data) from
+ * \param[in] in_fds input fds to read (raw statistics data) from
+ * \param[in] count number of input fds
  * \param[in] out_fd output fd to write (parsed results) to
- * \param[in] mode use any non zero number when using curl's progress bar (-#)
+ * \param[in] opts filter options
  * \return <0: for any error
  *          0: success (there's nothing left to read)
- *         >0: SIGCHLD signal received
+ *          1: SIGCHLD signal received
+ *          2: a stream stayed under low speed limit (CW_FILTER_LOW_SPEED)
  */
-int cw_filter (int in_fd, int out_fd, int mode)
+int cw_filter_multi (const int *in_fds, unsigned int count, int out_fd,
+    const cw_options_t *opts)
 {
-  struct epoll_event ev, events[1];
-  int epollfd, n, i, timeout;
-  sigset_t mask, orig_mask;
-  struct sigaction sa;
+  struct epoll_event ev, events[MAX_EVENTS];
+  int epollfd, sigfd = -1, timerfd = -1, n, i, ret = 0;
+  uint64_t expirations, deadline = 0;
+  cw_sigstate_t sig = { .saved = false };
+  cw_metrics_conn_t *c;
   cw_context_t ctx;
+  cw_stream_t *s;
 
-  if (in_fd < 0 || out_fd < 0)
+  if (context_init(&ctx, in_fds, count, out_fd, opts) < 0)
     return -1;
 
-  epollfd = epoll_create(1);
+  epollfd = epoll_create1(EPOLL_CLOEXEC);
   if (epollfd == -1) {
-    CW_ERROR_ERRNO(errno, "epoll_create");
+    CW_ERROR_ERRNO(errno, "epoll_create1");
+    context_free(&ctx);
     return -2;
   }
 
-  /* Block the 3 signals until ppoll call */
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGINT);
-  sigaddset(&mask, SIGTERM);
-  sigaddset(&mask, SIGCHLD);
-
-  if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0) {
-    CW_ERROR_ERRNO(errno, "sigprocmask");
-    return -3;
+  sigfd = signals_fd_setup(&sig, &ctx);
+  timerfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  if (sigfd == -1 || timerfd == -1) {
+    if (timerfd == -1)
+      CW_ERROR_ERRNO(errno, "timerfd_create");
+    ret = -3;
+    goto out;
   }
 
-  ctx.in_fd = in_fd;
-  ctx.out_fd = out_fd;
-  ctx.cw_parsing_func = (mode) ? parse_curl_progress_bar :
-      parse_curl_progress_meter;
-
-  sa.sa_handler = signal_handler;
-  sa.sa_flags = 0;
-  sigemptyset(&sa.sa_mask); // signals to be blocked while the handler runs
-
-  if (sigaction(SIGINT, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -4;
+  /* Streams are identified by their address, other fds by their own */
+  ev.events = EPOLLIN;
+  ev.data.ptr = &sigfd;
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, sigfd, &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    ret = -4;
+    goto out;
   }
-
-  if (sigaction(SIGTERM, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -5;
+  ev.data.ptr = &timerfd;
+  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, timerfd, &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    ret = -4;
+    goto out;
   }
-
-  if (sigaction(SIGCHLD, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -6;
+  ev.data.ptr = &ctx.metrics_fd;
+  if (ctx.metrics_fd >= 0 &&
+      epoll_ctl(epollfd, EPOLL_CTL_ADD, ctx.metrics_fd, &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    ret = -4;
+    goto out;
   }
 
-  timeout = WAIT_TIME_SECS * 1000; /* milliseconds */
-
-  ev.events = EPOLLIN;
-  ev.data.fd = ctx.in_fd;
-  if (epoll_ctl(epollfd, EPOLL_CTL_ADD, ctx.in_fd, &ev) == -1) {
-    CW_ERROR_ERRNO(errno, "epoll_ctl");
-    close(epollfd);
-    return -7;
+  for (unsigned int j = 0; j < count; j++) {
+    if (epoll_watch(epollfd, &ctx, &ctx.streams[j]) < 0) {
+      ret = -4;
+      goto out;
+    }
   }
 
-  while (!exit_request) {
-    n = epoll_pwait(epollfd, &events[0], sizeof(events)/sizeof(struct epoll_event),
-        timeout, &orig_mask);
-    if (n == -1 || n > 1) {
-      printf("n=%d", n);
-      CW_ERROR_ERRNO(errno, "epoll_pwait");
-      return -8;
+  timer_set(timerfd, context_tick(&ctx), &deadline);
+
+  while (!exit_request && ctx.alive > 0) {
+    n = epoll_wait(epollfd, &events[0], MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      CW_ERROR_ERRNO(errno, "epoll_wait");
+      ret = -5;
+      goto out;
     }
-    i = 0;
-    if ((events[i].events & EPOLLIN) && (ctx.in_fd == events[i].data.fd) && \
-      process_read(&ctx) < 0) {
-      break;
-    } else if (events[i].events & (EPOLLERR | EPOLLHUP)) {
-      break;
+
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == &sigfd) {
+        signals_fd_read(sigfd);
+        continue;
+      }
+      if (events[i].data.ptr == &timerfd) {
+        read(timerfd, &expirations, sizeof(expirations));
+        deadline = 0;
+        continue;
+      }
+      if (events[i].data.ptr == &ctx.metrics_fd) {
+        metrics_accept(&ctx);
+        metrics_epoll_add(epollfd, &ctx);
+        continue;
+      }
+      if (ctx.metrics_fd >= 0 && (c = metrics_conn(&ctx, events[i].data.ptr))) {
+        if (c->fd >= 0)
+          metrics_io(c); /* closed fd leaves epoll set */
+        continue;
+      }
+
+      s = events[i].data.ptr;
+      if (s->fd < 0)
+        continue;
+
+      if (((events[i].events & EPOLLIN) && process_read(&ctx, s) < 0) ||
+          (!(events[i].events & EPOLLIN) &&
+           (events[i].events & (EPOLLERR | EPOLLHUP)))) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, s->fd, NULL);
+        stream_close(&ctx, s);
+        if (epoll_watch(epollfd, &ctx, s) < 0) {
+          ret = -4;
+          goto out;
+        }
+      }
     }
-  }
 
+    timer_set(timerfd, context_tick(&ctx), &deadline);
+  }
+  ret = exit_request;
+
+out:
+  if (timerfd != -1)
+    close(timerfd);
+  if (sigfd != -1)
+    close(sigfd);
+  signals_restore(&sig);
   close(epollfd);
-  return exit_request;
+  context_free(&ctx);
+  return ret;
 }
 #else
 #ifdef HAVE_CW_PPOLL
@@ -306,88 +1859,104 @@ int cw_filter (int in_fd, int out_fd, int mode)
  * Read, parse data and write results.
  * This is a blocking function using ppoll (Linux) syscall.
  *
- * \param[in] in_fd input fd to read (raw statistics data) from
+ * \param[in] in_fds input fds to read (raw statistics data) from
+ * \param[in] count number of input fds
  * \param[in] out_fd output fd to write (parsed results) to
- * \param[in] mode use any non zero number when using curl's progress bar (-#)
+ * \param[in] opts filter options
  * \return <0: for any error
  *          0: success (there's nothing left to read)
- *         >0: SIGCHLD signal received
+ *          1: SIGCHLD signal received
+ *          2: a stream stayed under low speed limit (CW_FILTER_LOW_SPEED)
  */
-int cw_filter (int in_fd, int out_fd, int mode)
+int cw_filter_multi (const int *in_fds, unsigned int count, int out_fd,
+    const cw_options_t *opts)
 {
-  struct pollfd readfds[1];
+  struct pollfd *readfds, *pfd;
   struct timespec timeout = {0};
-  int retval;
-  sigset_t mask, orig_mask;
-  struct sigaction sa;
+  int retval, ms, ret = 0;
+  cw_metrics_conn_t *c;
+  cw_sigstate_t sig = { .saved = false };
   cw_context_t ctx;
+  nfds_t nfds;
 
-  if (in_fd < 0 || out_fd < 0)
+  if (context_init(&ctx, in_fds, count, out_fd, opts) < 0)
     return -1;
 
-  /* Block the 3 signals until ppoll call */
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGINT);
-  sigaddset(&mask, SIGTERM);
-  sigaddset(&mask, SIGCHLD);
-
-  if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0) {
-    CW_ERROR_ERRNO(errno, "sigprocmask");
+  /* Then metrics socket (-1 if disabled) and metrics connections */
+  nfds = count + 1 + METRICS_CONNS_MAX;
+  readfds = calloc(nfds, sizeof(struct pollfd));
+  if (!readfds) {
+    CW_ERROR_ERRNO(errno, "calloc");
+    context_free(&ctx);
     return -2;
   }
 
-  ctx.in_fd = in_fd;
-  ctx.out_fd = out_fd;
-  ctx.cw_parsing_func = (mode) ? parse_curl_progress_bar :
-      parse_curl_progress_meter;
-
-  sa.sa_handler = signal_handler;
-  sa.sa_flags = 0;
-  sigemptyset(&sa.sa_mask); // signals to be blocked while the handler runs
-
-  if (sigaction(SIGINT, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -3;
+  if (signals_setup(&sig, &ctx) < 0) {
+    ret = -3;
+    goto out;
   }
 
-  if (sigaction(SIGTERM, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -4;
+  for (unsigned int i = 0; i < count; i++) {
+    readfds[i].fd = ctx.streams[i].fd;
+    readfds[i].events = POLLIN;
   }
+  readfds[count].fd = ctx.metrics_fd;
+  readfds[count].events = POLLIN;
 
-  if (sigaction(SIGCHLD, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -5;
-  }
+  ms = context_tick(&ctx);
 
-  timeout.tv_sec = WAIT_TIME_SECS;
+  while (!exit_request && ctx.alive > 0) {
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_nsec = (ms % 1000) * 1000000L;
 
-  readfds[0].fd = ctx.in_fd;
-  readfds[0].events = POLLIN;
+    for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+      c = &ctx.metrics_conns[i];
+      readfds[count + 1 + i].fd = c->fd;
+      readfds[count + 1 + i].events = (c->fd >= 0) ? metrics_events(c) : 0;
+    }
 
-  while (!exit_request) {
-    retval = ppoll(&readfds[0], sizeof(readfds)/sizeof(struct pollfd),
-        &timeout, &orig_mask);
+    retval = ppoll(readfds, nfds, &timeout, &sig.mask);
     if (retval < 0) {
       if (errno != EINTR) {
         CW_ERROR_ERRNO(errno, "ppoll");
-        return -6;
+        ret = -4;
+        goto out;
       }
-      break;
+      retval = 0; /* signal: exit request or statistics dump */
+    }
 
-    } else if (retval == 0) { /* timeout */
-      continue;
+    for (unsigned int i = 0; retval > 0 && i < count; i++) {
+      if (readfds[i].fd < 0)
+        continue;
 
-    } else if (retval == 1 && readfds[0].revents & POLLHUP) {
-      break;
+      if (((readfds[i].revents & POLLIN) &&
+           process_read(&ctx, &ctx.streams[i]) < 0) ||
+          (!(readfds[i].revents & POLLIN) &&
+           (readfds[i].revents & (POLLERR | POLLHUP | POLLNVAL)))) {
+        stream_close(&ctx, &ctx.streams[i]);
+        readfds[i].fd = ctx.streams[i].fd; /* -1 is ignored by ppoll */
+      }
+    }
 
-    } else if ((retval == 1 && readfds[0].revents & POLLIN) && \
-        process_read(&ctx) < 0) {
-      break;
+    for (unsigned int i = 0; retval > 0 && i < METRICS_CONNS_MAX; i++) {
+      c = &ctx.metrics_conns[i];
+      pfd = &readfds[count + 1 + i];
+      if (c->fd >= 0 && pfd->fd == c->fd && pfd->revents)
+        metrics_io(c);
     }
+
+    if (retval > 0 && (readfds[count].revents & POLLIN))
+      metrics_accept(&ctx);
+
+    ms = context_tick(&ctx);
   }
+  ret = exit_request;
 
-  return exit_request;
+out:
+  signals_restore(&sig);
+  free(readfds);
+  context_free(&ctx);
+  return ret;
 }
 #else
 #ifdef HAVE_CW_PSELECT
@@ -395,88 +1964,416 @@ int cw_filter (int in_fd, int out_fd, int mode)
  * Read, parse data and write results.
  * This is a blocking function using pselect syscall.
  *
- * \param[in] in_fd input fd to read (raw statistics data) from
+ * \param[in] in_fds input fds to read (raw statistics data) from
+ * \param[in] count number of input fds
  * \param[in] out_fd output fd to write (parsed results) to
- * \param[in] mode use any non zero number when using curl's progress bar (-#)
+ * \param[in] opts filter options
  * \return <0: for any error
  *          0: success (there's nothing left to read)
- *         >0: SIGCHLD signal received
+ *          1: SIGCHLD signal received
+ *          2: a stream stayed under low speed limit (CW_FILTER_LOW_SPEED)
  */
-int cw_filter (int in_fd, int out_fd, int mode)
+int cw_filter_multi (const int *in_fds, unsigned int count, int out_fd,
+    const cw_options_t *opts)
 {
-  fd_set readfds;
+  fd_set readfds, writefds;
   struct timespec timeout = {0};
-  int maxfd, retval;
-  sigset_t mask, orig_mask;
-  struct sigaction sa;
+  int maxfd, retval, ms, ret = 0;
+  cw_metrics_conn_t *c;
+  cw_sigstate_t sig = { .saved = false };
   cw_context_t ctx;
+  cw_stream_t *s;
 
-  if (in_fd < 0 || out_fd < 0)
+  if (context_init(&ctx, in_fds, count, out_fd, opts) < 0)
     return -1;
 
-  /* Block the 3 signals until pselect call */
-  sigemptyset(&mask);
-  sigaddset(&mask, SIGINT);
-  sigaddset(&mask, SIGTERM);
-  sigaddset(&mask, SIGCHLD);
-
-  if (sigprocmask(SIG_BLOCK, &mask, &orig_mask) < 0) {
-    CW_ERROR_ERRNO(errno, "sigprocmask");
-    return -2;
+  for (unsigned int i = 0; i < count; i++) {
+    if (in_fds[i] >= FD_SETSIZE) {
+      CW_ERROR("fd %d exceeds FD_SETSIZE", in_fds[i]);
+      context_free(&ctx);
+      return -2;
+    }
   }
 
-  ctx.in_fd = in_fd;
-  ctx.out_fd = out_fd;
-  ctx.cw_parsing_func = (mode) ? parse_curl_progress_bar :
-      parse_curl_progress_meter;
-
-  sa.sa_handler = signal_handler;
-  sa.sa_flags = 0;
-  sigemptyset(&sa.sa_mask);
-
-  if (sigaction(SIGINT, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -3;
+  if (ctx.metrics_fd >= FD_SETSIZE) {
+    CW_ERROR("fd %d exceeds FD_SETSIZE", ctx.metrics_fd);
+    context_free(&ctx);
+    return -2;
   }
 
-  if (sigaction(SIGTERM, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -4;
+  if (signals_setup(&sig, &ctx) < 0) {
+    ret = -3;
+    goto out;
   }
 
-  if (sigaction(SIGCHLD, &sa, NULL)) {
-    CW_ERROR_ERRNO(errno, "sigaction");
-    return -5;
-  }
+  ms = context_tick(&ctx);
 
-  timeout.tv_sec = WAIT_TIME_SECS;
+  while (!exit_request && ctx.alive > 0) {
+    timeout.tv_sec = ms / 1000;
+    timeout.tv_nsec = (ms % 1000) * 1000000L;
 
-  while (!exit_request) {
     FD_ZERO(&readfds);
-    FD_SET(ctx.in_fd, &readfds);
-    maxfd = ctx.in_fd;
+    FD_ZERO(&writefds);
+    maxfd = ctx.metrics_fd;
+    if (ctx.metrics_fd >= 0)
+      FD_SET(ctx.metrics_fd, &readfds);
+    for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+      c = &ctx.metrics_conns[i];
+      if (c->fd >= FD_SETSIZE)
+        metrics_close(c);
+      if (c->fd < 0)
+        continue;
+      FD_SET(c->fd, &readfds);
+      if (metrics_events(c) & POLLOUT)
+        FD_SET(c->fd, &writefds);
+      if (c->fd > maxfd)
+        maxfd = c->fd;
+    }
+    for (unsigned int i = 0; i < count; i++) {
+      s = &ctx.streams[i];
+      if (s->fd >= FD_SETSIZE) { /* next input given by hooks */
+        CW_ERROR("fd %d exceeds FD_SETSIZE", s->fd);
+        ret = -2;
+        goto out;
+      }
+      if (s->fd >= 0) {
+        FD_SET(s->fd, &readfds);
+        if (s->fd > maxfd)
+          maxfd = s->fd;
+      }
+    }
 
-    retval = pselect(maxfd + 1, &readfds, NULL, NULL, &timeout, &orig_mask);
+    retval = pselect(maxfd + 1, &readfds, &writefds, NULL, &timeout, &sig.mask);
     if (retval < 0) {
       if (errno != EINTR) {
         CW_ERROR_ERRNO(errno, "pselect");
-        return -6;
+        ret = -4;
+        goto out;
       }
-      break;
+      retval = 0; /* signal: exit request or statistics dump */
+    }
+
+    for (unsigned int i = 0; retval > 0 && i < count; i++) {
+      s = &ctx.streams[i];
+      if (s->fd >= 0 && FD_ISSET(s->fd, &readfds) && process_read(&ctx, s) < 0)
+        stream_close(&ctx, s);
+    }
+
+    for (unsigned int i = 0; retval > 0 && i < METRICS_CONNS_MAX; i++) {
+      c = &ctx.metrics_conns[i];
+      if (c->fd >= 0 && (FD_ISSET(c->fd, &readfds) || FD_ISSET(c->fd, &writefds)))
+        metrics_io(c);
+    }
+
+    if (retval > 0 && ctx.metrics_fd >= 0 && FD_ISSET(ctx.metrics_fd, &readfds))
+      metrics_accept(&ctx);
+
+    ms = context_tick(&ctx);
+  }
+  ret = exit_request;
+
+out:
+  signals_restore(&sig);
+  context_free(&ctx);
+  return ret;
+}
+#else
+#ifdef HAVE_CW_URING
+#define URING_BUFFERS    16 /* provided buffers (shared by all streams), power of 2 */
+#define URING_CQ_ENTRIES 256
+#define URING_BGID       0
+#define URING_METRICS    UINT64_MAX /* user_data of metrics socket poll */
+#define URING_CONN(i)    (URING_METRICS - 1 - (i)) /* metrics connection poll */
+
+/**
+ * Queue a read request for a stream. A multishot read is armed once and
+ * completes every time data is available, a kernel buffer being picked
+ * from provided buffer ring.
+ *
+ * \param[in] ring io_uring instance
+ * \param[in] ctx filter context
+ * \param[in] i stream index
+ * \param[in] multishot false for single-shot read (before Linux 6.7)
+ * \return 0 on success, -1 if submission queue is full
+ */
+static int uring_read (cw_uring_t *ring, cw_context_t *ctx, unsigned int i,
+    bool multishot)
+{
+  struct io_uring_sqe *sqe = cw_uring_sqe(ring);
+
+  if (!sqe)
+    return -1;
+
+  sqe->opcode = (multishot) ? IORING_OP_READ_MULTISHOT : IORING_OP_READ;
+  sqe->fd = ctx->streams[i].fd;
+  sqe->off = (uint64_t)-1; /* current position */
+  sqe->len = (multishot) ? 0 : (unsigned int)ring->buffer_size;
+  sqe->flags = IOSQE_BUFFER_SELECT;
+  sqe->buf_group = URING_BGID;
+  sqe->user_data = i;
+  return 0;
+}
+
+/**
+ * Start reading a stream. A regular file can't be polled (multishot) but
+ * is always readable: it is read at once. Stream may get a new input when
+ * closed (hooks).
+ *
+ * \param[in] ring io_uring instance
+ * \param[in] ctx filter context
+ * \param[in] i stream index
+ * \param[in] multishot false for single-shot read (before Linux 6.7)
+ */
+static void uring_watch (cw_uring_t *ring, cw_context_t *ctx, unsigned int i,
+    bool multishot)
+{
+  cw_stream_t *s = &ctx->streams[i];
+  struct stat st;
+
+  while (s->fd >= 0 && !exit_request && fstat(s->fd, &st) == 0 &&
+      S_ISREG(st.st_mode)) {
+    while (process_read(ctx, s) == 0 && !exit_request)
+      ;
+    stream_close(ctx, s);
+  }
+
+  if (s->fd >= 0)
+    uring_read(ring, ctx, i, multishot);
+}
 
-    } else if (retval == 0) { /* timeout */
+/* Queue a readiness wait of metrics socket */
+static void uring_poll_metrics (cw_uring_t *ring, cw_context_t *ctx)
+{
+  struct io_uring_sqe *sqe = cw_uring_sqe(ring);
+
+  if (sqe) {
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = ctx->metrics_fd;
+    sqe->poll32_events = POLLIN;
+    sqe->user_data = URING_METRICS;
+  }
+}
+
+/* Queue readiness waits of metrics connections not being waited for */
+static void uring_poll_conns (cw_uring_t *ring, cw_context_t *ctx)
+{
+  struct io_uring_sqe *sqe;
+  cw_metrics_conn_t *c;
+
+  for (unsigned int i = 0; i < METRICS_CONNS_MAX; i++) {
+    c = &ctx->metrics_conns[i];
+    if (c->fd < 0 || c->armed || !(sqe = cw_uring_sqe(ring)))
       continue;
+    sqe->opcode = IORING_OP_POLL_ADD;
+    sqe->fd = c->fd;
+    sqe->poll32_events = (unsigned int)metrics_events(c);
+    sqe->user_data = URING_CONN(i);
+    c->armed = true;
+  }
+}
 
-    } else if (FD_ISSET(ctx.in_fd, &readfds) && \
-        process_read(&ctx) < 0) {
-      break;
+/**
+ * Read, parse data and write results.
+ * This is a blocking function using io_uring (Linux) syscalls: reads are
+ * queued in kernel, a single system call submits requests, waits and
+ * gets all completions (several chunks of several streams).
+ *
+ * \param[in] in_fds input fds to read (raw statistics data) from
+ * \param[in] count number of input fds
+ * \param[in] out_fd output fd to write (parsed results) to
+ * \param[in] opts filter options
+ * \return <0: for any error
+ *          0: success (there's nothing left to read)
+ *          1: SIGCHLD signal received
+ *          2: a stream stayed under low speed limit (CW_FILTER_LOW_SPEED)
+ */
+int cw_filter_multi (const int *in_fds, unsigned int count, int out_fd,
+    const cw_options_t *opts)
+{
+  struct io_uring_cqe cqe;
+  cw_uring_t ring;
+  bool multishot = true;
+  int ms, err, ret = 0;
+  unsigned int bid;
+  cw_metrics_conn_t *c;
+  cw_sigstate_t sig = { .saved = false };
+  cw_context_t ctx;
+  cw_stream_t *s;
+  char *data;
+
+  if (context_init(&ctx, in_fds, count, out_fd, opts) < 0)
+    return -1;
+
+  /* At most one request in flight per stream (and metrics socket) */
+  err = cw_uring_init(&ring, count + 1 + METRICS_CONNS_MAX, (count * 4 > URING_CQ_ENTRIES) ?
+      count * 4 : URING_CQ_ENTRIES);
+  if (err == 0)
+    err = cw_uring_buffers(&ring, URING_BUFFERS, ctx.buffer_size, URING_BGID);
+  if (err < 0) {
+    CW_ERROR_ERRNO(-err, "io_uring");
+    if (ring.fd >= 0)
+      cw_uring_free(&ring);
+    context_free(&ctx);
+    return -2;
+  }
+
+  if (signals_setup(&sig, &ctx) < 0) {
+    ret = -3;
+    goto out;
+  }
+
+  for (unsigned int i = 0; i < count; i++)
+    uring_watch(&ring, &ctx, i, multishot);
+
+  if (ctx.metrics_fd >= 0)
+    uring_poll_metrics(&ring, &ctx);
+
+  ms = context_tick(&ctx);
+
+  while (!exit_request && ctx.alive > 0) {
+    err = cw_uring_wait(&ring, ms, &sig.mask);
+    if (err < 0 && err != -EINTR) {
+      CW_ERROR_ERRNO(-err, "io_uring_enter");
+      ret = -4;
+      goto out;
+    }
+
+    while (cw_uring_cqe(&ring, &cqe)) {
+      if (cqe.user_data == URING_METRICS) {
+        metrics_accept(&ctx);
+        uring_poll_metrics(&ring, &ctx);
+        continue;
+      }
+      if (cqe.user_data >= URING_CONN(METRICS_CONNS_MAX - 1)) {
+        c = &ctx.metrics_conns[URING_CONN(0) - cqe.user_data];
+        c->armed = false;
+        if (c->closing)
+          metrics_close(c);
+        else if (c->fd >= 0)
+          metrics_io(c);
+        continue;
+      }
+
+      s = &ctx.streams[cqe.user_data];
+
+      if (cqe.flags & IORING_CQE_F_BUFFER) {
+        bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+        data = cw_uring_buffer(&ring, bid);
+        if (cqe.res > 0 && s->fd >= 0) {
+          if (ctx.tee_fd >= 0 &&
+              write_full(ctx.tee_fd, data, (size_t)cqe.res) < 0)
+            tee_disable(&ctx);
+          process_chunk(&ctx, s, data, (size_t)cqe.res);
+        }
+        cw_uring_buffer_return(&ring, bid);
+      }
+
+      if (s->fd < 0 || (cqe.flags & IORING_CQE_F_MORE))
+        continue;
+
+      /* Request is over: rearm it unless end of file or error */
+      if (cqe.res == -EINVAL && multishot) {
+        multishot = false;
+        uring_read(&ring, &ctx, (unsigned int)cqe.user_data, multishot);
+      } else if (cqe.res > 0 || cqe.res == -ENOBUFS || cqe.res == -EINTR ||
+          cqe.res == -EAGAIN) {
+        uring_read(&ring, &ctx, (unsigned int)cqe.user_data, multishot);
+      } else {
+        if (cqe.res < 0)
+          CW_ERROR_ERRNO(-cqe.res, "read");
+        stream_close(&ctx, s);
+        uring_watch(&ring, &ctx, (unsigned int)cqe.user_data, multishot);
+      }
     }
+
+    ms = context_tick(&ctx);
+    if (ctx.metrics_fd >= 0)
+      uring_poll_conns(&ring, &ctx);
   }
+  ret = exit_request;
 
-  return exit_request;
+out:
+  signals_restore(&sig);
+  cw_uring_free(&ring);
+  context_free(&ctx);
+  return ret;
 }
+#endif /* HAVE_CW_URING */
 #endif /* HAVE_CW_PSELECT */
 #endif /* HAVE_CW_PPOLL */
 #endif /* HAVE_CW_EPOLL */
 
+/**
+ * Read, parse data and write results (single input stream).
+ * See cw_filter_multi().
+ */
+int cw_filter (int in_fd, int out_fd, int mode)
+{
+  cw_options_t opts = { .mode = mode };
+
+  return cw_filter_multi(&in_fd, 1, out_fd, &opts);
+}
+
+struct cw_writer {
+  cw_context_t ctx;
+};
+
+/**
+ * Create a results writer: same output as cw_filter() but results are
+ * provided by caller instead of being parsed from curl's output.
+ *
+ * \param[in] out_fd output fd to write results to
+ * \param[in] opts output options (mode and read_size are ignored)
+ * \return writer instance or NULL
+ */
+cw_writer_t *cw_writer_new (int out_fd, const cw_options_t *opts)
+{
+  cw_writer_t *w = malloc(sizeof(cw_writer_t));
+
+  if (!w) {
+    CW_ERROR_ERRNO(errno, "malloc");
+    return NULL;
+  }
+
+  if (context_init(&w->ctx, NULL, 1, out_fd, opts) < 0) {
+    free(w);
+    return NULL;
+  }
+
+  return w;
+}
+
+/**
+ * Write a result (subject to rate limiting, see cw_options_t).
+ */
+void cw_writer_progress (cw_writer_t *w, const cw_progress_t *result)
+{
+  emit_progress(&w->ctx, &w->ctx.streams[0], result);
+  context_tick(&w->ctx);
+}
+
+/**
+ * Write latency breakdown of the transfer (end of transfer).
+ */
+void cw_writer_timing (cw_writer_t *w, const cw_timing_t *timing)
+{
+  cw_stream_t *s = &w->ctx.streams[0];
+
+  if (s->has_pending)
+    write_progress(&w->ctx, s, &s->pending);
+  write_timing(&w->ctx, s, timing);
+  context_tick(&w->ctx);
+}
+
+/**
+ * Write held back result and release writer.
+ */
+void cw_writer_free (cw_writer_t *w)
+{
+  if (w) {
+    context_free(&w->ctx);
+    free(w);
+  }
+}
+
 /* vim: set et sw=2 ts=4: */
@@ -27,6 +27,14 @@
 #include "config.h"
 #endif
 
+#include "libcw.h"
+
+/* Used to build several backends from the same tree (benchmark) */
+#ifdef CW_IOWAIT_OVERRIDE
+#  undef FORCE_IOWAIT
+#  define FORCE_IOWAIT CW_IOWAIT_OVERRIDE
+#endif
+
 #ifdef FORCE_IOWAIT
 #  if defined(HAVE_EPOLL_CTL) && (FORCE_IOWAIT == 0x45504F4C)
 #  define HAVE_CW_EPOLL 1
@@ -34,6 +42,8 @@
 #  define HAVE_CW_PPOLL 1
 #  elif defined(HAVE_PSELECT) && (FORCE_IOWAIT == 0x53454C45)
 #  define HAVE_CW_PSELECT 1
+#  elif defined(HAVE_LINUX_IO_URING_H) && (FORCE_IOWAIT == 0x5552494E)
+#  define HAVE_CW_URING 1
 #  else
 #  error "Unavailable implementation, FORCE_IOWAIT has unexpected value"
 #  endif
@@ -54,7 +64,70 @@
 #define CW_ERROR_ERRNO(errno, fmt, ...) \
     fprintf(stderr, "error: " fmt " (%s)\n", ## __VA_ARGS__, strerror(errno))
 
-/* Exported prototype */
+#define READ_BUFFER_SIZE 65536 /* default, pipe capacity on Linux */
+
+/* Output encodings */
+enum {
+  CW_OUTPUT_ZENITY = 0,     /* percent and "# text" lines */
+  CW_OUTPUT_JSON,           /* JSON Lines (see format.h for fields) */
+  CW_OUTPUT_BINARY,         /* fixed size records (format.h) */
+};
+
+/*
+ * cw_filter_multi() hooks: streams are handled by caller (batch downloads).
+ * Results are handed over instead of being written and a stream reaching
+ * end of file can be replaced by a new input. SIGCHLD is left alone.
+ */
+typedef struct {
+  void *data;               /* first argument of callbacks */
+  /* Parsed result of a stream */
+  void (*progress) (void *data, unsigned int index, const cw_progress_t *result);
+  /* End of file of a stream (timing is NULL if none has been parsed):
+   * return next input of this stream, -1 for none */
+  int (*close) (void *data, unsigned int index, const cw_timing_t *timing);
+  /* After each wakeup: return delay (ms) before next call, <0 for none */
+  int (*tick) (void *data, uint64_t now_ms);
+} cw_hooks_t;
+
+/* cw_filter_multi() options, zero means default value */
+typedef struct {
+  int mode;                 /* non zero for curl's progress bar (-#) */
+  size_t read_size;         /* read buffer size (bytes) */
+  unsigned int rate;        /* maximum number of results per second and per
+                               stream, unlimited if zero */
+  int smooth;               /* non zero for speed statistics (average, ETA) */
+  unsigned int stall_secs;  /* stall detection timeout (seconds) */
+  int tee_fd;               /* copy of raw input data (log), none if zero */
+  const char *shm_path;     /* shared memory progress export file, NULL for none */
+  const char *metrics_path; /* Unix socket serving metrics, NULL for none */
+  const char *record_path;  /* binary progress recording, NULL for none */
+  uint64_t low_speed;       /* low speed limit (bytes/s), disabled if zero */
+  unsigned int low_speed_secs; /* time under low speed limit before
+                               cw_filter_multi() returns CW_FILTER_LOW_SPEED */
+  uint64_t offset;          /* bytes transferred before (resumed transfer) */
+  int pstats;               /* non zero for self instrumentation report
+                               (stderr, on SIGUSR1 and at end) */
+  int format;               /* output encoding (CW_OUTPUT_*) */
+  const cw_hooks_t *hooks;  /* caller handles streams, NULL for none */
+} cw_options_t;
+
+/* cw_filter_multi() return value: a stream stayed under low speed limit */
+#define CW_FILTER_LOW_SPEED 2
+
+typedef struct cw_writer cw_writer_t;
+
+/* Exported prototypes */
 int cw_filter (int in_fd, int out_fd, int mode);
+int cw_filter_multi (const int *in_fds, unsigned int count, int out_fd,
+    const cw_options_t *opts);
+
+cw_writer_t *cw_writer_new (int out_fd, const cw_options_t *opts);
+void cw_writer_progress (cw_writer_t *w, const cw_progress_t *result);
+void cw_writer_timing (cw_writer_t *w, const cw_timing_t *timing);
+
+char *cw_format_timing (char *buf, size_t len, const cw_timing_t *t);
+void cw_writer_free (cw_writer_t *w);
+
+void cw_signals_reset (void);
 
 #endif /* COMMON_H */
@@ -19,7 +19,9 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <getopt.h>
 
 #include "common.h"
@@ -31,25 +33,100 @@
 #define CW_NAME    "cw"
 #define CW_VERSION PACKAGE_VERSION
 
+/* Append a file descriptor to the input list */
+static bool add_input (int **fds, unsigned int *count, int fd)
+{
+  int *tmp = realloc(*fds, (*count + 1) * sizeof(int));
+
+  if (!tmp) {
+    CW_ERROR_ERRNO(errno, "realloc");
+    return false;
+  }
+
+  tmp[(*count)++] = fd;
+  *fds = tmp;
+  return true;
+}
+
+/* Parse a size argument: number of bytes with optional k or M suffix */
+static bool parse_size (const char *str, size_t *size)
+{
+  unsigned long val;
+  char *end;
+
+  errno = 0;
+  val = strtoul(str, &end, 10);
+  if (errno || end == str)
+    return false;
+
+  if (*end == 'k' || *end == 'K')
+    val <<= 10, end++;
+  else if (*end == 'm' || *end == 'M')
+    val <<= 20, end++;
+
+  if (*end != '\0' || val == 0)
+    return false;
+
+  *size = (size_t)val;
+  return true;
+}
+
 int main (int argc, char *argv[])
 {
-  int c, option_index;
-  bool curl_hash_flag = false;
+  int c, option_index, fd, ret;
+  int *in_fds = NULL;
+  unsigned int in_count = 0;
+  cw_options_t opts = {0};
+  char *end;
 
   const struct option switches[] = {
+    {"buffer-size", required_argument, 0, 'B'},
+    {"fd",      required_argument, 0, 'f'},
+    {"format",  required_argument, 0, 'F'},
+    {"metrics", required_argument, 0, 'M'},
+    {"rate",    required_argument, 0, 'r'},
+    {"record",  required_argument, 0, 'R'},
+    {"shm",     required_argument, 0, 'm'},
+    {"smooth",  no_argument, 0, 's'},
+    {"stall",   required_argument, 0, 'S'},
+    {"stats",   no_argument, 0, 'P'},
+    {"tee",     required_argument, 0, 't'},
     {"version", no_argument, 0, 'v'},
     {"help",    no_argument, 0, 'h'},
     {0, 0, 0, 0}
   };
 
-  while ((c = getopt_long(argc, argv, "#hv", switches, &option_index)) != -1) {
+  while ((c = getopt_long(argc, argv, "#B:f:hr:st:v", switches, &option_index)) != -1) {
     switch(c) {
       case 'h':
-        fprintf(stdout, "Usage: %s [OPTIONS...]\n"
-            "Parse curl's progress meter/bar (stdin => stdout).\n"
+        fprintf(stdout, "Usage: %s [OPTIONS...] [FILE...]\n"
+            "Parse curl's progress meter/bar (FILEs or stdin => stdout).\n"
+            "With several inputs, output lines are prefixed by input number (\"N:\").\n"
             "\nOptions:\n"
             "   -#                     progress bar input data\n"
+            "   -B,  --buffer-size=N   read buffer size (bytes, k or M suffix\n"
+            "                          allowed, default: 64k)\n"
+            "   -f,  --fd=NUM          read from inherited file descriptor NUM\n"
+            "                          (can be given several times)\n"
+            "        --format=FMT      output encoding: zenity (default), json\n"
+            "                          (JSON Lines) or binary (fixed size records)\n"
             "   -h,  --help            display this help and exit\n"
+            "        --metrics=SOCKET  serve metrics (Prometheus text format) on\n"
+            "                          Unix socket SOCKET\n"
+            "   -r,  --rate=NUM        write at most NUM updates per second and\n"
+            "                          per input (default: unlimited)\n"
+            "        --record=FILE     record progress samples of each input to\n"
+            "                          FILE (compact binary, see cwrec)\n"
+            "        --shm=FILE        publish progress of each input to FILE\n"
+            "                          (memory mapped, see cwshm)\n"
+            "   -s,  --smooth          report smoothed speed and ETA, speed\n"
+            "                          statistics at end of transfer\n"
+            "        --stall=SECS      with --smooth, report transfer as stalled\n"
+            "                          after SECS without progress (default: 10)\n"
+            "        --stats           report own counters and latencies (read,\n"
+            "                          parse, read to write) on stderr, at end and\n"
+            "                          on SIGUSR1\n"
+            "   -t,  --tee=FILE        copy raw input data (curl's messages) to FILE\n"
             "        --version         display program version and exit\n",
             CW_NAME);
         return 0;
@@ -57,7 +134,75 @@ int main (int argc, char *argv[])
         fputs(CW_VERSION "\n", stdout);
         return 0;
       case '#':
-        curl_hash_flag = true;
+        opts.mode = 1;
+        break;
+      case 'B':
+        if (!parse_size(optarg, &opts.read_size)) {
+          CW_ERROR("%s: invalid buffer size", optarg);
+          return -1;
+        }
+        break;
+      case 'f':
+        errno = 0;
+        fd = (int)strtol(optarg, &end, 10);
+        if (errno || *end != '\0' || fd < 0 || fcntl(fd, F_GETFD) == -1) {
+          CW_ERROR("%s: invalid file descriptor", optarg);
+          return -1;
+        }
+        if (!add_input(&in_fds, &in_count, fd))
+          return -1;
+        break;
+      case 'F':
+        if (strcmp(optarg, "zenity") == 0) {
+          opts.format = CW_OUTPUT_ZENITY;
+        } else if (strcmp(optarg, "json") == 0) {
+          opts.format = CW_OUTPUT_JSON;
+        } else if (strcmp(optarg, "binary") == 0) {
+          opts.format = CW_OUTPUT_BINARY;
+        } else {
+          CW_ERROR("%s: unknown output format (zenity, json or binary)", optarg);
+          return -1;
+        }
+        break;
+      case 'r':
+        errno = 0;
+        opts.rate = (unsigned int)strtoul(optarg, &end, 10);
+        if (errno || *end != '\0' || opts.rate == 0 || opts.rate > 1000) {
+          CW_ERROR("%s: invalid rate (1 to 1000)", optarg);
+          return -1;
+        }
+        break;
+      case 'm':
+        opts.shm_path = optarg;
+        break;
+      case 'R':
+        opts.record_path = optarg;
+        break;
+      case 'M':
+        opts.metrics_path = optarg;
+        break;
+      case 's':
+        opts.smooth = 1;
+        break;
+      case 'P':
+        opts.pstats = 1;
+        break;
+      case 'S':
+        errno = 0;
+        opts.stall_secs = (unsigned int)strtoul(optarg, &end, 10);
+        if (errno || *end != '\0' || opts.stall_secs == 0) {
+          CW_ERROR("%s: invalid stall timeout", optarg);
+          return -1;
+        }
+        break;
+      case 't':
+        if (opts.tee_fd > 0)
+          close(opts.tee_fd);
+        opts.tee_fd = open(optarg, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666);
+        if (opts.tee_fd == -1) {
+          CW_ERROR_ERRNO(errno, "%s", optarg);
+          return -1;
+        }
         break;
       default:
         fprintf(stderr, "Try `%s --help' for more information.\n", CW_NAME);
@@ -65,13 +210,29 @@ int main (int argc, char *argv[])
     }
   }
 
-  if (optind < argc)
-    fprintf(stderr, "%s: unwanted argument(s), ignoring them\n", CW_NAME);
+  /* FIFOs are opened non blocking: don't wait for a writer to show up */
+  for (; optind < argc; optind++) {
+    if (strcmp(argv[optind], "-") == 0) {
+      fd = STDIN_FILENO;
+    } else {
+      fd = open(argv[optind], O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+      if (fd == -1) {
+        CW_ERROR_ERRNO(errno, "%s", argv[optind]);
+        return -1;
+      }
+    }
+    if (!add_input(&in_fds, &in_count, fd))
+      return -1;
+  }
+
+  if (in_count == 0 && !add_input(&in_fds, &in_count, STDIN_FILENO))
+    return -1;
 
   /* Blocking loop inside */
-  if (cw_filter(STDIN_FILENO, STDOUT_FILENO,
-          curl_hash_flag) == 0)
+  ret = cw_filter_multi(in_fds, in_count, STDOUT_FILENO, &opts);
+  if (ret == 0 && in_count == 1 && opts.format == CW_OUTPUT_ZENITY)
     write(STDOUT_FILENO, "100\n", 4);
 
+  free(in_fds);
   return 0;
 }
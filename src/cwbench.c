@@ -0,0 +1,260 @@
+/*
+ * cURL wrapper - I/O wait backends benchmark
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#include "common.h"
+
+#if defined(HAVE_CW_EPOLL)
+#define BACKEND_NAME "epoll"
+#elif defined(HAVE_CW_PPOLL)
+#define BACKEND_NAME "ppoll"
+#elif defined(HAVE_CW_PSELECT)
+#define BACKEND_NAME "pselect"
+#elif defined(HAVE_CW_URING)
+#define BACKEND_NAME "uring"
+#endif
+
+typedef struct {
+  unsigned long lines;      /* number of progress lines per stream */
+  unsigned long rate;       /* lines per second and per stream, 0 for no limit */
+  size_t fragment;          /* write size, 0 for one write per line */
+  bool bar;                 /* curl's -# progress bar instead of meter */
+} gen_options_t;
+
+static double timeval_secs (const struct timeval *tv)
+{
+  return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static void write_all (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n <= 0)
+      _exit(1);
+    buf += n;
+    len -= (size_t)n;
+  }
+}
+
+/**
+ * Synthetic curl stderr generator.
+ *
+ * \param[in] fd output stream
+ * \param[in] opts generator options
+ */
+static void generate (int fd, const gen_options_t *opts)
+{
+  static const char header[] =
+      "  % Total    % Received % Xferd  Average Speed   Time    Time     Time  Current\n"
+      "                                 Dload  Upload   Total   Spent    Left  Speed\n";
+  char line[128];
+  struct timespec next;
+  unsigned long i, period_ns = (opts->rate) ? 1000000000UL / opts->rate : 0;
+  int len, percent;
+
+  if (!opts->bar)
+    write_all(fd, header, sizeof(header) - 1);
+
+  clock_gettime(CLOCK_MONOTONIC, &next);
+
+  for (i = 1; i <= opts->lines; i++) {
+    percent = (int)(i * 100 / opts->lines);
+
+    if (opts->bar) {
+      char bar[73];
+      int w = percent * 72 / 100;
+      memset(bar, '#', w);
+      memset(bar + w, ' ', 72 - w);
+      bar[72] = '\0';
+      len = snprintf(line, sizeof(line), "\r%s %3d,%d%%", bar, percent,
+          (int)(i % 10));
+    } else {
+      len = snprintf(line, sizeof(line),
+          "\r%3d 20.0M  %3d %4luk    0     0  2970k      0  0:00:06  0:00:01  0:00:05 %4luk",
+          percent, percent, i % 10000, 2000 + i % 1000);
+    }
+
+    if (opts->fragment == 0) {
+      write_all(fd, line, (size_t)len);
+    } else {
+      for (int off = 0; off < len; off += (int)opts->fragment)
+        write_all(fd, line + off, ((size_t)(len - off) < opts->fragment) ?
+            (size_t)(len - off) : opts->fragment);
+    }
+
+    if (period_ns) {
+      next.tv_nsec += (long)period_ns;
+      while (next.tv_nsec >= 1000000000L) {
+        next.tv_nsec -= 1000000000L;
+        next.tv_sec++;
+      }
+      clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+  }
+
+  write_all(fd, "\n", 1);
+}
+
+/*
+ * Start a generator writing to a new pipe. Generator is a grandchild:
+ * its termination doesn't raise SIGCHLD (which would stop cw_filter).
+ */
+static int spawn_generator (const gen_options_t *opts)
+{
+  int apipe[2];
+  pid_t pid;
+
+  if (pipe(apipe) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    return -1;
+  }
+
+  pid = fork();
+  if (pid == (pid_t)-1) {
+    CW_ERROR_ERRNO(errno, "fork");
+    return -1;
+  }
+
+  if (pid == 0) {
+    close(apipe[0]);
+    if (fork() == 0) {
+      generate(apipe[1], opts);
+      _exit(0);
+    }
+    _exit(0);
+  }
+
+  close(apipe[1]);
+  waitpid(pid, NULL, 0);
+  return apipe[0];
+}
+
+int main (int argc, char *argv[])
+{
+  gen_options_t gen = { .lines = 100000 };
+  cw_options_t opts = {0};
+  struct rusage ru0, ru1;
+  struct timespec t0, t1;
+  unsigned int streams = 1;
+  bool generate_only = false;
+  int c, ret, *fds, out_fd;
+  double wall, cpu, updates;
+  long wakeups;
+
+  while ((c = getopt(argc, argv, "#c:f:gn:r:R:h")) != -1) {
+    switch (c) {
+      case '#':
+        gen.bar = true;
+        opts.mode = 1;
+        break;
+      case 'c':
+        streams = (unsigned int)strtoul(optarg, NULL, 10);
+        break;
+      case 'f':
+        gen.fragment = strtoul(optarg, NULL, 10);
+        break;
+      case 'g':
+        generate_only = true;
+        break;
+      case 'n':
+        gen.lines = strtoul(optarg, NULL, 10);
+        break;
+      case 'r':
+        gen.rate = strtoul(optarg, NULL, 10);
+        break;
+      case 'R':
+        opts.rate = (unsigned int)strtoul(optarg, NULL, 10);
+        break;
+      default:
+        fprintf(stderr, "Usage: %s [-#] [-c STREAMS] [-f FRAGMENT] [-g] [-n LINES]"
+            " [-r LINES_PER_SEC] [-R OUTPUT_RATE]\n"
+            "  -g: write synthetic curl output to stdout, don't benchmark\n",
+            argv[0]);
+        return (c == 'h') ? 0 : 1;
+    }
+  }
+
+  if (streams == 0 || gen.lines == 0) {
+    CW_ERROR("invalid arguments");
+    return 1;
+  }
+
+  if (generate_only) {
+    generate(STDOUT_FILENO, &gen);
+    return 0;
+  }
+
+  fds = calloc(streams, sizeof(int));
+  out_fd = open("/dev/null", O_WRONLY);
+  if (!fds || out_fd == -1) {
+    CW_ERROR_ERRNO(errno, "setup");
+    return 1;
+  }
+
+  for (unsigned int i = 0; i < streams; i++) {
+    fds[i] = spawn_generator(&gen);
+    if (fds[i] < 0)
+      return 1;
+  }
+
+  getrusage(RUSAGE_SELF, &ru0);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  ret = cw_filter_multi(fds, streams, out_fd, &opts);
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  getrusage(RUSAGE_SELF, &ru1);
+
+  if (ret != 0) {
+    CW_ERROR("cw_filter_multi returned %d", ret);
+    return 1;
+  }
+
+  wall = (t1.tv_sec - t0.tv_sec) + (t1.tv_nsec - t0.tv_nsec) / 1e9;
+  cpu = timeval_secs(&ru1.ru_utime) - timeval_secs(&ru0.ru_utime) +
+      timeval_secs(&ru1.ru_stime) - timeval_secs(&ru0.ru_stime);
+  wakeups = ru1.ru_nvcsw - ru0.ru_nvcsw; /* each blocking wait is a voluntary switch */
+  updates = (double)gen.lines * streams;
+
+  printf("%-8s %-6s %3u %6zu %7lu %12.0f %10.3f %8ld %8.3f\n", BACKEND_NAME,
+      gen.bar ? "bar" : "meter", streams, gen.fragment, gen.rate,
+      updates / wall, cpu * 1e6 / updates, wakeups, wakeups / updates);
+
+  for (unsigned int i = 0; i < streams; i++)
+    close(fds[i]);
+  close(out_fd);
+  free(fds);
+  return 0;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,634 @@
+/*
+ * cURL wrapper - progress aggregation daemon
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Producers connect to a Unix socket and write curl's stderr (one stream
+ * per connection), for example:
+ *   curl -o file URL 2>&1 >/dev/null | socat - UNIX-CONNECT:/run/cwd.sock
+ *
+ * Connections are spread over shards: one thread per core, each with its
+ * own epoll instance, read buffer and parsers. Nothing is shared between
+ * shards but the listening socket and the export slots. The shard woken up
+ * by incoming connections (EPOLLEXCLUSIVE) accepts them and hands each one
+ * to the least loaded shard (fewest open connections) through its inbox
+ * pipe: a burst of connections doesn't end up on a single shard. Global
+ * view is merged without locks: shard counters have a single writer (but
+ * active, atomic) and are summed by the main thread, per-stream results go
+ * to seqlock protected shm records.
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+
+#include "common.h"
+#include "shm.h"
+
+#define CWD_NAME "cwd"
+#define CWD_MAX_STREAMS 4096
+#define CWD_MAX_EVENTS 64
+#define CWD_BACKLOG 1024
+
+/* Single writer (owner shard), any reader */
+#define counter_add(c, v) __atomic_store_n(&(c), (c) + (v), __ATOMIC_RELAXED)
+#define counter_get(c)    __atomic_load_n(&(c), __ATOMIC_RELAXED)
+
+typedef struct conn {
+  int fd;
+  int slot;                 /* shm record, -1 if none */
+  uint64_t bytes;           /* transferred bytes of last result */
+  cw_parser_t *parser;
+  struct conn *prev, *next;
+} conn_t;
+
+typedef struct {
+  /* Written by shard thread only */
+  uint64_t accepted;        /* connections */
+  uint64_t active;          /* open connections, handed out ones included
+                               (incremented by accepting shard) */
+  uint64_t results;         /* progress results */
+  uint64_t bytes;           /* transferred bytes (sum of progress deltas) */
+  uint64_t input;           /* bytes read from producers */
+} __attribute__((aligned(64))) cwd_counters_t;
+
+typedef struct {
+  cwd_counters_t counters;  /* own cache line: no false sharing */
+  pthread_t thread;
+  int epoll_fd;
+  int stop_fd;              /* eventfd */
+  int inbox[2];             /* pipe: connections handed out to this shard */
+  conn_t *conns;            /* open connections */
+  char *buffer;
+} __attribute__((aligned(64))) cwd_shard_t;
+
+static struct {
+  int listen_fd;
+  cw_format_t format;
+  cw_shm_t *shm;
+  unsigned int max_streams;
+  unsigned char *slots;     /* non zero if shm record is used */
+  unsigned int next_slot;
+  cwd_shard_t *shards;
+  unsigned int count;       /* running shards */
+} cwd;
+
+/* Claim a free export record, -1 if there is none */
+static int slot_get (void)
+{
+  for (unsigned int i = 0; i < cwd.max_streams; i++) {
+    unsigned int n = __atomic_fetch_add(&cwd.next_slot, 1, __ATOMIC_RELAXED) %
+        cwd.max_streams;
+    unsigned char expected = 0;
+
+    if (__atomic_compare_exchange_n(&cwd.slots[n], &expected, 1, false,
+          __ATOMIC_ACQUIRE, __ATOMIC_RELAXED))
+      return (int)n;
+  }
+
+  return -1;
+}
+
+static void slot_put (int n)
+{
+  __atomic_store_n(&cwd.slots[n], 0, __ATOMIC_RELEASE);
+}
+
+static void conn_close (cwd_shard_t *sh, conn_t *c)
+{
+  if (c->slot >= 0) {
+    cw_shm_set_state(cwd.shm, (unsigned int)c->slot, CW_SHM_DONE);
+    slot_put(c->slot);
+  }
+
+  /* Also removes it from epoll set */
+  close(c->fd);
+  cw_parser_free(c->parser);
+
+  if (c->prev)
+    c->prev->next = c->next;
+  else
+    sh->conns = c->next;
+  if (c->next)
+    c->next->prev = c->prev;
+
+  free(c);
+  __atomic_fetch_sub(&sh->counters.active, 1, __ATOMIC_RELAXED);
+}
+
+/* Take a connection handed out to this shard */
+static void conn_add (cwd_shard_t *sh, int fd)
+{
+  struct epoll_event ev;
+  conn_t *c;
+
+  c = calloc(1, sizeof(conn_t));
+  if (!c || !(c->parser = cw_parser_new(cwd.format))) {
+    CW_ERROR_ERRNO(ENOMEM, "connection");
+    free(c);
+    close(fd);
+    __atomic_fetch_sub(&sh->counters.active, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  c->fd = fd;
+  c->slot = (cwd.shm) ? slot_get() : -1;
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = c;
+  if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    if (c->slot >= 0)
+      slot_put(c->slot);
+    cw_parser_free(c->parser);
+    free(c);
+    close(fd);
+    __atomic_fetch_sub(&sh->counters.active, 1, __ATOMIC_RELAXED);
+    return;
+  }
+
+  c->next = sh->conns;
+  if (sh->conns)
+    sh->conns->prev = c;
+  sh->conns = c;
+
+  counter_add(sh->counters.accepted, 1);
+}
+
+/* Shard with fewest open connections (handed out ones included) */
+static cwd_shard_t *shard_least_loaded (void)
+{
+  unsigned int count = __atomic_load_n(&cwd.count, __ATOMIC_ACQUIRE);
+  cwd_shard_t *best = &cwd.shards[0];
+  uint64_t min = UINT64_MAX, active;
+
+  for (unsigned int i = 0; i < count; i++) {
+    active = __atomic_load_n(&cwd.shards[i].counters.active, __ATOMIC_RELAXED);
+    if (active < min) {
+      min = active;
+      best = &cwd.shards[i];
+    }
+  }
+
+  return best;
+}
+
+static void shard_accept (void)
+{
+  cwd_shard_t *target;
+  int fd;
+
+  /* Several shards may have been woken up: EAGAIN is expected */
+  while ((fd = accept4(cwd.listen_fd, NULL, NULL,
+          SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0) {
+    target = shard_least_loaded();
+    __atomic_fetch_add(&target->counters.active, 1, __ATOMIC_RELAXED);
+    if (write(target->inbox[1], &fd, sizeof(fd)) != sizeof(fd)) {
+      CW_ERROR_ERRNO(errno, "shard inbox");
+      __atomic_fetch_sub(&target->counters.active, 1, __ATOMIC_RELAXED);
+      close(fd);
+    }
+  }
+
+  if (errno != EAGAIN && errno != EWOULDBLOCK && errno != ECONNABORTED)
+    CW_ERROR_ERRNO(errno, "accept");
+}
+
+/* Connections handed out to this shard (close them if stopping) */
+static void shard_inbox (cwd_shard_t *sh, bool stop)
+{
+  int fds[64];
+  ssize_t len;
+
+  while ((len = read(sh->inbox[0], fds, sizeof(fds))) > 0) {
+    for (size_t i = 0; i < (size_t)len / sizeof(int); i++) {
+      if (!stop) {
+        conn_add(sh, fds[i]);
+      } else {
+        close(fds[i]);
+        __atomic_fetch_sub(&sh->counters.active, 1, __ATOMIC_RELAXED);
+      }
+    }
+  }
+}
+
+static void conn_result (cwd_shard_t *sh, conn_t *c, const cw_progress_t *r)
+{
+  uint64_t bytes = r->received + r->uploaded;
+
+  /* Progress may restart (curl with several URLs) */
+  if (bytes > c->bytes)
+    counter_add(sh->counters.bytes, bytes - c->bytes);
+  c->bytes = bytes;
+  counter_add(sh->counters.results, 1);
+
+  if (c->slot >= 0)
+    cw_shm_publish(cwd.shm, (unsigned int)c->slot, r, 0, CW_SHM_RUNNING);
+}
+
+/* Read available data, return false if connection must be closed */
+static bool conn_read (cwd_shard_t *sh, conn_t *c)
+{
+  cw_progress_t result;
+  ssize_t len;
+  size_t n;
+  char *p;
+
+  len = read(c->fd, sh->buffer, READ_BUFFER_SIZE);
+  if (len <= 0)
+    return (len == -1 && (errno == EAGAIN || errno == EINTR));
+
+  counter_add(sh->counters.input, (uint64_t)len);
+
+  for (p = sh->buffer; len > 0; p += n, len -= (ssize_t)n) {
+    n = cw_parser_push(c->parser, p, (size_t)len);
+    while (cw_parser_pull(c->parser, &result) > 0)
+      conn_result(sh, c, &result);
+  }
+
+  return true;
+}
+
+static void *shard_run (void *arg)
+{
+  struct epoll_event events[CWD_MAX_EVENTS];
+  cwd_shard_t *sh = arg;
+  bool stop = false;
+  int n;
+
+  while (!stop) {
+    n = epoll_wait(sh->epoll_fd, events, CWD_MAX_EVENTS, -1);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      CW_ERROR_ERRNO(errno, "epoll_wait");
+      break;
+    }
+
+    for (int i = 0; i < n; i++) {
+      if (events[i].data.ptr == &cwd.listen_fd)
+        shard_accept();
+      else if (events[i].data.ptr == sh->inbox)
+        shard_inbox(sh, false);
+      else if (events[i].data.ptr == &sh->stop_fd)
+        stop = true;
+      else if (!conn_read(sh, events[i].data.ptr))
+        conn_close(sh, events[i].data.ptr);
+    }
+  }
+
+  while (sh->conns)
+    conn_close(sh, sh->conns);
+  shard_inbox(sh, true);
+
+  return NULL;
+}
+
+static int shard_init (cwd_shard_t *sh)
+{
+  struct epoll_event ev;
+
+  memset(sh, 0, sizeof(*sh));
+  sh->epoll_fd = sh->stop_fd = -1;
+  sh->inbox[0] = sh->inbox[1] = -1;
+
+  sh->buffer = malloc(READ_BUFFER_SIZE);
+  sh->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+  if (!sh->buffer || sh->epoll_fd == -1) {
+    CW_ERROR_ERRNO(errno, "shard");
+    return -1;
+  }
+
+  sh->stop_fd = eventfd(0, EFD_CLOEXEC);
+  if (sh->stop_fd == -1) {
+    CW_ERROR_ERRNO(errno, "eventfd");
+    return -1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = &sh->stop_fd;
+  if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, sh->stop_fd, &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    return -1;
+  }
+
+  /* Whole int writes and reads (below PIPE_BUF): fds are never split */
+  if (pipe2(sh->inbox, O_NONBLOCK | O_CLOEXEC) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    return -1;
+  }
+
+  ev.events = EPOLLIN;
+  ev.data.ptr = sh->inbox;
+  if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, sh->inbox[0], &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    return -1;
+  }
+
+  /* Only one shard is woken up by an incoming connection */
+  ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+  ev.data.ptr = &cwd.listen_fd;
+  if (epoll_ctl(sh->epoll_fd, EPOLL_CTL_ADD, cwd.listen_fd, &ev) == -1) {
+    CW_ERROR_ERRNO(errno, "epoll_ctl");
+    return -1;
+  }
+
+  return 0;
+}
+
+static void shard_free (cwd_shard_t *sh)
+{
+  if (sh->stop_fd >= 0)
+    close(sh->stop_fd);
+  if (sh->inbox[0] >= 0) {
+    close(sh->inbox[0]);
+    close(sh->inbox[1]);
+  }
+  if (sh->epoll_fd >= 0)
+    close(sh->epoll_fd);
+  free(sh->buffer);
+}
+
+static int listen_socket (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    CW_ERROR("%s: socket path too long", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  /* Stale socket of a previous instance */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      listen(fd, CWD_BACKLOG) == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Merge shard counters and print global view */
+static void report (const cwd_shard_t *shards, unsigned int count,
+    uint64_t *last_results, double elapsed)
+{
+  uint64_t accepted = 0, active = 0, results = 0, bytes = 0, input = 0;
+  char size[8], in[8];
+
+  for (unsigned int i = 0; i < count; i++) {
+    accepted += counter_get(shards[i].counters.accepted);
+    active += counter_get(shards[i].counters.active);
+    results += counter_get(shards[i].counters.results);
+    bytes += counter_get(shards[i].counters.bytes);
+    input += counter_get(shards[i].counters.input);
+  }
+
+  fprintf(stdout, "streams %lu (total %lu), results %lu (%.0f/s), "
+      "transferred %s, input %s", (unsigned long)active,
+      (unsigned long)accepted, (unsigned long)results,
+      (elapsed > 0) ? (double)(results - *last_results) / elapsed : 0.0,
+      cw_format_size(size, sizeof(size), bytes),
+      cw_format_size(in, sizeof(in), input));
+
+  /* Spread over shards */
+  if (count > 1) {
+    fprintf(stdout, ", per shard (active/total)");
+    for (unsigned int i = 0; i < count; i++)
+      fprintf(stdout, " %lu/%lu",
+          (unsigned long)counter_get(shards[i].counters.active),
+          (unsigned long)counter_get(shards[i].counters.accepted));
+  }
+  fprintf(stdout, "\n");
+  fflush(stdout);
+
+  *last_results = results;
+}
+
+static unsigned long parse_number (const char *arg, unsigned long max)
+{
+  unsigned long n;
+  char *end;
+
+  errno = 0;
+  n = strtoul(arg, &end, 10);
+  if (errno || *end != '\0' || n > max)
+    return (unsigned long)-1;
+  return n;
+}
+
+int main (int argc, char *argv[])
+{
+  unsigned long threads = 0, max_streams = CWD_MAX_STREAMS, interval = 1;
+  const char *socket_path = NULL, *shm_path = NULL;
+  struct timespec ts, start, now;
+  uint64_t last_results = 0;
+  cwd_shard_t *shards;
+  unsigned int count;
+  int c, err, option_index, ret = 0;
+  sigset_t mask;
+
+  const struct option switches[] = {
+    {"progress-bar", no_argument, 0, '#'},
+    {"listen",       required_argument, 0, 'l'},
+    {"threads",      required_argument, 0, 't'},
+    {"max-streams",  required_argument, 0, 'm'},
+    {"interval",     required_argument, 0, 'i'},
+    {"shm",          required_argument, 0, 'S'},
+    {"help",         no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  cwd.format = CW_FORMAT_METER;
+
+  while ((c = getopt_long(argc, argv, "#hi:l:m:t:", switches, &option_index)) != -1) {
+    switch(c) {
+      case '#':
+        cwd.format = CW_FORMAT_BAR;
+        break;
+      case 'h':
+        fprintf(stdout, "Usage: %s [OPTIONS...] -l SOCKET\n"
+            "Aggregate curl progress streams written to a Unix socket.\n"
+            "\nOptions:\n"
+            "   -#,  --progress-bar    producers use curl's progress bar\n"
+            "   -h,  --help            display this help and exit\n"
+            "   -i,  --interval=SECS   global summary period (default: 1),\n"
+            "                          0 to disable\n"
+            "   -l,  --listen=SOCKET   Unix socket path\n"
+            "   -m,  --max-streams=N   number of --shm records (default: %u)\n"
+            "   -t,  --threads=N       event loop shards (default: one per\n"
+            "                          online CPU)\n"
+            "        --shm=FILE        export per stream progress (see cwshm)\n",
+            CWD_NAME, CWD_MAX_STREAMS);
+        return 0;
+      case 'i':
+        if ((interval = parse_number(optarg, 3600)) == (unsigned long)-1) {
+          CW_ERROR("%s: invalid interval", optarg);
+          return -1;
+        }
+        break;
+      case 'l':
+        socket_path = optarg;
+        break;
+      case 'm':
+        max_streams = parse_number(optarg, 1 << 20);
+        if (max_streams == (unsigned long)-1 || max_streams == 0) {
+          CW_ERROR("%s: invalid number of streams", optarg);
+          return -1;
+        }
+        break;
+      case 't':
+        threads = parse_number(optarg, 1024);
+        if (threads == (unsigned long)-1 || threads == 0) {
+          CW_ERROR("%s: invalid number of threads", optarg);
+          return -1;
+        }
+        break;
+      case 'S':
+        shm_path = optarg;
+        break;
+      default:
+        fprintf(stderr, "Try `%s --help' for more information.\n", CWD_NAME);
+        return -1;
+    }
+  }
+
+  if (!socket_path || optind != argc) {
+    fprintf(stderr, "Try `%s --help' for more information.\n", CWD_NAME);
+    return -1;
+  }
+
+  if (threads == 0) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    threads = (n > 0) ? (unsigned long)n : 1;
+  }
+  count = (unsigned int)threads;
+
+  if (shm_path) {
+    cwd.max_streams = (unsigned int)max_streams;
+    cwd.slots = calloc(max_streams, 1);
+    cwd.shm = (cwd.slots) ? cw_shm_create(shm_path, cwd.max_streams) : NULL;
+    if (!cwd.shm) {
+      free(cwd.slots);
+      return -1;
+    }
+  }
+
+  cwd.listen_fd = listen_socket(socket_path);
+  if (cwd.listen_fd < 0) {
+    cw_shm_close(cwd.shm);
+    free(cwd.slots);
+    return -1;
+  }
+
+  /* Signals are handled by main thread only (shards inherit mask) */
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  pthread_sigmask(SIG_BLOCK, &mask, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  shards = aligned_alloc(64, count * sizeof(cwd_shard_t));
+  if (!shards) {
+    CW_ERROR_ERRNO(ENOMEM, "shards");
+    ret = -1;
+    goto out;
+  }
+
+  cwd.shards = shards;
+  for (unsigned int i = 0; i < count; i++) {
+    err = shard_init(&shards[i]);
+    if (err == 0) {
+      /* Can take connections before its thread runs: they wait in inbox */
+      __atomic_store_n(&cwd.count, i + 1, __ATOMIC_RELEASE);
+      err = pthread_create(&shards[i].thread, NULL, shard_run, &shards[i]);
+      if (err != 0)
+        CW_ERROR_ERRNO(err, "pthread_create");
+    }
+    if (err != 0) {
+      shard_free(&shards[i]);
+      count = i;
+      ret = -1;
+      break;
+    }
+  }
+
+  clock_gettime(CLOCK_MONOTONIC, &start);
+  ts.tv_sec = (interval > 0) ? (time_t)interval : 3600;
+  ts.tv_nsec = 0;
+
+  while (ret == 0) {
+    if (sigtimedwait(&mask, NULL, &ts) != -1)
+      break;
+    if (errno == EAGAIN && interval > 0) {
+      clock_gettime(CLOCK_MONOTONIC, &now);
+      report(shards, count, &last_results, (double)(now.tv_sec - start.tv_sec) +
+          (now.tv_nsec - start.tv_nsec) / 1e9);
+      start = now;
+    }
+  }
+
+  for (unsigned int i = 0; i < count; i++) {
+    uint64_t one = 1;
+    if (write(shards[i].stop_fd, &one, sizeof(one)) != sizeof(one))
+      CW_ERROR_ERRNO(errno, "eventfd");
+  }
+  for (unsigned int i = 0; i < count; i++) {
+    pthread_join(shards[i].thread, NULL);
+    shard_free(&shards[i]);
+  }
+
+  /* Final report, always with several shards: shows their spread */
+  if (count > 1 || (interval > 0 && count > 0)) {
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    report(shards, count, &last_results, (double)(now.tv_sec - start.tv_sec) +
+        (now.tv_nsec - start.tv_nsec) / 1e9);
+  }
+  free(shards);
+
+out:
+  close(cwd.listen_fd);
+  unlink(socket_path);
+  cw_shm_close(cwd.shm);
+  free(cwd.slots);
+  return ret;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,25 @@
+#!/bin/sh
+# cwd scaling with number of shards (run by `make bench-cwd`).
+# Columns: shards, then cwdload end to end throughput (lines parsed per
+# second by cwd). Expect growth up to the number of cores.
+
+set -e
+
+BENCH_CONNS=${BENCH_CONNS:-2000}
+BENCH_LINES=${BENCH_LINES:-2000}
+SOCK=${TMPDIR:-/tmp}/cwdbench.$$.sock
+NCPU=$(getconf _NPROCESSORS_ONLN 2>/dev/null || echo 1)
+
+trap 'kill $pid 2>/dev/null || :; rm -f $SOCK' EXIT
+
+echo "online CPUs: $NCPU"
+for shards in 1 2 4 8 16; do
+  ./cwd -i 0 -t $shards -l $SOCK &
+  pid=$!
+  while ! test -S $SOCK; do sleep 0.1; done
+  printf '%-3s shards: ' $shards
+  ./cwdload -t $NCPU -c $BENCH_CONNS -n $BENCH_LINES $SOCK
+  kill $pid
+  wait $pid || true
+  test $shards -lt $NCPU -o $shards -lt 2 || break
+done
@@ -0,0 +1,242 @@
+/*
+ * cURL wrapper - cwd load generator
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Open many producer connections to cwd and write synthetic progress
+ * meter lines as fast as possible. Each connection is then half closed and
+ * we wait for cwd to close it: it has parsed everything. Throughput is
+ * end to end (lines/s handled by cwd).
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "common.h"
+
+#define CWDLOAD_NAME "cwdload"
+#define BATCH_LINES 16      /* lines per write() */
+
+static struct sockaddr_un addr = { .sun_family = AF_UNIX };
+static unsigned int lines_per_conn = 1000;
+
+typedef struct {
+  pthread_t thread;
+  unsigned int conns;       /* connections of this thread */
+  int error;
+} worker_t;
+
+static double elapsed (const struct timespec *t0)
+{
+  struct timespec t1;
+
+  clock_gettime(CLOCK_MONOTONIC, &t1);
+  return (double)(t1.tv_sec - t0->tv_sec) + (t1.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* One progress meter line, similar to curl's output (last one ends line) */
+static size_t meter_line (char *buf, size_t len, unsigned int i)
+{
+  unsigned int pct = (i * 100) / lines_per_conn;
+
+  return (size_t)snprintf(buf, len, "\r%3u  100M  %3u %4uM    0     0  %4uk"
+      "      0  0:01:40  0:00:%02u  0:01:%02u  %4uk%s", pct, pct, pct,
+      1000 + i % 100, i % 60, 40 - i % 40, 1000 + i % 97,
+      (i == lines_per_conn) ? "\n" : "");
+}
+
+static int write_full (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n == -1) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+static void *worker_run (void *arg)
+{
+  char buf[BATCH_LINES * 128], drain[64];
+  worker_t *w = arg;
+  int *fds;
+  size_t len;
+
+  fds = malloc(w->conns * sizeof(int));
+  if (!fds) {
+    w->error = ENOMEM;
+    return NULL;
+  }
+
+  for (unsigned int j = 0; j < w->conns; j++) {
+    fds[j] = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (fds[j] == -1 ||
+        connect(fds[j], (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+      w->error = errno;
+      w->conns = j;
+      break;
+    }
+  }
+
+  /* Round robin: all connections stay active during the run */
+  for (unsigned int i = 0; i < lines_per_conn && !w->error; i += BATCH_LINES) {
+    for (unsigned int j = 0; j < w->conns; j++) {
+      len = 0;
+      for (unsigned int k = i; k < i + BATCH_LINES && k < lines_per_conn; k++)
+        len += meter_line(buf + len, sizeof(buf) - len, k + 1);
+      if (write_full(fds[j], buf, len) == -1) {
+        w->error = errno;
+        break;
+      }
+    }
+  }
+
+  for (unsigned int j = 0; j < w->conns; j++)
+    shutdown(fds[j], SHUT_WR);
+
+  /* cwd closes connection when all data has been parsed */
+  for (unsigned int j = 0; j < w->conns; j++) {
+    while (read(fds[j], drain, sizeof(drain)) > 0)
+      ;
+    close(fds[j]);
+  }
+
+  free(fds);
+  return NULL;
+}
+
+int main (int argc, char *argv[])
+{
+  unsigned long conns = 1000, threads = 1;
+  struct timespec t0;
+  worker_t *workers;
+  int c, option_index, ret = 0;
+  double secs;
+  char *end;
+
+  const struct option switches[] = {
+    {"connections", required_argument, 0, 'c'},
+    {"lines",       required_argument, 0, 'n'},
+    {"threads",     required_argument, 0, 't'},
+    {"help",        no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  while ((c = getopt_long(argc, argv, "c:hn:t:", switches, &option_index)) != -1) {
+    switch(c) {
+      case 'c':
+        conns = strtoul(optarg, &end, 10);
+        if (*end != '\0' || conns == 0) {
+          CW_ERROR("%s: invalid number of connections", optarg);
+          return -1;
+        }
+        break;
+      case 'h':
+        fprintf(stdout, "Usage: %s [OPTIONS...] SOCKET\n"
+            "Load generator for cwd.\n"
+            "\nOptions:\n"
+            "   -c,  --connections=N   producer connections (default: 1000)\n"
+            "   -h,  --help            display this help and exit\n"
+            "   -n,  --lines=N         progress lines per connection (default: 1000)\n"
+            "   -t,  --threads=N       writer threads (default: 1)\n",
+            CWDLOAD_NAME);
+        return 0;
+      case 'n':
+        lines_per_conn = (unsigned int)strtoul(optarg, &end, 10);
+        if (*end != '\0' || lines_per_conn == 0) {
+          CW_ERROR("%s: invalid number of lines", optarg);
+          return -1;
+        }
+        break;
+      case 't':
+        threads = strtoul(optarg, &end, 10);
+        if (*end != '\0' || threads == 0 || threads > 1024) {
+          CW_ERROR("%s: invalid number of threads", optarg);
+          return -1;
+        }
+        break;
+      default:
+        fprintf(stderr, "Try `%s --help' for more information.\n", CWDLOAD_NAME);
+        return -1;
+    }
+  }
+
+  if (optind + 1 != argc || strlen(argv[optind]) >= sizeof(addr.sun_path)) {
+    fprintf(stderr, "Try `%s --help' for more information.\n", CWDLOAD_NAME);
+    return -1;
+  }
+  strcpy(addr.sun_path, argv[optind]);
+
+  if (threads > conns)
+    threads = conns;
+
+  workers = calloc(threads, sizeof(worker_t));
+  if (!workers) {
+    CW_ERROR_ERRNO(ENOMEM, "workers");
+    return -1;
+  }
+
+  signal(SIGPIPE, SIG_IGN);
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+
+  for (unsigned long i = 0; i < threads; i++) {
+    workers[i].conns = (unsigned int)(conns / threads + (i < conns % threads));
+    if (pthread_create(&workers[i].thread, NULL, worker_run, &workers[i]) != 0) {
+      CW_ERROR("pthread_create failed");
+      threads = i;
+      ret = -1;
+      break;
+    }
+  }
+
+  for (unsigned long i = 0; i < threads; i++) {
+    pthread_join(workers[i].thread, NULL);
+    if (workers[i].error) {
+      CW_ERROR_ERRNO(workers[i].error, "%s", addr.sun_path);
+      ret = -1;
+    }
+  }
+
+  secs = elapsed(&t0);
+  if (ret == 0)
+    fprintf(stdout, "%lu connections, %lu lines in %.3f s: %.0f lines/s\n",
+        conns, conns * lines_per_conn, secs, (double)(conns * lines_per_conn) / secs);
+
+  free(workers);
+  return ret;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,368 @@
+/*
+ * cURL wrapper - progress recording query and replay tool
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <getopt.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "rec.h"
+
+#define CWREC_NAME "cwrec"
+
+typedef struct {
+  uint64_t from, to;        /* ms since recording start */
+  unsigned int stream;      /* 1 based, 0 for all */
+  uint64_t step;            /* downsampling period (ms), 0 for none */
+  double factor;            /* replay speed, 0 for no wait */
+  cw_options_t filter;
+} cwrec_options_t;
+
+static void usage (FILE *fp)
+{
+  fprintf(fp, "Usage: %s COMMAND [OPTIONS...] FILE\n"
+      "Query or replay a progress recording (cw --record).\n"
+      "\nCommands:\n"
+      "   info                   recording summary\n"
+      "   dump                   print samples (CSV: time_ms,stream,bytes,speed,total)\n"
+      "   replay                 feed samples to cw filter (stdout), as curl would\n"
+      "\nOptions:\n"
+      "   -f,  --from=SECS       skip samples before SECS (from recording start)\n"
+      "   -t,  --to=SECS         stop after SECS\n"
+      "   -i,  --stream=N        only stream N (dump)\n"
+      "   -d,  --step=MS         at most one sample per stream every MS (dump)\n"
+      "   -x,  --speed=FACTOR    replay speed (default: 1, 0: no wait)\n"
+      "   -s,  --smooth          smoothed speed and ETA (replay)\n"
+      "   -h,  --help            display this help and exit\n",
+      CWREC_NAME);
+}
+
+static bool parse_secs (const char *arg, uint64_t *ms)
+{
+  char *end;
+  double v;
+
+  errno = 0;
+  v = strtod(arg, &end);
+  if (errno || *end != '\0' || v < 0)
+    return false;
+
+  *ms = (uint64_t)(v * 1000);
+  return true;
+}
+
+static int cmd_info (cw_rec_reader_t *r)
+{
+  uint64_t samples = 0, last = 0, *counts;
+  time_t start = (time_t)(cw_rec_start(r) / 1000);
+  cw_rec_sample_t s;
+  char date[32];
+  int ret;
+
+  counts = calloc(cw_rec_streams(r), sizeof(uint64_t));
+  if (!counts)
+    return -1;
+
+  while ((ret = cw_rec_next(r, &s)) > 0) {
+    samples++;
+    counts[s.stream]++;
+    last = s.time;
+  }
+
+  strftime(date, sizeof(date), "%Y-%m-%d %H:%M:%S", localtime(&start));
+  printf("start:    %s\n"
+      "duration: %" PRIu64 ".%03u s\n"
+      "streams:  %u\n"
+      "chunks:   %u\n"
+      "samples:  %" PRIu64 "\n", date, last / 1000, (unsigned int)(last % 1000),
+      cw_rec_streams(r), cw_rec_chunks(r), samples);
+  for (unsigned int i = 0; i < cw_rec_streams(r); i++)
+    printf("  %u: %" PRIu64 " samples\n", i + 1, counts[i]);
+
+  free(counts);
+  if (ret < 0)
+    CW_ERROR("corrupted data after %" PRIu64 " samples", samples);
+  return (ret < 0) ? -1 : 0;
+}
+
+static int cmd_dump (cw_rec_reader_t *r, const cwrec_options_t *opts)
+{
+  uint64_t *next;
+  cw_rec_sample_t s;
+  int ret;
+
+  next = calloc(cw_rec_streams(r), sizeof(uint64_t));
+  if (!next)
+    return -1;
+
+  cw_rec_seek(r, opts->from);
+  while ((ret = cw_rec_next(r, &s)) > 0 && s.time <= opts->to) {
+    if (opts->stream && s.stream + 1 != opts->stream)
+      continue;
+    if (opts->step) {
+      if (s.time < next[s.stream])
+        continue;
+      next[s.stream] = (s.time / opts->step + 1) * opts->step;
+    }
+    printf("%" PRIu64 ",%u,%" PRIu64 ",%" PRIu64 ",%" PRIu64 "\n", s.time,
+        s.stream + 1, s.bytes, s.speed, s.total);
+  }
+
+  free(next);
+  if (ret < 0)
+    CW_ERROR("corrupted data");
+  return (ret < 0) ? -1 : 0;
+}
+
+/* Rebuild curl progress meter line from a sample */
+static size_t meter_line (char *buf, size_t len, const cw_rec_sample_t *s,
+    uint64_t elapsed_ms)
+{
+  char total[8], bytes[8], avg[8], speed[8], t_total[10], t_spent[10], t_left[10];
+  int64_t spent = (int64_t)(elapsed_ms / 1000), all = -1;
+  uint64_t average = (elapsed_ms) ? s->bytes * 1000 / elapsed_ms : 0;
+  int percent = (s->total) ? (int)(s->bytes * 100 / s->total) : 0;
+
+  if (s->total && average)
+    all = (int64_t)(s->total / average);
+
+  return (size_t)snprintf(buf, len, "\r%3d %5s %3d %5s    0     0 %5s      0 "
+      "%8s %8s %8s %5s", percent, cw_format_size(total, sizeof(total), s->total),
+      percent, cw_format_size(bytes, sizeof(bytes), s->bytes),
+      cw_format_size(avg, sizeof(avg), average),
+      cw_format_time(t_total, sizeof(t_total), all),
+      cw_format_time(t_spent, sizeof(t_spent), spent),
+      cw_format_time(t_left, sizeof(t_left), (all >= spent) ? all - spent : -1),
+      cw_format_size(speed, sizeof(speed), s->speed));
+}
+
+/* Child process: write samples to pipes at recorded pace */
+static void replay_feed (cw_rec_reader_t *r, const cwrec_options_t *opts,
+    const int *fds)
+{
+  unsigned int count = cw_rec_streams(r);
+  uint64_t *first, base = 0, due;
+  struct timespec t0, ts;
+  cw_rec_sample_t s;
+  char line[128];
+  size_t len;
+  bool started = false;
+
+  first = calloc(count, sizeof(uint64_t));
+  if (!first)
+    return;
+  for (unsigned int i = 0; i < count; i++)
+    first[i] = UINT64_MAX;
+
+  clock_gettime(CLOCK_MONOTONIC, &t0);
+  cw_rec_seek(r, opts->from);
+
+  while (cw_rec_next(r, &s) > 0 && s.time <= opts->to) {
+    if (!started) {
+      base = s.time;
+      started = true;
+    }
+    if (first[s.stream] == UINT64_MAX)
+      first[s.stream] = s.time;
+
+    if (opts->factor > 0) {
+      due = (uint64_t)((double)(s.time - base) / opts->factor);
+      ts.tv_sec = t0.tv_sec + (time_t)(due / 1000);
+      ts.tv_nsec = t0.tv_nsec + (long)(due % 1000) * 1000000L;
+      if (ts.tv_nsec >= 1000000000L) {
+        ts.tv_sec++;
+        ts.tv_nsec -= 1000000000L;
+      }
+      while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR)
+        ;
+    }
+
+    len = meter_line(line, sizeof(line), &s, s.time - first[s.stream]);
+    if (write(fds[s.stream], line, len) == -1)
+      break;
+  }
+
+  /* Last line of each stream */
+  for (unsigned int i = 0; i < count; i++)
+    write(fds[i], "\n", 1);
+
+  free(first);
+}
+
+static int cmd_replay (cw_rec_reader_t *r, const cwrec_options_t *opts)
+{
+  unsigned int count = cw_rec_streams(r);
+  int *in_fds, *out_fds, p[2], ret = -1;
+  pid_t pid;
+
+  in_fds = calloc(count, sizeof(int));
+  out_fds = calloc(count, sizeof(int));
+  if (!in_fds || !out_fds)
+    goto out;
+
+  for (unsigned int i = 0; i < count; i++) {
+    if (pipe(p) == -1) {
+      CW_ERROR_ERRNO(errno, "pipe");
+      goto out;
+    }
+    in_fds[i] = p[0];
+    out_fds[i] = p[1];
+  }
+
+  pid = fork();
+  if (pid == (pid_t)-1) {
+    CW_ERROR_ERRNO(errno, "fork");
+    goto out;
+  }
+
+  if (pid == 0) { /* child */
+    for (unsigned int i = 0; i < count; i++)
+      close(in_fds[i]);
+    replay_feed(r, opts, out_fds);
+    exit(EXIT_SUCCESS);
+  }
+
+  for (unsigned int i = 0; i < count; i++)
+    close(out_fds[i]);
+
+  /* Blocking loop inside */
+  ret = cw_filter_multi(in_fds, count, STDOUT_FILENO, &opts->filter);
+  if (ret == 0 && count == 1)
+    write(STDOUT_FILENO, "100\n", 4);
+
+  kill(pid, SIGTERM); /* interrupted filter */
+  waitpid(pid, NULL, 0);
+
+out:
+  free(in_fds);
+  free(out_fds);
+  return (ret < 0) ? -1 : 0;
+}
+
+int main (int argc, char *argv[])
+{
+  cwrec_options_t opts = { .to = UINT64_MAX, .factor = 1 };
+  const char *command;
+  cw_rec_reader_t *r;
+  int c, option_index, ret;
+  char *end;
+
+  const struct option switches[] = {
+    {"from",    required_argument, 0, 'f'},
+    {"to",      required_argument, 0, 't'},
+    {"stream",  required_argument, 0, 'i'},
+    {"step",    required_argument, 0, 'd'},
+    {"speed",   required_argument, 0, 'x'},
+    {"smooth",  no_argument, 0, 's'},
+    {"help",    no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  if (argc < 2 || *argv[1] == '-') {
+    usage((argc == 2 && (strcmp(argv[1], "-h") == 0 ||
+            strcmp(argv[1], "--help") == 0)) ? stdout : stderr);
+    return (argc == 2 && *argv[1] == '-') ? 0 : -1;
+  }
+
+  command = argv[1];
+  argc--;
+  argv++;
+
+  while ((c = getopt_long(argc, argv, "d:f:hi:st:x:", switches, &option_index)) != -1) {
+    switch(c) {
+      case 'h':
+        usage(stdout);
+        return 0;
+      case 'f':
+        if (!parse_secs(optarg, &opts.from)) {
+          CW_ERROR("%s: invalid time", optarg);
+          return -1;
+        }
+        break;
+      case 't':
+        if (!parse_secs(optarg, &opts.to)) {
+          CW_ERROR("%s: invalid time", optarg);
+          return -1;
+        }
+        break;
+      case 'i':
+        errno = 0;
+        opts.stream = (unsigned int)strtoul(optarg, &end, 10);
+        if (errno || *end != '\0' || opts.stream == 0) {
+          CW_ERROR("%s: invalid stream number", optarg);
+          return -1;
+        }
+        break;
+      case 'd':
+        errno = 0;
+        opts.step = strtoull(optarg, &end, 10);
+        if (errno || *end != '\0' || opts.step == 0) {
+          CW_ERROR("%s: invalid step", optarg);
+          return -1;
+        }
+        break;
+      case 'x':
+        opts.factor = strtod(optarg, &end);
+        if (*end != '\0' || opts.factor < 0) {
+          CW_ERROR("%s: invalid speed factor", optarg);
+          return -1;
+        }
+        break;
+      case 's':
+        opts.filter.smooth = 1;
+        break;
+      default:
+        fprintf(stderr, "Try `%s --help' for more information.\n", CWREC_NAME);
+        return -1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    fprintf(stderr, "Try `%s --help' for more information.\n", CWREC_NAME);
+    return -1;
+  }
+
+  r = cw_rec_open(argv[optind]);
+  if (!r)
+    return -1;
+
+  if (strcmp(command, "info") == 0) {
+    ret = cmd_info(r);
+  } else if (strcmp(command, "dump") == 0) {
+    ret = cmd_dump(r, &opts);
+  } else if (strcmp(command, "replay") == 0) {
+    ret = cmd_replay(r, &opts);
+  } else {
+    CW_ERROR("%s: unknown command", command);
+    ret = -1;
+  }
+
+  cw_rec_free(r);
+  return ret;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,136 @@
+/*
+ * cURL wrapper - shared memory progress export reader
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <getopt.h>
+
+#include "common.h"
+#include "shm.h"
+
+#define CWSHM_NAME "cwshm"
+
+static const char *state_name (uint32_t state)
+{
+  switch (state) {
+    case CW_SHM_IDLE:    return "idle";
+    case CW_SHM_RUNNING: return "running";
+    case CW_SHM_STALLED: return "stalled";
+    case CW_SHM_DONE:    return "done";
+    default:             return "?";
+  }
+}
+
+/* Print one line per stream, return number of streams not done */
+static unsigned int print_records (const cw_shm_t *shm)
+{
+  char size[8], total[8], speed[8], avg[8], eta[10];
+  unsigned int i, running = 0;
+  cw_shm_record_t r;
+
+  for (i = 0; i < cw_shm_count(shm); i++) {
+    if (!cw_shm_read(shm, i, &r)) {
+      printf("%u: busy\n", i + 1);
+      running++;
+      continue;
+    }
+
+    if (r.state != CW_SHM_DONE)
+      running++;
+
+    printf("%u: %-7s %3d%%", i + 1, state_name(r.state), r.percent);
+
+    if (r.fields & CW_FIELD_METER) {
+      cw_format_size(size, sizeof(size), (r.received) ? r.received : r.uploaded);
+      cw_format_size(total, sizeof(total), r.total);
+      cw_format_size(speed, sizeof(speed), r.speed);
+      printf(" %s/%s %s/s", size, (r.total) ? total : "?", speed);
+      if (r.avg_speed)
+        printf(" (avg %s/s)", cw_format_size(avg, sizeof(avg), r.avg_speed));
+      printf(" ETA %s", cw_format_time(eta, sizeof(eta), r.time_left));
+    }
+    putchar('\n');
+  }
+
+  return running;
+}
+
+int main (int argc, char *argv[])
+{
+  unsigned int interval = 0;
+  int c, option_index;
+  cw_shm_t *shm;
+  char *end;
+
+  const struct option switches[] = {
+    {"watch",   required_argument, 0, 'w'},
+    {"help",    no_argument, 0, 'h'},
+    {0, 0, 0, 0}
+  };
+
+  while ((c = getopt_long(argc, argv, "hw:", switches, &option_index)) != -1) {
+    switch(c) {
+      case 'h':
+        fprintf(stdout, "Usage: %s [OPTIONS...] FILE\n"
+            "Print progress exported by cw --shm or c2z --c2z-shm.\n"
+            "\nOptions:\n"
+            "   -h,  --help            display this help and exit\n"
+            "   -w,  --watch=SECS      print again every SECS seconds until all\n"
+            "                          transfers are done\n",
+            CWSHM_NAME);
+        return 0;
+      case 'w':
+        errno = 0;
+        interval = (unsigned int)strtoul(optarg, &end, 10);
+        if (errno || *end != '\0' || interval == 0) {
+          CW_ERROR("%s: invalid interval", optarg);
+          return -1;
+        }
+        break;
+      default:
+        fprintf(stderr, "Try `%s --help' for more information.\n", CWSHM_NAME);
+        return -1;
+    }
+  }
+
+  if (optind + 1 != argc) {
+    fprintf(stderr, "Try `%s --help' for more information.\n", CWSHM_NAME);
+    return -1;
+  }
+
+  shm = cw_shm_open(argv[optind]);
+  if (!shm)
+    return -1;
+
+  while (print_records(shm) > 0 && interval > 0) {
+    /* Writer has gone without closing streams */
+    if (kill(cw_shm_pid(shm), 0) == -1 && errno == ESRCH)
+      break;
+    fflush(stdout);
+    sleep(interval);
+  }
+
+  cw_shm_close(shm);
+  return 0;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,375 @@
+/*
+ * cURL wrapper - payload digests (SHA-256, CRC-32)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Payload is hashed while it is written out: when input is a pipe, bytes
+ * are duplicated in kernel (tee) to an intermediate pipe which is spliced
+ * to the output file, and input is read once for hashing. Payload is
+ * copied to user space only once, nothing is read back from disk.
+ */
+
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "digest.h"
+
+#define DIGEST_BUFFER_SIZE (256 * 1024)
+
+#define ROR(x, n) (((x) >> (n)) | ((x) << (32 - (n))))
+
+static const uint32_t sha256_k[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2
+};
+
+/* Process one 64 bytes block */
+static void sha256_block (uint32_t state[8], const uint8_t *p)
+{
+  uint32_t w[64], a, b, c, d, e, f, g, h, t1, t2;
+  int i;
+
+  for (i = 0; i < 16; i++, p += 4)
+    w[i] = (uint32_t)p[0] << 24 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 8 | p[3];
+  for (; i < 64; i++)
+    w[i] = (ROR(w[i - 2], 17) ^ ROR(w[i - 2], 19) ^ (w[i - 2] >> 10)) + w[i - 7] +
+        (ROR(w[i - 15], 7) ^ ROR(w[i - 15], 18) ^ (w[i - 15] >> 3)) + w[i - 16];
+
+  a = state[0], b = state[1], c = state[2], d = state[3];
+  e = state[4], f = state[5], g = state[6], h = state[7];
+
+  for (i = 0; i < 64; i++) {
+    t1 = h + (ROR(e, 6) ^ ROR(e, 11) ^ ROR(e, 25)) + ((e & f) ^ (~e & g)) +
+        sha256_k[i] + w[i];
+    t2 = (ROR(a, 2) ^ ROR(a, 13) ^ ROR(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+    h = g, g = f, f = e, e = d + t1;
+    d = c, c = b, b = a, a = t1 + t2;
+  }
+
+  state[0] += a, state[1] += b, state[2] += c, state[3] += d;
+  state[4] += e, state[5] += f, state[6] += g, state[7] += h;
+}
+
+void cw_sha256_init (cw_sha256_t *ctx)
+{
+  static const uint32_t h0[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19
+  };
+
+  memcpy(ctx->state, h0, sizeof(h0));
+  ctx->length = 0;
+  ctx->fill = 0;
+}
+
+void cw_sha256_update (cw_sha256_t *ctx, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+  size_t n;
+
+  ctx->length += len;
+
+  if (ctx->fill) {
+    n = sizeof(ctx->block) - ctx->fill;
+    if (n > len)
+      n = len;
+    memcpy(ctx->block + ctx->fill, p, n);
+    ctx->fill += n, p += n, len -= n;
+    if (ctx->fill < sizeof(ctx->block))
+      return;
+    sha256_block(ctx->state, ctx->block);
+    ctx->fill = 0;
+  }
+
+  /* Full blocks are hashed in place */
+  for (; len >= sizeof(ctx->block); p += 64, len -= 64)
+    sha256_block(ctx->state, p);
+
+  memcpy(ctx->block, p, len);
+  ctx->fill = len;
+}
+
+void cw_sha256_final (cw_sha256_t *ctx, uint8_t digest[CW_SHA256_SIZE])
+{
+  uint64_t bits = ctx->length * 8;
+
+  ctx->block[ctx->fill++] = 0x80;
+  if (ctx->fill > 56) {
+    memset(ctx->block + ctx->fill, 0, sizeof(ctx->block) - ctx->fill);
+    sha256_block(ctx->state, ctx->block);
+    ctx->fill = 0;
+  }
+  memset(ctx->block + ctx->fill, 0, 56 - ctx->fill);
+  for (int i = 0; i < 8; i++)
+    ctx->block[56 + i] = (uint8_t)(bits >> (56 - 8 * i));
+  sha256_block(ctx->state, ctx->block);
+
+  for (int i = 0; i < 8; i++) {
+    digest[4 * i] = (uint8_t)(ctx->state[i] >> 24);
+    digest[4 * i + 1] = (uint8_t)(ctx->state[i] >> 16);
+    digest[4 * i + 2] = (uint8_t)(ctx->state[i] >> 8);
+    digest[4 * i + 3] = (uint8_t)ctx->state[i];
+  }
+}
+
+/* CRC-32 (IEEE 802.3, same as zlib), slicing by 8 bytes */
+static uint32_t crc32_table[8][256];
+
+static void crc32_init (void)
+{
+  uint32_t c;
+
+  for (unsigned int i = 0; i < 256; i++) {
+    c = i;
+    for (int k = 0; k < 8; k++)
+      c = (c & 1) ? 0xedb88320 ^ (c >> 1) : c >> 1;
+    crc32_table[0][i] = c;
+  }
+
+  for (unsigned int i = 0; i < 256; i++)
+    for (int t = 1; t < 8; t++)
+      crc32_table[t][i] = (crc32_table[t - 1][i] >> 8) ^
+          crc32_table[0][crc32_table[t - 1][i] & 0xff];
+}
+
+/**
+ * Update a CRC-32 checksum.
+ *
+ * \param[in] crc current checksum (0 to start)
+ * \param[in] data bytes to add
+ * \param[in] len number of bytes
+ * \return updated checksum
+ */
+uint32_t cw_crc32 (uint32_t crc, const void *data, size_t len)
+{
+  const uint8_t *p = data;
+
+  if (crc32_table[0][1] == 0)
+    crc32_init();
+
+  crc = ~crc;
+  for (; len >= 8; p += 8, len -= 8) {
+    uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 |
+        (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    crc = crc32_table[7][lo & 0xff] ^ crc32_table[6][(lo >> 8) & 0xff] ^
+        crc32_table[5][(lo >> 16) & 0xff] ^ crc32_table[4][lo >> 24] ^
+        crc32_table[3][p[4]] ^ crc32_table[2][p[5]] ^
+        crc32_table[1][p[6]] ^ crc32_table[0][p[7]];
+  }
+  while (len--)
+    crc = crc32_table[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+  return ~crc;
+}
+
+void cw_digest_init (cw_digest_t *d, bool sha256, bool crc32)
+{
+  memset(d, 0, sizeof(*d));
+  d->sha256 = sha256;
+  d->crc32 = crc32;
+  if (sha256)
+    cw_sha256_init(&d->sha);
+}
+
+static void digest_update (cw_digest_t *d, const char *buf, size_t len)
+{
+  if (d->sha256)
+    cw_sha256_update(&d->sha, buf, len);
+  if (d->crc32)
+    d->crc = cw_crc32(d->crc, buf, len);
+  d->bytes += len;
+}
+
+/* Write a whole buffer, -1 on error */
+static int write_full (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/* Read exactly len bytes (they are known to be there), -1 on error */
+static int read_full (int fd, char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = read(fd, buf, len);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n <= 0)
+      return -1;
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/* Move bytes from intermediate pipe to output, -1 on error */
+static int splice_full (int pipe_fd, int out_fd, char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = splice(pipe_fd, NULL, out_fd, NULL, len, SPLICE_F_MOVE);
+    if (n < 0 && errno == EINTR)
+      continue;
+    if (n < 0 && errno == EINVAL) {
+      /* Output can't be spliced to: copy */
+      n = read(pipe_fd, buf, (len < DIGEST_BUFFER_SIZE) ? len : DIGEST_BUFFER_SIZE);
+      if (n <= 0 || write_full(out_fd, buf, (size_t)n) < 0)
+        return -1;
+    } else if (n <= 0) {
+      return -1;
+    }
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/**
+ * Copy input to output until end of file, computing digests on the way.
+ *
+ * \param[in,out] d digests
+ * \param[in] in_fd input (a pipe is best)
+ * \param[in] out_fd output file
+ * \return 0 on success, -1 on read or write error
+ */
+int cw_digest_copy (cw_digest_t *d, int in_fd, int out_fd)
+{
+  int aux[2] = {-1, -1};
+  bool use_tee = false;
+  struct stat st;
+  ssize_t n;
+  char *buf;
+  int ret = -1;
+
+  buf = malloc(DIGEST_BUFFER_SIZE);
+  if (!buf) {
+    CW_ERROR_ERRNO(errno, "malloc");
+    return -1;
+  }
+
+  if (fstat(in_fd, &st) == 0 && S_ISFIFO(st.st_mode) && pipe2(aux, O_CLOEXEC) == 0) {
+    use_tee = true;
+    /* Bigger pipes, less wakeups (best effort) */
+    fcntl(in_fd, F_SETPIPE_SZ, DIGEST_BUFFER_SIZE);
+    fcntl(aux[1], F_SETPIPE_SZ, DIGEST_BUFFER_SIZE);
+  }
+
+  for (;;) {
+    if (use_tee) {
+      n = tee(in_fd, aux[1], DIGEST_BUFFER_SIZE, 0);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0 && errno == EINVAL) {
+        use_tee = false;
+        continue;
+      }
+      if (n < 0) {
+        CW_ERROR_ERRNO(errno, "tee");
+        goto out;
+      }
+      if (n > 0 && splice_full(aux[0], out_fd, buf, (size_t)n) < 0) {
+        CW_ERROR_ERRNO(errno, "write");
+        goto out;
+      }
+      if (n > 0 && read_full(in_fd, buf, (size_t)n) < 0) {
+        CW_ERROR_ERRNO(errno, "read");
+        goto out;
+      }
+    } else {
+      n = read(in_fd, buf, DIGEST_BUFFER_SIZE);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0) {
+        CW_ERROR_ERRNO(errno, "read");
+        goto out;
+      }
+      if (n > 0 && write_full(out_fd, buf, (size_t)n) < 0) {
+        CW_ERROR_ERRNO(errno, "write");
+        goto out;
+      }
+    }
+
+    if (n == 0)
+      break;
+    digest_update(d, buf, (size_t)n);
+  }
+
+  ret = 0;
+
+out:
+  if (aux[0] >= 0) {
+    close(aux[0]);
+    close(aux[1]);
+  }
+  free(buf);
+  return ret;
+}
+
+/**
+ * Finalize digests, as lowercase hexadecimal strings.
+ *
+ * \param[in,out] d digests (SHA-256 can't be updated anymore)
+ * \param[out] sha256 SHA-256 (empty string if not computed)
+ * \param[out] crc32 CRC-32 (empty string if not computed)
+ */
+void cw_digest_hex (cw_digest_t *d, char sha256[2 * CW_SHA256_SIZE + 1],
+    char crc32[9])
+{
+  uint8_t digest[CW_SHA256_SIZE];
+
+  *sha256 = *crc32 = '\0';
+
+  if (d->sha256) {
+    cw_sha256_final(&d->sha, digest);
+    for (int i = 0; i < CW_SHA256_SIZE; i++)
+      sprintf(sha256 + 2 * i, "%02x", digest[i]);
+  }
+
+  if (d->crc32)
+    sprintf(crc32, "%08x", d->crc);
+}
+
+/* vim: set et sw=2 ts=4: */
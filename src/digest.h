@@ -0,0 +1,55 @@
+/*
+ * cURL wrapper - payload digests (SHA-256, CRC-32)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef DIGEST_H
+#define DIGEST_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CW_SHA256_SIZE 32
+
+typedef struct {
+  uint32_t state[8];
+  uint64_t length;          /* bytes hashed so far */
+  uint8_t block[64];
+  size_t fill;              /* bytes pending in block */
+} cw_sha256_t;
+
+void cw_sha256_init (cw_sha256_t *ctx);
+void cw_sha256_update (cw_sha256_t *ctx, const void *data, size_t len);
+void cw_sha256_final (cw_sha256_t *ctx, uint8_t digest[CW_SHA256_SIZE]);
+
+uint32_t cw_crc32 (uint32_t crc, const void *data, size_t len);
+
+/* Digests computed while a payload is copied */
+typedef struct {
+  bool sha256;
+  bool crc32;
+  cw_sha256_t sha;
+  uint32_t crc;
+  uint64_t bytes;           /* bytes copied */
+} cw_digest_t;
+
+void cw_digest_init (cw_digest_t *d, bool sha256, bool crc32);
+int cw_digest_copy (cw_digest_t *d, int in_fd, int out_fd);
+void cw_digest_hex (cw_digest_t *d, char sha256[2 * CW_SHA256_SIZE + 1],
+    char crc32[9]);
+
+#endif /* DIGEST_H */
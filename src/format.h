@@ -0,0 +1,86 @@
+/*
+ * cURL wrapper - machine readable output (binary records)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef FORMAT_H
+#define FORMAT_H
+
+#include <stdint.h>
+
+/*
+ * `cw --format=binary` writes a stream of fixed size records (native byte
+ * order, no header). Several records are written at once: a consumer reads
+ * any multiple of the record size. `--format=json` writes the same fields,
+ * one JSON object per line.
+ */
+#define CW_RECORD_SIZE 128
+
+enum {
+  CW_RECORD_PROGRESS = 1,   /* parsed result */
+  CW_RECORD_TIMING,         /* latency breakdown (end of transfer) */
+  CW_RECORD_SUMMARY,        /* speed statistics (end of transfer, --smooth) */
+  CW_RECORD_END,            /* input closed */
+};
+
+#define CW_RECORD_STALLED 1 /* flags: no byte progress for stall timeout */
+
+typedef struct {
+  uint32_t type;            /* CW_RECORD_* */
+  uint32_t stream;          /* input number (1 based) */
+  uint64_t time;            /* wall clock (ms since Epoch) */
+  union {
+    struct {
+      uint32_t fields;      /* CW_FIELD_* mask */
+      int32_t percent;
+      uint64_t total;       /* 0 if unknown */
+      uint64_t received;
+      uint64_t uploaded;
+      uint64_t speed;       /* current speed (bytes/s) */
+      uint64_t dl_speed;    /* average download speed */
+      uint64_t ul_speed;    /* average upload speed */
+      int64_t time_total;   /* seconds, -1 if unknown */
+      int64_t time_spent;   /* seconds, -1 if unknown */
+      int64_t time_left;    /* seconds, -1 if unknown */
+      uint64_t avg_speed;   /* smoothed speed, 0 if statistics are disabled */
+      int64_t eta;          /* seconds (smoothed), -1 if unknown */
+      uint32_t flags;       /* CW_RECORD_STALLED */
+      uint32_t transfers;   /* parallel meter (-Z), 0 otherwise */
+      uint32_t live;
+      uint32_t pad;
+    } progress;
+    struct {
+      int64_t dns_us;       /* phase durations (microseconds) */
+      int64_t connect_us;
+      int64_t tls_us;
+      int64_t wait_us;
+      int64_t transfer_us;
+      uint64_t speed;       /* average download speed (bytes/s) */
+      uint64_t size;        /* downloaded bytes */
+    } timing;
+    struct {
+      uint64_t avg;         /* speeds (bytes/s) */
+      uint64_t min;
+      uint64_t p50;
+      uint64_t p95;
+      uint64_t max;
+      uint64_t samples;
+    } summary;
+    uint8_t pad[112];
+  } u;
+} cw_record_t;
+
+#endif /* FORMAT_H */
@@ -0,0 +1,294 @@
+/*
+ * Zenity cURL wrapper - in-process transfers (libcurl)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "inproc.h"
+
+#ifdef HAVE_LIBCURL
+static uint64_t now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/**
+ * Check if a curl command-line can be handled in-process.
+ * Any unknown switch means no: curl will be executed.
+ *
+ * \param[in] argc number of arguments
+ * \param[in] argv curl arguments (argv[0] is ignored)
+ * \param[out] req parsed request
+ * \return true if supported
+ */
+bool inproc_parse (int argc, char *argv[], inproc_request_t *req)
+{
+  const char *arg;
+
+  memset(req, 0, sizeof(*req));
+
+  for (int i = 1; i < argc; i++) {
+    arg = argv[i];
+
+    if (*arg != '-') {
+      if (req->url)
+        return false; /* several URLs */
+      req->url = arg;
+    } else if (strcmp(arg, "-o") == 0 || strcmp(arg, "--output") == 0) {
+      if (++i == argc)
+        return false;
+      req->output = argv[i];
+    } else if (strcmp(arg, "-A") == 0 || strcmp(arg, "--user-agent") == 0) {
+      if (++i == argc)
+        return false;
+      req->user_agent = argv[i];
+    } else if (strcmp(arg, "-O") == 0 || strcmp(arg, "--remote-name") == 0) {
+      req->remote_name = true;
+    } else if (strcmp(arg, "-L") == 0 || strcmp(arg, "--location") == 0) {
+      req->location = true;
+    } else if (strcmp(arg, "-f") == 0 || strcmp(arg, "--fail") == 0) {
+      req->fail = true;
+    } else if (strcmp(arg, "-k") == 0 || strcmp(arg, "--insecure") == 0) {
+      req->insecure = true;
+    } else if (strcmp(arg, "-s") == 0 || strcmp(arg, "--silent") == 0) {
+      req->silent = true;
+    } else if (strcmp(arg, "-#") != 0 && strcmp(arg, "--progress-bar") != 0) {
+      return false;
+    }
+  }
+
+  return (req->url != NULL);
+}
+
+/* Write a progress meter result from last values seen by callback */
+static void progress_write (inproc_t *t, uint64_t now, uint64_t speed)
+{
+  uint64_t elapsed = now - t->start_ms, bytes = (uint64_t)(t->dlnow + t->ulnow);
+  cw_progress_t r;
+
+  memset(&r, 0, sizeof(r));
+  r.fields = CW_FIELD_PERCENT | CW_FIELD_METER;
+  r.total = (uint64_t)(t->dltotal + t->ultotal);
+  r.received = (uint64_t)t->dlnow;
+  r.uploaded = (uint64_t)t->ulnow;
+  r.percent = (r.total) ? (int)(bytes * 100 / r.total) : 0;
+  r.received_percent = (t->dltotal) ? (int)(t->dlnow * 100 / t->dltotal) : 0;
+  r.uploaded_percent = (t->ultotal) ? (int)(t->ulnow * 100 / t->ultotal) : 0;
+  r.dl_speed = (elapsed) ? r.received * 1000 / elapsed : 0;
+  r.ul_speed = (elapsed) ? r.uploaded * 1000 / elapsed : 0;
+  r.time_spent = (int64_t)(elapsed / 1000);
+  r.time_total = r.time_left = -1;
+  if (r.total && bytes && elapsed) {
+    r.time_total = (int64_t)(r.total * elapsed / bytes / 1000);
+    r.time_left = r.time_total - r.time_spent;
+  }
+  r.speed = speed;
+
+  cw_writer_progress(t->writer, &r);
+}
+
+/*
+ * libcurl progress callback (called many times per second): like curl's
+ * meter, a result is written every second, with that second's speed.
+ */
+static int xferinfo (void *clientp, curl_off_t dltotal, curl_off_t dlnow,
+    curl_off_t ultotal, curl_off_t ulnow)
+{
+  inproc_t *t = clientp;
+  uint64_t now = now_ms(), bytes = (uint64_t)(dlnow + ulnow);
+
+  t->dltotal = dltotal;
+  t->dlnow = dlnow;
+  t->ultotal = ultotal;
+  t->ulnow = ulnow;
+
+  if (now - t->sample_ms < 1000)
+    return 0;
+
+  t->speed = (bytes - t->sample_bytes) * 1000 / (now - t->sample_ms);
+  t->sample_ms = now;
+  t->sample_bytes = bytes;
+  progress_write(t, now, t->speed);
+  return 0;
+}
+
+/**
+ * Transfer is over: write final progress (as curl's last meter line) and
+ * latency breakdown, same record as curl's write-out (CW_TIMING_WRITE_OUT).
+ *
+ * \param[in] curl easy handle
+ * \param[in] t progress state
+ */
+void inproc_done (CURL *curl, inproc_t *t)
+{
+  curl_off_t dns = 0, connect = 0, app = 0, start = 0, total = 0, speed = 0, size = 0;
+  uint64_t now = now_ms(), elapsed = now - t->start_ms;
+  cw_timing_t timing;
+
+  /* Shorter than a second: no sample, average speed */
+  if (t->progress)
+    progress_write(t, now, (t->sample_ms != t->start_ms) ? t->speed :
+        (elapsed) ? (uint64_t)(t->dlnow + t->ulnow) * 1000 / elapsed : 0);
+
+  curl_easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(curl, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(curl, CURLINFO_APPCONNECT_TIME_T, &app);
+  curl_easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME_T, &start);
+  curl_easy_getinfo(curl, CURLINFO_TOTAL_TIME_T, &total);
+  curl_easy_getinfo(curl, CURLINFO_SPEED_DOWNLOAD_T, &speed);
+  curl_easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &size);
+
+  timing.namelookup_us = (int64_t)dns;
+  timing.connect_us = (int64_t)connect;
+  timing.appconnect_us = (int64_t)app;
+  timing.starttransfer_us = (int64_t)start;
+  timing.total_us = (int64_t)total;
+  timing.speed = (uint64_t)speed;
+  timing.size = (uint64_t)size;
+
+  cw_writer_timing(t->writer, &timing);
+}
+
+/**
+ * Get output file name of a request.
+ *
+ * \param[in] req transfer description
+ * \param[out] output file name (-o or -O), NULL for stdout
+ * \return 0 on success, -1 if remote name can't be used
+ */
+int inproc_output (const inproc_request_t *req, const char **output)
+{
+  *output = req->output;
+
+  /* -O: last path segment of URL */
+  if (!*output && req->remote_name) {
+    *output = strrchr(req->url, '/');
+    *output = (*output) ? *output + 1 : req->url;
+    if (**output == '\0') {
+      CW_ERROR("Remote file name has no length");
+      return -1;
+    }
+  }
+
+  return 0;
+}
+
+/**
+ * Set transfer options of an easy handle.
+ *
+ * \param[in] curl easy handle
+ * \param[in] req transfer description
+ * \param[in] t progress state (writer may be NULL: no progress)
+ * \param[in] fp payload output
+ * \param[in] errbuf error message buffer (CURL_ERROR_SIZE bytes)
+ */
+void inproc_setup (CURL *curl, const inproc_request_t *req, inproc_t *t,
+    FILE *fp, char *errbuf)
+{
+  t->start_ms = t->sample_ms = now_ms();
+  t->sample_bytes = t->speed = 0;
+  t->dltotal = t->dlnow = t->ultotal = t->ulnow = 0;
+  t->progress = !req->silent;
+
+  curl_easy_setopt(curl, CURLOPT_URL, req->url);
+  curl_easy_setopt(curl, CURLOPT_WRITEDATA, fp);
+  curl_easy_setopt(curl, CURLOPT_ERRORBUFFER, errbuf);
+  if (!req->silent) {
+    curl_easy_setopt(curl, CURLOPT_NOPROGRESS, 0L);
+    curl_easy_setopt(curl, CURLOPT_XFERINFOFUNCTION, xferinfo);
+    curl_easy_setopt(curl, CURLOPT_XFERINFODATA, t);
+  }
+  curl_easy_setopt(curl, CURLOPT_FOLLOWLOCATION, (long)req->location);
+  curl_easy_setopt(curl, CURLOPT_FAILONERROR, (long)req->fail);
+  if (req->insecure) {
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+    curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+  }
+  if (req->user_agent)
+    curl_easy_setopt(curl, CURLOPT_USERAGENT, req->user_agent);
+}
+
+/**
+ * Perform transfer with libcurl, progress is written to out_fd.
+ *
+ * \param[in] req transfer description
+ * \param[in] out_fd output fd to write progress to
+ * \param[in] opts output options
+ * \return curl exit code (0 for success)
+ */
+int inproc_transfer (const inproc_request_t *req, int out_fd,
+    const cw_options_t *opts)
+{
+  char errbuf[CURL_ERROR_SIZE] = "";
+  const char *output;
+  FILE *fp = stdout;
+  inproc_t t = {0};
+  CURLcode code;
+  CURL *curl;
+
+  if (inproc_output(req, &output) < 0)
+    return CURLE_WRITE_ERROR;
+
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK)
+    return CURLE_FAILED_INIT;
+
+  curl = curl_easy_init();
+  t.writer = cw_writer_new(out_fd, opts);
+  if (!curl || !t.writer) {
+    code = CURLE_FAILED_INIT;
+    goto out;
+  }
+
+  if (output) {
+    fp = fopen(output, "wb");
+    if (!fp) {
+      CW_ERROR_ERRNO(errno, "%s", output);
+      code = CURLE_WRITE_ERROR;
+      goto out;
+    }
+  }
+
+  inproc_setup(curl, req, &t, fp, errbuf);
+
+  code = curl_easy_perform(curl);
+  if (code != CURLE_OK)
+    CW_ERROR("curl: (%d) %s", (int)code, (errbuf[0]) ? errbuf :
+        curl_easy_strerror(code));
+  else
+    inproc_done(curl, &t);
+
+  if (fp != stdout && fclose(fp) != 0 && code == CURLE_OK) {
+    CW_ERROR_ERRNO(errno, "%s", output);
+    code = CURLE_WRITE_ERROR;
+  }
+
+out:
+  cw_writer_free(t.writer);
+  if (curl)
+    curl_easy_cleanup(curl);
+  curl_global_cleanup();
+  return (int)code;
+}
+#endif /* HAVE_LIBCURL */
+
+/* vim: set et sw=2 ts=4: */
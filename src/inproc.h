@@ -0,0 +1,61 @@
+/*
+ * Zenity cURL wrapper - in-process transfers (libcurl)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef INPROC_H
+#define INPROC_H
+
+#include <stdbool.h>
+
+#include "common.h"
+
+/* Subset of curl command-line handled in-process */
+typedef struct {
+  const char *url;
+  const char *output;       /* -o FILE, NULL for stdout */
+  const char *user_agent;   /* -A STRING */
+  bool remote_name;         /* -O */
+  bool location;            /* -L */
+  bool fail;                /* -f */
+  bool insecure;            /* -k */
+  bool silent;              /* -s: no progress, timing record only */
+} inproc_request_t;
+
+#ifdef HAVE_LIBCURL
+#include <curl/curl.h>
+
+/* Progress state of a transfer */
+typedef struct {
+  cw_writer_t *writer;      /* progress and timing results */
+  bool progress;            /* progress results are written (not -s) */
+  uint64_t start_ms;
+  uint64_t sample_ms;       /* results and current speed: every second */
+  uint64_t sample_bytes;
+  uint64_t speed;
+  curl_off_t dltotal, dlnow, ultotal, ulnow; /* last seen by callback */
+} inproc_t;
+
+bool inproc_parse (int argc, char *argv[], inproc_request_t *req);
+int inproc_output (const inproc_request_t *req, const char **output);
+void inproc_setup (CURL *curl, const inproc_request_t *req, inproc_t *t,
+    FILE *fp, char *errbuf);
+void inproc_done (CURL *curl, inproc_t *t);
+int inproc_transfer (const inproc_request_t *req, int out_fd,
+    const cw_options_t *opts);
+#endif
+
+#endif /* INPROC_H */
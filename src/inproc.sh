@@ -0,0 +1,44 @@
+#!/bin/sh
+#
+# In-process transfer check (make check): c2z fetches a file:// URL with
+# libcurl, a fake zenity records its progress. Payload must be intact,
+# progress must end with 100 and have no more updates than seconds.
+
+set -e
+
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+mkdir "$dir/bin"
+cat > "$dir/bin/zenity" <<EOT
+#!/bin/sh
+cat > "$dir/progress"
+EOT
+chmod +x "$dir/bin/zenity"
+
+head -c 8388608 /dev/urandom > "$dir/in"
+
+PATH="$dir/bin:$PATH" ./c2z -o "$dir/out" "file://$dir/in"
+
+if ! cmp -s "$dir/in" "$dir/out"; then
+  echo "output file differs from input" >&2
+  exit 1
+fi
+
+if [ "$(tail -n 1 "$dir/progress")" != "100" ]; then
+  echo "progress doesn't end with 100:" >&2
+  cat "$dir/progress" >&2
+  exit 1
+fi
+
+# Local file is fast: final result only (and no bogus speed sample)
+updates=$(grep -c '^#' "$dir/progress" || true)
+if [ "$updates" -gt 2 ]; then
+  echo "$updates progress updates for a sub-second transfer:" >&2
+  cat "$dir/progress" >&2
+  exit 1
+fi
+
+cat "$dir/progress"
+
+# vim: set et sw=2 ts=4:
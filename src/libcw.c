@@ -0,0 +1,635 @@
+/*
+ * cURL wrapper - progress parsing library
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <inttypes.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "libcw.h"
+#include "scan.h"
+
+#define RESULTS_QUEUE_SIZE 16
+#define TOKEN_SHAPE_SIZE 12  /* longest field: "cw-timing:" or "--:--:--" */
+#define TOKEN_VALUES 3       /* "H:MM:SS" */
+#define BAR_TAIL_SIZE 6      /* "23,3%" preceded by a space */
+#define METER_FIELDS 12
+#define PARALLEL_FIELDS 10
+#define TIMING_FIELDS 8      /* prefix included */
+
+/*
+ * Field being parsed. It is not copied: digit runs are accumulated as
+ * numbers and the token is reduced to its shape (each digit run is
+ * replaced by a single '9'): "20.0M" has shape "9.9M" and values 20, 0.
+ */
+typedef struct {
+  char shape[TOKEN_SHAPE_SIZE];
+  unsigned int len;
+  unsigned int count;                  /* number of digit runs */
+  uint64_t values[TOKEN_VALUES];
+  int digits[TOKEN_VALUES];
+} cw_token_t;
+
+struct cw_parser {
+  cw_format_t format;
+  cw_format_t layout;                  /* meter layout (from header line) */
+  bool sync;                           /* synchronised on an end of line */
+
+  /* Current line state, carried from one push to the next one */
+  size_t line_len;
+  bool reject;                         /* can't be a progress line anymore */
+  bool overflow;                       /* field too long */
+  bool timing_line;                    /* line starts with CW_TIMING_PREFIX */
+  bool days;                           /* last field is "DDDd", "HHh" may follow */
+  unsigned int field;                  /* number of complete fields */
+  cw_token_t token;
+  cw_progress_t line;                  /* progress meter fields */
+  cw_timing_t line_timing;             /* timing record fields */
+  char tail[BAR_TAIL_SIZE];            /* progress bar: last bytes of line */
+
+  /* Results ring buffer */
+  cw_progress_t results[RESULTS_QUEUE_SIZE];
+  unsigned int head, count;
+
+  cw_timing_t timing;                  /* last timing record */
+  bool has_timing;
+
+  cw_counters_t counters;
+};
+
+/* Add a byte to current token, false if it is too long */
+static inline bool token_add (cw_token_t *t, char c)
+{
+  if (c >= '0' && c <= '9') {
+    /* Digit run continues */
+    if (t->len > 0 && t->shape[t->len - 1] == '9') {
+      if (++t->digits[t->count - 1] > 19)
+        return false;
+      t->values[t->count - 1] = t->values[t->count - 1] * 10 + (uint64_t)(c - '0');
+      return true;
+    }
+    if (t->count == TOKEN_VALUES)
+      return false;
+    t->values[t->count] = (uint64_t)(c - '0');
+    t->digits[t->count++] = 1;
+    c = '9';
+  }
+
+  if (t->len == TOKEN_SHAPE_SIZE)
+    return false;
+  t->shape[t->len++] = c;
+  return true;
+}
+
+static inline bool token_is (const cw_token_t *t, const char *shape)
+{
+  return (t->len == strlen(shape) && memcmp(t->shape, shape, t->len) == 0);
+}
+
+/* Percent column: integer from 0 to 100 */
+static bool token_percent (const cw_token_t *t, int *percent)
+{
+  if (!token_is(t, "9") || t->values[0] > 100)
+    return false;
+
+  *percent = (int)t->values[0];
+  return true;
+}
+
+/*
+ * Size or speed column (see cw_format_size): "12345", "2969k", "20.0M".
+ * Value is rounded down to a byte.
+ */
+static bool token_size (const cw_token_t *t, uint64_t *bytes)
+{
+  static const char suffixes[] = "kMGTP";
+  uint64_t frac = 0, unit = 1, scale = 1;
+  const char *q;
+  char suffix;
+
+  if (token_is(t, "9")) {
+    *bytes = t->values[0];
+    return true;
+  }
+
+  if (t->len == 2 && t->shape[0] == '9') {
+    suffix = t->shape[1];
+  } else if (t->len == 4 && memcmp(t->shape, "9.9", 3) == 0) {
+    suffix = t->shape[3];
+    frac = t->values[1];
+    for (int i = 0; i < t->digits[1]; i++)
+      scale *= 10;
+  } else {
+    return false; /* decimal number without unit too */
+  }
+
+  if (suffix == '\0' || (q = strchr(suffixes, suffix)) == NULL)
+    return false;
+  for (int i = 0; i <= q - suffixes; i++)
+    unit <<= 10;
+
+  *bytes = t->values[0] * unit + frac * unit / scale;
+  return true;
+}
+
+/*
+ * Time column: "--:--:--" (unknown), "H:MM:SS", "DDDd HHh" or "DDDDDDDd".
+ * "DDDd" sets days flag, "HHh" is the next token.
+ */
+static bool token_time (const cw_token_t *t, int64_t *seconds, bool *days)
+{
+  *days = false;
+
+  if (token_is(t, "--:--:--")) {
+    *seconds = -1;
+  } else if (token_is(t, "9:9:9")) {
+    *seconds = (int64_t)(t->values[0] * 3600 + t->values[1] * 60 + t->values[2]);
+  } else if (token_is(t, "9d")) {
+    *seconds = (int64_t)(t->values[0] * 86400);
+    *days = true;
+  } else {
+    return false;
+  }
+
+  return true;
+}
+
+/* Parallel meter percent column: "--" (-1) if sizes are unknown */
+static bool token_percent_opt (const cw_token_t *t, int *percent)
+{
+  if (token_is(t, "--")) {
+    *percent = -1;
+    return true;
+  }
+
+  return token_percent(t, percent);
+}
+
+/* Counter column: plain integer */
+static bool token_count (const cw_token_t *t, unsigned int *count)
+{
+  if (!token_is(t, "9") || t->values[0] > UINT32_MAX)
+    return false;
+
+  *count = (unsigned int)t->values[0];
+  return true;
+}
+
+/* Write-out duration: seconds with up to 6 decimals, "0.012345" */
+static bool token_seconds_us (const cw_token_t *t, int64_t *us)
+{
+  uint64_t frac = 0;
+
+  if (token_is(t, "9.9") && t->digits[1] <= 6) {
+    frac = t->values[1];
+    for (int i = t->digits[1]; i < 6; i++)
+      frac *= 10;
+  } else if (!token_is(t, "9")) {
+    return false;
+  }
+
+  *us = (int64_t)(t->values[0] * 1000000 + frac);
+  return true;
+}
+
+/**
+ * Decode a complete field of a timing record (see CW_TIMING_WRITE_OUT).
+ *
+ * It looks like this:
+ * cw-timing: 0.001021 0.001185 0.000000 0.002310 5.003213 4194304 20971520
+ *
+ * \param[in] t field, prefix is field 0
+ * \param[in] field field index
+ * \param[out] timing decoded values
+ * \return false if field is invalid
+ */
+static bool timing_field (const cw_token_t *t, unsigned int field,
+    cw_timing_t *timing)
+{
+  switch (field) {
+    case 1: return token_seconds_us(t, &timing->namelookup_us);
+    case 2: return token_seconds_us(t, &timing->connect_us);
+    case 3: return token_seconds_us(t, &timing->appconnect_us);
+    case 4: return token_seconds_us(t, &timing->starttransfer_us);
+    case 5: return token_seconds_us(t, &timing->total_us);
+    case 6: timing->speed = t->values[0]; return token_is(t, "9");
+    case 7: timing->size = t->values[0]; return token_is(t, "9");
+    default: return false;
+  }
+}
+
+/**
+ * Decode a complete field of cURL progress meter.
+ *
+ * It looks like this:
+ *   % Total    % Received % Xferd  Average Speed   Time    Time     Time  Current
+ *                                  Dload  Upload   Total   Spent    Left  Speed
+ *  28 20.0M   28 5936k    0     0  2970k      0  0:00:06  0:00:01  0:00:05 2969k
+ *
+ * All twelve columns are decoded, any other line (headers, verbose output)
+ * is rejected.
+ *
+ * \param[in] t field
+ * \param[in] field field index
+ * \param[out] r decoded values
+ * \param[out] days time field is "DDDd", "HHh" may follow
+ * \return false if field is invalid
+ */
+static bool meter_field (const cw_token_t *t, unsigned int field,
+    cw_progress_t *r, bool *days)
+{
+  switch (field) {
+    case 0: return token_percent(t, &r->percent);
+    case 1: return token_size(t, &r->total);
+    case 2: return token_percent(t, &r->received_percent);
+    case 3: return token_size(t, &r->received);
+    case 4: return token_percent(t, &r->uploaded_percent);
+    case 5: return token_size(t, &r->uploaded);
+    case 6: return token_size(t, &r->dl_speed);
+    case 7: return token_size(t, &r->ul_speed);
+    case 8: return token_time(t, &r->time_total, days);
+    case 9: return token_time(t, &r->time_spent, days);
+    case 10: return token_time(t, &r->time_left, days);
+    case 11: return token_size(t, &r->speed);
+    default: return false;
+  }
+}
+
+/**
+ * Decode a complete field of cURL parallel progress meter (-Z).
+ *
+ * It looks like this:
+ * DL% UL%  Dled  Uled  Xfers  Live Total     Current  Left    Speed
+ *  39 --  3121k     0     2     1   0:00:03  0:00:01  0:00:02 1990k
+ *
+ * Percent columns are "--" until all sizes are known.
+ *
+ * \param[in] t field
+ * \param[in] field field index
+ * \param[out] r decoded values
+ * \param[out] days time field is "DDDd", "HHh" may follow
+ * \return false if field is invalid
+ */
+static bool parallel_field (const cw_token_t *t, unsigned int field,
+    cw_progress_t *r, bool *days)
+{
+  switch (field) {
+    case 0: return token_percent_opt(t, &r->received_percent);
+    case 1: return token_percent_opt(t, &r->uploaded_percent);
+    case 2: return token_size(t, &r->received);
+    case 3: return token_size(t, &r->uploaded);
+    case 4: return token_count(t, &r->transfers);
+    case 5: return token_count(t, &r->live);
+    case 6: return token_time(t, &r->time_total, days);
+    case 7: return token_time(t, &r->time_spent, days);
+    case 8: return token_time(t, &r->time_left, days);
+    case 9: return token_size(t, &r->speed);
+    default: return false;
+  }
+}
+
+/* Current token is complete (a space or an end of line follows) */
+static void end_token (cw_parser_t *p)
+{
+  cw_token_t *t = &p->token;
+  unsigned int first;
+  int64_t *time;
+
+  if (p->days) {
+    p->days = false;
+    /* "DDDd HHh": previous field is completed */
+    if (token_is(t, "9h")) {
+      first = (p->layout == CW_FORMAT_PARALLEL) ? 7 : 9;
+      time = (p->field == first) ? &p->line.time_total :
+          (p->field == first + 1) ? &p->line.time_spent : &p->line.time_left;
+      *time += (int64_t)(t->values[0] * 3600);
+      t->len = t->count = 0;
+      return;
+    }
+  }
+
+  if (p->field == 0 && token_is(t, CW_TIMING_PREFIX))
+    p->timing_line = true;
+  else if (p->timing_line)
+    p->reject = !timing_field(t, p->field, &p->line_timing);
+  else if (p->format == CW_FORMAT_BAR)
+    p->reject = true; /* only looking for timing record */
+  else if (p->field == 0 && p->format == CW_FORMAT_METER &&
+      (token_is(t, "%") || token_is(t, "DL%"))) {
+    /* Header line: which meter follows */
+    p->layout = (t->shape[0] == 'D') ? CW_FORMAT_PARALLEL : CW_FORMAT_METER;
+    p->reject = true;
+  } else if (p->layout == CW_FORMAT_PARALLEL)
+    p->reject = !parallel_field(t, p->field, &p->line, &p->days);
+  else
+    p->reject = !meter_field(t, p->field, &p->line, &p->days);
+
+  p->field++;
+  t->len = t->count = 0;
+}
+
+/* Progress meter or timing record bytes (no end of line) */
+static void feed_fields (cw_parser_t *p, const char *buf, size_t len)
+{
+  for (size_t i = 0; i < len && !p->reject; i++) {
+    if (buf[i] == ' ') {
+      if (p->token.len > 0)
+        end_token(p);
+    } else if (!token_add(&p->token, buf[i])) {
+      p->overflow = true;
+      p->reject = true;
+    }
+  }
+}
+
+/* Progress bar bytes (no end of line): only the end of line matters */
+static void feed_bar (cw_parser_t *p, const char *buf, size_t len)
+{
+  if (len >= BAR_TAIL_SIZE) {
+    memcpy(p->tail, buf + len - BAR_TAIL_SIZE, BAR_TAIL_SIZE);
+  } else {
+    memmove(p->tail, p->tail + len, BAR_TAIL_SIZE - len);
+    memcpy(p->tail + BAR_TAIL_SIZE - len, buf, len);
+  }
+}
+
+/**
+ * Parse cURL progress bar line end.
+ *
+ * It looks like this:
+ * ################                                                          23,3%
+ * ############################################                              61,1%
+ * #############################################################             85,9%
+ *
+ * \param[in] p parser instance, line is complete
+ * \param[out] result parsed values (percent is rounded)
+ * \return 1 if result has been filled, 0 otherwise
+ */
+static int end_bar (const cw_parser_t *p, cw_progress_t *result)
+{
+  char tmp[8] = {61};
+
+  if (p->line_len < BAR_TAIL_SIZE)
+    return 0;
+
+  memcpy(&tmp[0], p->tail, BAR_TAIL_SIZE);
+  /* Decimal separator is ',' with older curl (locale), '.' otherwise */
+  if ((tmp[3] == ',' || tmp[3] == '.') && tmp[5] == '%') {
+    tmp[3] = '\0';
+    memset(result, 0, sizeof(*result));
+    result->fields = CW_FIELD_PERCENT;
+    result->percent = atoi(tmp);
+    result->time_total = result->time_spent = result->time_left = -1;
+    return 1;
+  }
+
+  return 0;
+}
+
+/* Progress meter line end */
+static int end_meter (cw_parser_t *p, cw_progress_t *result)
+{
+  if (p->reject || p->days || p->field != METER_FIELDS)
+    return 0;
+
+  *result = p->line;
+  result->fields = CW_FIELD_PERCENT | CW_FIELD_METER;
+  result->transfers = result->live = 0;
+  return 1;
+}
+
+/* Parallel progress meter line end: no total size, percent may be unknown */
+static int end_parallel (cw_parser_t *p, cw_progress_t *result)
+{
+  if (p->reject || p->days || p->field != PARALLEL_FIELDS)
+    return 0;
+
+  *result = p->line;
+  result->fields = CW_FIELD_METER | CW_FIELD_PARALLEL;
+  result->total = result->dl_speed = result->ul_speed = 0;
+  result->percent = 0;
+  if (result->received_percent >= 0 || result->uploaded_percent >= 0) {
+    result->fields |= CW_FIELD_PERCENT;
+    result->percent = (result->received_percent >= 0) ?
+        result->received_percent : result->uploaded_percent;
+  }
+  if (result->received_percent < 0)
+    result->received_percent = 0;
+  if (result->uploaded_percent < 0)
+    result->uploaded_percent = 0;
+  return 1;
+}
+
+static void line_reset (cw_parser_t *p)
+{
+  p->line_len = 0;
+  p->reject = false;
+  p->overflow = false;
+  p->timing_line = false;
+  p->days = false;
+  p->field = 0;
+  p->token.len = p->token.count = 0;
+}
+
+/* End of line: decode it */
+static void end_line (cw_parser_t *p)
+{
+  cw_progress_t *result;
+
+  if (!p->reject && p->token.len > 0)
+    end_token(p);
+
+  if (p->overflow && (p->timing_line || p->format != CW_FORMAT_BAR))
+    p->counters.overflows++;
+
+  /* Timing record is not a progress line */
+  if (p->timing_line) {
+    if (!p->reject && !p->days && p->field == TIMING_FIELDS) {
+      p->timing = p->line_timing;
+      p->has_timing = true;
+    }
+  } else {
+    p->counters.lines++;
+
+    result = &p->results[(p->head + p->count) % RESULTS_QUEUE_SIZE];
+    if ((p->format == CW_FORMAT_BAR) ? end_bar(p, result) :
+        (p->layout == CW_FORMAT_PARALLEL) ? end_parallel(p, result) :
+        end_meter(p, result)) {
+      p->counters.results++;
+      p->count++;
+    }
+  }
+}
+
+cw_parser_t *cw_parser_new (cw_format_t format)
+{
+  cw_parser_t *p = calloc(1, sizeof(cw_parser_t));
+
+  if (p)
+    p->format = p->layout = format;
+
+  return p;
+}
+
+void cw_parser_free (cw_parser_t *p)
+{
+  free(p);
+}
+
+void cw_parser_reset (cw_parser_t *p)
+{
+  p->sync = false;
+  p->layout = p->format;
+  line_reset(p);
+  p->head = 0;
+  p->count = 0;
+  p->has_timing = false;
+}
+
+/*
+ * A progress line is everything between two consecutive end of line
+ * characters: cURL starts each update with \r, verbose output (-v) and
+ * final update end with \n.
+ *
+ * Lines are decoded as bytes arrive, nothing is copied: fields are parsed
+ * straight from caller's buffer and only the state of the current line
+ * (decoded fields, partial field) is kept between two pushes. Lines can be
+ * split anywhere and have any length.
+ */
+size_t cw_parser_push (cw_parser_t *p, const char *buf, size_t len)
+{
+  size_t sz = len, n;
+  const char *eol;
+
+  while (sz > 0 && p->count < RESULTS_QUEUE_SIZE) {
+    eol = cw_scan_eol(buf, sz);
+    n = (eol) ? (size_t)(eol - buf) : sz; /* delimiter excluded */
+
+    /* Unsynchronised line is not decoded, but it can be meter header */
+    if (n > 0)
+      feed_fields(p, buf, n);
+    if (p->sync && n > 0) {
+      if (p->format == CW_FORMAT_BAR)
+        feed_bar(p, buf, n);
+      p->line_len += n;
+    }
+
+    if (eol) {
+      if (p->sync && p->line_len > 0)
+        end_line(p);
+      line_reset(p);
+      p->sync = true;
+      n++;
+    }
+
+    buf += n;
+    sz -= n;
+  }
+
+  p->counters.bytes += len - sz;
+  return len - sz;
+}
+
+int cw_parser_pull (cw_parser_t *p, cw_progress_t *result)
+{
+  if (p->count == 0)
+    return 0;
+
+  *result = p->results[p->head];
+  p->head = (p->head + 1) % RESULTS_QUEUE_SIZE;
+  p->count--;
+  return 1;
+}
+
+int cw_parser_timing (cw_parser_t *p, cw_timing_t *timing)
+{
+  if (!p->has_timing)
+    return 0;
+
+  *timing = p->timing;
+  p->has_timing = false;
+  return 1;
+}
+
+char *cw_format_size (char *buf, size_t len, uint64_t bytes)
+{
+  static const char suffixes[] = "kMGTP";
+  const uint64_t k = 1024;
+  uint64_t unit = k;
+  int i;
+
+  if (bytes < 100000) {
+    snprintf(buf, len, "%" PRIu64, bytes);
+    return buf;
+  }
+
+  if (bytes < 10000 * k) {
+    snprintf(buf, len, "%" PRIu64 "k", bytes / k);
+    return buf;
+  }
+
+  /* "12.3M" then "1234M" for each unit */
+  for (i = 1; i < (int)sizeof(suffixes) - 2; i++, unit *= k) {
+    if (bytes < 100 * unit * k) {
+      snprintf(buf, len, "%" PRIu64 ".%" PRIu64 "%c", bytes / (unit * k),
+          (bytes % (unit * k)) * 10 / (unit * k), suffixes[i]);
+      return buf;
+    }
+    if (bytes < 10000 * unit * k) {
+      snprintf(buf, len, "%" PRIu64 "%c", bytes / (unit * k), suffixes[i]);
+      return buf;
+    }
+  }
+
+  snprintf(buf, len, "%" PRIu64 "%c", bytes / (unit * k), suffixes[i]);
+  return buf;
+}
+
+char *cw_format_time (char *buf, size_t len, int64_t seconds)
+{
+  int64_t h;
+
+  if (seconds < 0) {
+    snprintf(buf, len, "--:--:--");
+    return buf;
+  }
+
+  h = seconds / 3600;
+  if (h <= 99)
+    snprintf(buf, len, "%" PRId64 ":%02d:%02d", h, (int)(seconds / 60 % 60),
+        (int)(seconds % 60));
+  else if (seconds / 86400 <= 999)
+    snprintf(buf, len, "%" PRId64 "d %02dh", seconds / 86400,
+        (int)(seconds / 3600 % 24));
+  else
+    snprintf(buf, len, "%" PRId64 "d", seconds / 86400);
+
+  return buf;
+}
+
+void cw_parser_counters (const cw_parser_t *p, cw_counters_t *counters)
+{
+  *counters = p->counters;
+}
+
+/* vim: set et sw=2 ts=4: */
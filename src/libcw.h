@@ -0,0 +1,260 @@
+/*
+ * cURL wrapper - progress parsing library
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef LIBCW_H
+#define LIBCW_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*
+ * Usage:
+ *
+ *   cw_parser_t *p = cw_parser_new(CW_FORMAT_METER);
+ *
+ *   while ((len = read(fd, buf, sizeof(buf))) > 0) {
+ *     const char *q = buf;
+ *     while (len > 0) {
+ *       size_t n = cw_parser_push(p, q, len);
+ *       while (cw_parser_pull(p, &progress))
+ *         ...;
+ *       q += n, len -= n;
+ *     }
+ *   }
+ *
+ *   cw_parser_free(p);
+ *
+ * A parser instance holds all parsing state, there is no global state:
+ * any number of parsers can be used at the same time (one per thread or
+ * with external locking).
+ */
+
+/* Input data format (curl command-line switches) */
+typedef enum {
+  CW_FORMAT_METER    = 0,  /* default progress meter, parallel meter layout
+                              is detected from its header line */
+  CW_FORMAT_BAR      = 1,  /* progress bar (-#) */
+  CW_FORMAT_PARALLEL = 2,  /* parallel transfers progress meter (-Z) */
+} cw_format_t;
+
+/* cw_progress_t fields validity */
+#define CW_FIELD_PERCENT   0x01  /* percent */
+#define CW_FIELD_METER     0x02  /* all other fields (progress meter only) */
+#define CW_FIELD_PARALLEL  0x04  /* parallel meter: transfers and live are set,
+                                    total and average speeds are not, percent
+                                    only with CW_FIELD_PERCENT (sizes known) */
+
+/*
+ * Parsed progress line. Sizes are in bytes, speeds in bytes per second,
+ * times in seconds.
+ *
+ *   % Total    % Received % Xferd  Average Speed   Time    Time     Time  Current
+ *                                  Dload  Upload   Total   Spent    Left  Speed
+ *  28 20.0M   28 5936k    0     0  2970k      0  0:00:06  0:00:01  0:00:05 2969k
+ */
+typedef struct {
+  unsigned int fields;  /* CW_FIELD_* mask */
+  int percent;          /* 0 to 100 */
+  uint64_t total;       /* 0 if unknown */
+  int received_percent;
+  uint64_t received;
+  int uploaded_percent;
+  uint64_t uploaded;
+  uint64_t dl_speed;    /* average download speed */
+  uint64_t ul_speed;    /* average upload speed */
+  int64_t time_total;   /* -1 if unknown */
+  int64_t time_spent;   /* -1 if unknown */
+  int64_t time_left;    /* -1 if unknown */
+  uint64_t speed;       /* current speed */
+  unsigned int transfers; /* parallel meter: transfers started */
+  unsigned int live;    /* parallel meter: transfers running */
+} cw_progress_t;
+
+/*
+ * Per transfer timing record. curl prints it at the end of the transfer
+ * when given CW_TIMING_WRITE_OUT (-w, curl 7.63.0 or later). Durations are
+ * cumulative since transfer start (curl's time_* variables). Record is
+ * preceded by an end of line: it is found even if nothing else has been
+ * written (-s).
+ */
+#define CW_TIMING_PREFIX "cw-timing:"
+#define CW_TIMING_WRITE_OUT "%{stderr}\n" CW_TIMING_PREFIX " %{time_namelookup} " \
+    "%{time_connect} %{time_appconnect} %{time_starttransfer} %{time_total} " \
+    "%{speed_download} %{size_download}\n"
+
+typedef struct {
+  int64_t namelookup_us;    /* DNS resolution done */
+  int64_t connect_us;       /* TCP connection established */
+  int64_t appconnect_us;    /* TLS handshake done, 0 without TLS */
+  int64_t starttransfer_us; /* first byte received */
+  int64_t total_us;         /* transfer done */
+  uint64_t speed;           /* average download speed (bytes/s) */
+  uint64_t size;            /* downloaded bytes */
+} cw_timing_t;
+
+/* Parser counters */
+typedef struct {
+  unsigned long bytes;      /* number of bytes pushed */
+  unsigned long lines;      /* number of complete lines seen (timing
+                               records excluded) */
+  unsigned long results;    /* number of progress results produced */
+  unsigned long overflows;  /* number of lines rejected because of a field
+                               too long to be progress data */
+} cw_counters_t;
+
+typedef struct cw_parser cw_parser_t;
+
+/**
+ * Create a parser.
+ *
+ * \param[in] format input data format
+ * \return parser instance or NULL (out of memory)
+ */
+cw_parser_t *cw_parser_new (cw_format_t format);
+
+/**
+ * Release a parser and all its resources.
+ */
+void cw_parser_free (cw_parser_t *p);
+
+/**
+ * Forget partial line and pending results (counters are kept).
+ */
+void cw_parser_reset (cw_parser_t *p);
+
+/**
+ * Push raw bytes (curl's stderr) to parser.
+ *
+ * Parsing stops when internal results queue is full, caller must then
+ * pull results and push remaining bytes.
+ *
+ * \param[in] p parser instance
+ * \param[in] buf input data
+ * \param[in] len number of bytes of input data
+ * \return number of bytes consumed (from 0 to len)
+ */
+size_t cw_parser_push (cw_parser_t *p, const char *buf, size_t len);
+
+/**
+ * Pull next parsed result (oldest first).
+ *
+ * \param[in] p parser instance
+ * \param[out] result progress data
+ * \return 1 if result has been written, 0 if there's nothing left
+ */
+int cw_parser_pull (cw_parser_t *p, cw_progress_t *result);
+
+/**
+ * Get last timing record (see CW_TIMING_WRITE_OUT).
+ *
+ * \param[in] p parser instance
+ * \param[out] timing timing record
+ * \return 1 if a record has been parsed since previous call, 0 otherwise
+ */
+int cw_parser_timing (cw_parser_t *p, cw_timing_t *timing);
+
+/**
+ * Format a size or a speed like cURL does (5 characters at most, using
+ * k, M, G, T or P suffix, 1024 based).
+ *
+ * \param[out] buf output string (at least 8 bytes)
+ * \param[in] len size of buf
+ * \param[in] bytes value to format
+ * \return buf
+ */
+char *cw_format_size (char *buf, size_t len, uint64_t bytes);
+
+/**
+ * Format a duration like cURL does: "H:MM:SS", "DDDd HHh" or "--:--:--"
+ * when unknown.
+ *
+ * \param[out] buf output string (at least 10 bytes)
+ * \param[in] len size of buf
+ * \param[in] seconds value to format, negative if unknown
+ * \return buf
+ */
+char *cw_format_time (char *buf, size_t len, int64_t seconds);
+
+/**
+ * Get parser counters.
+ *
+ * \param[in] p parser instance
+ * \param[out] counters parser counters
+ */
+void cw_parser_counters (const cw_parser_t *p, cw_counters_t *counters);
+
+/*
+ * Statistics engine: smoothed speed, ETA, speed distribution and stall
+ * detection computed from successive progress meter results of a transfer.
+ * Times are milliseconds of a caller chosen monotonic clock.
+ */
+typedef struct {
+  uint64_t transferred;     /* bytes received + uploaded */
+  double ewma;              /* exponentially weighted moving average speed */
+  double window;            /* average speed over sliding window */
+  uint64_t min, max;        /* extreme speeds since first sample */
+  uint64_t p50, p95;        /* median and 95th percentile speed over window */
+  int64_t eta;              /* seconds (from smoothed speed), -1 if unknown */
+  int64_t idle;             /* seconds without byte progress */
+  int stalled;              /* idle for at least stall timeout */
+  unsigned long samples;    /* number of results taken into account */
+} cw_summary_t;
+
+typedef struct cw_stats cw_stats_t;
+
+/**
+ * Create a statistics engine (one per transfer).
+ *
+ * \param[in] window_ms sliding window duration, 0 for default (10s)
+ * \param[in] stall_secs stall timeout, 0 for default (10s)
+ * \return instance or NULL (out of memory)
+ */
+cw_stats_t *cw_stats_new (unsigned int window_ms, unsigned int stall_secs);
+
+/**
+ * Release a statistics engine.
+ */
+void cw_stats_free (cw_stats_t *st);
+
+/**
+ * Take a parsed result into account (progress bar results are ignored).
+ *
+ * \param[in] st statistics engine
+ * \param[in] result parsed progress meter line
+ * \param[in] now_ms result timestamp
+ */
+void cw_stats_update (cw_stats_t *st, const cw_progress_t *result, uint64_t now_ms);
+
+/**
+ * Compute current statistics.
+ *
+ * \param[in] st statistics engine
+ * \param[in] now_ms current time (idle time and stall detection)
+ * \param[out] summary statistics
+ */
+void cw_stats_get (const cw_stats_t *st, uint64_t now_ms, cw_summary_t *summary);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBCW_H */
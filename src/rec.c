@@ -0,0 +1,682 @@
+/*
+ * cURL wrapper - progress recorder (compact binary time series)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "rec.h"
+
+#define CW_REC_VERSION 1
+
+#define REC_SAMPLE        0x01
+#define REC_SAMPLE_TOTAL  0x02 /* total has changed */
+#define REC_INDEX         0x03
+#define REC_TRAILER_MAGIC 0x58495743U /* "CWIX" */
+#define REC_TRAILER_SIZE  8
+#define REC_HEADER_SIZE   32
+#define REC_SAMPLE_MAX    (1 + 5 * 10)
+#define REC_BUFFER_SIZE   4096
+#define REC_FLUSH_MS      1000 /* samples are written at least every second */
+
+_Static_assert(sizeof(cw_rec_header_t) == REC_HEADER_SIZE, "cw_rec_header_t layout");
+
+typedef struct {
+  uint64_t bytes, speed, total;
+} rec_state_t;
+
+struct cw_rec {
+  int fd;                   /* -1 after a write error */
+  unsigned int streams;
+  rec_state_t *state;       /* last sample of each stream */
+  uint64_t start_ms;        /* monotonic clock */
+  uint64_t last_time;       /* previous sample (ms since start) */
+  uint64_t first_time;      /* first sample of chunk */
+  unsigned int samples;     /* samples in current chunk */
+  uint64_t chunk_offset;    /* file offset of current chunk */
+  uint64_t offset;          /* file offset of buffer start */
+  uint64_t flush_ms;
+  size_t len;
+  uint8_t buf[REC_BUFFER_SIZE];
+};
+
+typedef struct {
+  uint64_t offset, end;     /* samples: [offset, end) */
+  uint64_t last;            /* time of last sample, UINT64_MAX if unknown */
+} rec_chunk_t;
+
+struct cw_rec_reader {
+  const uint8_t *data;
+  size_t size;
+  unsigned int streams;
+  uint64_t start;
+
+  rec_chunk_t *chunks;
+  unsigned int count;
+  rec_state_t *states;      /* state before each chunk (count * streams) */
+  uint64_t *times;          /* time of sample before each chunk */
+
+  /* Decoding position */
+  unsigned int chunk;
+  uint64_t pos;
+  uint64_t time;
+  uint64_t from;            /* samples before are skipped */
+  rec_state_t *cur;
+};
+
+static uint64_t now_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static uint64_t zigzag (uint64_t delta)
+{
+  return (delta << 1) ^ (uint64_t)((int64_t)delta >> 63);
+}
+
+static uint64_t unzigzag (uint64_t v)
+{
+  return (v >> 1) ^ -(v & 1);
+}
+
+static void put_u8 (cw_rec_t *rec, uint8_t v)
+{
+  rec->buf[rec->len++] = v;
+}
+
+static void put_varint (cw_rec_t *rec, uint64_t v)
+{
+  while (v >= 0x80) {
+    rec->buf[rec->len++] = (uint8_t)(v | 0x80);
+    v >>= 7;
+  }
+  rec->buf[rec->len++] = (uint8_t)v;
+}
+
+static void put_u32 (cw_rec_t *rec, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    rec->buf[rec->len++] = (uint8_t)(v >> (8 * i));
+}
+
+static void put_u64 (cw_rec_t *rec, uint64_t v)
+{
+  put_u32(rec, (uint32_t)v);
+  put_u32(rec, (uint32_t)(v >> 32));
+}
+
+static int rec_flush (cw_rec_t *rec)
+{
+  const uint8_t *p = rec->buf;
+  size_t len = rec->len;
+  ssize_t n;
+
+  rec->offset += rec->len;
+  rec->len = 0;
+  rec->flush_ms = now_ms();
+
+  while (rec->fd >= 0 && len > 0) {
+    n = write(rec->fd, p, len);
+    if (n == -1 && errno == EINTR)
+      continue;
+    if (n == -1) {
+      CW_ERROR_ERRNO(errno, "record write");
+      close(rec->fd);
+      rec->fd = -1;
+      return -1;
+    }
+    p += n;
+    len -= (size_t)n;
+  }
+
+  return (rec->fd >= 0) ? 0 : -1;
+}
+
+/* Make room for n bytes in buffer */
+static void rec_reserve (cw_rec_t *rec, size_t n)
+{
+  if (rec->len + n > sizeof(rec->buf))
+    rec_flush(rec);
+}
+
+/* Close current chunk: index block and trailer */
+static void rec_index (cw_rec_t *rec)
+{
+  uint64_t block = rec->offset + rec->len;
+
+  rec_reserve(rec, 1 + 5 * 10);
+  put_u8(rec, REC_INDEX);
+  put_varint(rec, rec->chunk_offset);
+  put_varint(rec, rec->first_time);
+  put_varint(rec, rec->last_time);
+  put_varint(rec, rec->samples);
+  put_varint(rec, rec->streams);
+
+  for (unsigned int i = 0; i < rec->streams; i++) {
+    rec_reserve(rec, 3 * 10);
+    put_varint(rec, rec->state[i].bytes);
+    put_varint(rec, rec->state[i].speed);
+    put_varint(rec, rec->state[i].total);
+  }
+
+  rec_reserve(rec, REC_TRAILER_SIZE);
+  put_u32(rec, (uint32_t)(rec->offset + rec->len - block));
+  put_u32(rec, REC_TRAILER_MAGIC);
+  rec_flush(rec);
+
+  rec->chunk_offset = rec->offset;
+  rec->samples = 0;
+}
+
+/**
+ * Create (or truncate) a recording.
+ *
+ * \param[in] path file path
+ * \param[in] streams number of streams
+ * \return instance or NULL
+ */
+cw_rec_t *cw_rec_create (const char *path, unsigned int streams)
+{
+  struct timespec ts;
+  cw_rec_t *rec;
+
+  rec = calloc(1, sizeof(cw_rec_t));
+  if (!rec || !(rec->state = calloc(streams, sizeof(rec_state_t)))) {
+    CW_ERROR_ERRNO(ENOMEM, "%s", path);
+    free(rec);
+    return NULL;
+  }
+
+  rec->fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (rec->fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    free(rec->state);
+    free(rec);
+    return NULL;
+  }
+
+  /* Header (cw_rec_header_t fields, little endian) */
+  clock_gettime(CLOCK_REALTIME, &ts);
+  memcpy(rec->buf, CW_REC_MAGIC, 8);
+  rec->len = 8;
+  put_u32(rec, CW_REC_VERSION);
+  put_u32(rec, streams);
+  put_u64(rec, (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000);
+  put_u32(rec, CW_REC_INDEX_SAMPLES);
+  put_u32(rec, 0);
+
+  rec->streams = streams;
+  rec->start_ms = now_ms();
+  rec->chunk_offset = REC_HEADER_SIZE;
+
+  if (rec_flush(rec) < 0) {
+    cw_rec_close(rec);
+    return NULL;
+  }
+
+  return rec;
+}
+
+/**
+ * Append a sample (progress meter results only).
+ *
+ * \param[in] rec recorder
+ * \param[in] stream stream number
+ * \param[in] result parsed result
+ * \return 0 on success, -1 on write error
+ */
+int cw_rec_append (cw_rec_t *rec, unsigned int stream, const cw_progress_t *result)
+{
+  uint64_t now = now_ms(), time = now - rec->start_ms;
+  uint64_t bytes = result->received + result->uploaded;
+  rec_state_t *s = &rec->state[stream];
+
+  if (rec->fd < 0)
+    return -1;
+  if (!(result->fields & CW_FIELD_METER) || stream >= rec->streams)
+    return 0;
+
+  if (rec->samples++ == 0)
+    rec->first_time = time;
+
+  rec_reserve(rec, REC_SAMPLE_MAX);
+  put_u8(rec, (result->total != s->total) ? REC_SAMPLE_TOTAL : REC_SAMPLE);
+  put_varint(rec, stream);
+  put_varint(rec, time - rec->last_time);
+  put_varint(rec, zigzag(bytes - s->bytes));
+  put_varint(rec, zigzag(result->speed - s->speed));
+  if (result->total != s->total)
+    put_varint(rec, result->total);
+
+  s->bytes = bytes;
+  s->speed = result->speed;
+  s->total = result->total;
+  rec->last_time = time;
+
+  if (rec->samples == CW_REC_INDEX_SAMPLES)
+    rec_index(rec);
+  else if (now - rec->flush_ms >= REC_FLUSH_MS)
+    rec_flush(rec);
+
+  return (rec->fd >= 0) ? 0 : -1;
+}
+
+/* Write pending samples and final index block */
+void cw_rec_close (cw_rec_t *rec)
+{
+  if (!rec)
+    return;
+
+  if (rec->fd >= 0 && rec->samples > 0)
+    rec_index(rec);
+  else
+    rec_flush(rec);
+
+  if (rec->fd >= 0)
+    close(rec->fd);
+  free(rec->state);
+  free(rec);
+}
+
+static bool get_varint (const cw_rec_reader_t *r, uint64_t *pos, uint64_t end,
+    uint64_t *value)
+{
+  uint64_t v = 0;
+
+  for (unsigned int shift = 0; *pos < end && shift < 64; shift += 7) {
+    uint8_t b = r->data[(*pos)++];
+    v |= (uint64_t)(b & 0x7f) << shift;
+    if (!(b & 0x80)) {
+      *value = v;
+      return true;
+    }
+  }
+
+  return false;
+}
+
+static uint32_t get_u32 (const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 |
+      (uint32_t)p[3] << 24;
+}
+
+static uint64_t get_u64 (const uint8_t *p)
+{
+  return (uint64_t)get_u32(p) | (uint64_t)get_u32(p + 4) << 32;
+}
+
+static bool chunk_add (cw_rec_reader_t *r, uint64_t offset, uint64_t end,
+    uint64_t last)
+{
+  rec_chunk_t *c;
+
+  c = realloc(r->chunks, (r->count + 1) * sizeof(rec_chunk_t));
+  if (!c)
+    return false;
+  r->chunks = c;
+
+  c = &r->chunks[r->count++];
+  c->offset = offset;
+  c->end = end;
+  c->last = last;
+  return true;
+}
+
+/**
+ * Decode index block.
+ *
+ * \param[in] r reader
+ * \param[in] pos block offset
+ * \param[in] end block end (trailer offset)
+ * \param[out] chunk chunk described by block (end is block offset)
+ * \param[out] state state of streams at end of chunk, can be NULL
+ * \return true on success
+ */
+static bool index_parse (const cw_rec_reader_t *r, uint64_t pos, uint64_t end,
+    rec_chunk_t *chunk, rec_state_t *state)
+{
+  uint64_t first, samples, streams, v[3];
+
+  chunk->end = pos;
+  if (pos >= end || r->data[pos++] != REC_INDEX ||
+      !get_varint(r, &pos, end, &chunk->offset) ||
+      !get_varint(r, &pos, end, &first) ||
+      !get_varint(r, &pos, end, &chunk->last) ||
+      !get_varint(r, &pos, end, &samples) ||
+      !get_varint(r, &pos, end, &streams) ||
+      streams != r->streams || chunk->offset < sizeof(cw_rec_header_t) ||
+      chunk->offset > chunk->end)
+    return false;
+
+  for (unsigned int i = 0; i < r->streams; i++) {
+    for (int j = 0; j < 3; j++)
+      if (!get_varint(r, &pos, end, &v[j]))
+        return false;
+    if (state)
+      state[i] = (rec_state_t){ v[0], v[1], v[2] };
+  }
+
+  return (pos == end);
+}
+
+/* Chunks from index blocks chain (end of file to start) */
+static bool index_backward (cw_rec_reader_t *r)
+{
+  uint64_t pos = r->size, block, len;
+  rec_chunk_t c;
+
+  while (pos > sizeof(cw_rec_header_t)) {
+    if (pos < sizeof(cw_rec_header_t) + REC_TRAILER_SIZE ||
+        get_u32(&r->data[pos - 4]) != REC_TRAILER_MAGIC)
+      return false;
+
+    len = get_u32(&r->data[pos - REC_TRAILER_SIZE]);
+    if (len > pos - REC_TRAILER_SIZE - sizeof(cw_rec_header_t))
+      return false;
+    block = pos - REC_TRAILER_SIZE - len;
+
+    if (!index_parse(r, block, pos - REC_TRAILER_SIZE, &c, NULL) ||
+        !chunk_add(r, c.offset, c.end, c.last))
+      return false;
+    pos = c.offset;
+  }
+
+  /* Most recent first: reverse */
+  for (unsigned int i = 0; i < r->count / 2; i++) {
+    c = r->chunks[i];
+    r->chunks[i] = r->chunks[r->count - 1 - i];
+    r->chunks[r->count - 1 - i] = c;
+  }
+
+  return true;
+}
+
+/* Skip a sample, false if truncated or not a sample */
+static bool sample_skip (const cw_rec_reader_t *r, uint64_t *pos)
+{
+  uint8_t type = r->data[(*pos)++];
+  uint64_t v;
+  int n = (type == REC_SAMPLE_TOTAL) ? 5 : 4;
+
+  if (type != REC_SAMPLE && type != REC_SAMPLE_TOTAL)
+    return false;
+
+  while (n--)
+    if (!get_varint(r, pos, r->size, &v))
+      return false;
+
+  return true;
+}
+
+/* Chunks from a forward scan (recorder has been killed: no final index) */
+static bool index_forward (cw_rec_reader_t *r)
+{
+  uint64_t pos = sizeof(cw_rec_header_t), start = pos, len, next;
+  rec_chunk_t c;
+
+  free(r->chunks);
+  r->chunks = NULL;
+  r->count = 0;
+
+  while (pos < r->size) {
+    if (r->data[pos] != REC_INDEX) {
+      next = pos;
+      if (!sample_skip(r, &next))
+        break; /* truncated */
+      pos = next;
+      continue;
+    }
+
+    /* Index block: size is given by trailer, find it */
+    for (len = pos + 1; len + REC_TRAILER_SIZE <= r->size; len++)
+      if (get_u32(&r->data[len + 4]) == REC_TRAILER_MAGIC &&
+          get_u32(&r->data[len]) == len - pos)
+        break;
+
+    if (len + REC_TRAILER_SIZE > r->size ||
+        !index_parse(r, pos, len, &c, NULL) || c.offset != start)
+      break;
+    if (!chunk_add(r, c.offset, c.end, c.last))
+      return false;
+
+    pos = start = len + REC_TRAILER_SIZE;
+  }
+
+  /* Not indexed samples */
+  if (pos > start)
+    return chunk_add(r, start, pos, UINT64_MAX);
+
+  return true;
+}
+
+/* State of streams and time before each chunk */
+static bool chunk_states (cw_rec_reader_t *r)
+{
+  rec_chunk_t c;
+  uint64_t end;
+
+  r->states = calloc((size_t)(r->count + 1) * r->streams, sizeof(rec_state_t));
+  r->times = calloc(r->count + 1, sizeof(uint64_t));
+  if (!r->states || !r->times)
+    return false;
+
+  for (unsigned int i = 1; i < r->count; i++) {
+    /* Previous chunk index block (its trailer ends where chunk starts) */
+    end = r->chunks[i].offset - REC_TRAILER_SIZE;
+    if (!index_parse(r, r->chunks[i - 1].end, end, &c,
+          &r->states[(size_t)i * r->streams]))
+      return false;
+    r->times[i] = c.last;
+  }
+
+  return true;
+}
+
+/**
+ * Open a recording (read only).
+ *
+ * \param[in] path file path
+ * \return instance or NULL
+ */
+cw_rec_reader_t *cw_rec_open (const char *path)
+{
+  cw_rec_header_t header;
+  uint8_t buf[REC_HEADER_SIZE];
+  cw_rec_reader_t *r;
+  struct stat st;
+  void *p;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    return NULL;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(buf) ||
+      pread(fd, buf, sizeof(buf), 0) != sizeof(buf))
+    memset(buf, 0, sizeof(buf));
+
+  memcpy(header.magic, buf, sizeof(header.magic));
+  header.version = get_u32(&buf[8]);
+  header.streams = get_u32(&buf[12]);
+  header.start = get_u64(&buf[16]);
+  header.index_samples = get_u32(&buf[24]);
+
+  if (memcmp(header.magic, CW_REC_MAGIC, sizeof(header.magic)) != 0 ||
+      header.version != CW_REC_VERSION || header.streams == 0) {
+    CW_ERROR("%s: not a cw recording (or unsupported version)", path);
+    close(fd);
+    return NULL;
+  }
+
+  p = mmap(NULL, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (p == MAP_FAILED) {
+    CW_ERROR_ERRNO(errno, "mmap");
+    return NULL;
+  }
+
+  r = calloc(1, sizeof(cw_rec_reader_t));
+  if (!r) {
+    munmap(p, (size_t)st.st_size);
+    return NULL;
+  }
+
+  r->data = p;
+  r->size = (size_t)st.st_size;
+  r->streams = header.streams;
+  r->start = header.start;
+
+  if ((!index_backward(r) && !index_forward(r)) || !chunk_states(r) ||
+      !(r->cur = calloc(r->streams, sizeof(rec_state_t)))) {
+    CW_ERROR("%s: corrupted recording", path);
+    cw_rec_free(r);
+    return NULL;
+  }
+
+  cw_rec_seek(r, 0);
+  return r;
+}
+
+unsigned int cw_rec_streams (const cw_rec_reader_t *r)
+{
+  return r->streams;
+}
+
+/* Recording start: wall clock (ms since Epoch) */
+uint64_t cw_rec_start (const cw_rec_reader_t *r)
+{
+  return r->start;
+}
+
+unsigned int cw_rec_chunks (const cw_rec_reader_t *r)
+{
+  return r->count;
+}
+
+/**
+ * Go to first sample at or after a given time. Chunks ending before are
+ * not decoded.
+ *
+ * \param[in] r reader
+ * \param[in] time ms since recording start
+ * \return 0
+ */
+int cw_rec_seek (cw_rec_reader_t *r, uint64_t time)
+{
+  unsigned int lo = 0, hi = r->count;
+
+  /* First chunk whose last sample is not before time */
+  while (lo < hi) {
+    unsigned int mid = (lo + hi) / 2;
+    if (r->chunks[mid].last < time)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+
+  r->chunk = lo;
+  r->from = time;
+  r->pos = (lo < r->count) ? r->chunks[lo].offset : r->size;
+  r->time = r->times[lo < r->count ? lo : 0];
+  if (lo < r->count)
+    memcpy(r->cur, &r->states[(size_t)lo * r->streams],
+        r->streams * sizeof(rec_state_t));
+
+  return 0;
+}
+
+/**
+ * Decode next sample.
+ *
+ * \param[in] r reader
+ * \param[out] sample next sample
+ * \return 1 if sample has been filled, 0 at end, -1 if data is corrupted
+ */
+int cw_rec_next (cw_rec_reader_t *r, cw_rec_sample_t *sample)
+{
+  uint64_t stream, dt, dbytes, dspeed, total, end;
+  rec_state_t *s;
+  uint8_t type;
+
+  for (;;) {
+    if (r->chunk >= r->count)
+      return 0;
+
+    end = r->chunks[r->chunk].end;
+    if (r->pos >= end) {
+      if (++r->chunk < r->count)
+        r->pos = r->chunks[r->chunk].offset;
+      continue;
+    }
+
+    type = r->data[r->pos++];
+    if ((type != REC_SAMPLE && type != REC_SAMPLE_TOTAL) ||
+        !get_varint(r, &r->pos, end, &stream) || stream >= r->streams ||
+        !get_varint(r, &r->pos, end, &dt) ||
+        !get_varint(r, &r->pos, end, &dbytes) ||
+        !get_varint(r, &r->pos, end, &dspeed))
+      return -1;
+
+    s = &r->cur[stream];
+    if (type == REC_SAMPLE_TOTAL) {
+      if (!get_varint(r, &r->pos, end, &total))
+        return -1;
+      s->total = total;
+    }
+
+    r->time += dt;
+    s->bytes += unzigzag(dbytes);
+    s->speed += unzigzag(dspeed);
+
+    if (r->time < r->from)
+      continue;
+
+    sample->time = r->time;
+    sample->stream = (unsigned int)stream;
+    sample->bytes = s->bytes;
+    sample->speed = s->speed;
+    sample->total = s->total;
+    return 1;
+  }
+}
+
+void cw_rec_free (cw_rec_reader_t *r)
+{
+  if (r) {
+    munmap((void *)r->data, r->size);
+    free(r->chunks);
+    free(r->states);
+    free(r->times);
+    free(r->cur);
+    free(r);
+  }
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,80 @@
+/*
+ * cURL wrapper - progress recorder (compact binary time series)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef REC_H
+#define REC_H
+
+#include <stdint.h>
+
+#include "libcw.h"
+
+/*
+ * File layout (append only, little endian):
+ *
+ *   header    32 bytes, cw_rec_header_t fields (not struct copy)
+ *   chunk...  samples then one index block
+ *   [tail]    samples not indexed yet (recorder has been killed)
+ *
+ * Sample: type byte, then varints (LEB128): stream, milliseconds since
+ * previous sample, bytes and speed deltas (zigzag) from previous sample of
+ * the same stream, total (if changed). A sample is 5 to 10 bytes long.
+ *
+ * Index block: type byte, varints: chunk start offset, first and last
+ * sample time, number of samples, absolute state of each stream (bytes,
+ * speed, total) at end of chunk. It is followed by a fixed size trailer
+ * (block size, magic): blocks are chained backward from end of file, so a
+ * reader can skip to any time without decoding what's before.
+ */
+#define CW_REC_MAGIC "CWREC\0\0\1"
+#define CW_REC_INDEX_SAMPLES 256  /* samples per chunk */
+
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint32_t streams;         /* number of streams */
+  uint64_t start;           /* wall clock (ms since Epoch) */
+  uint32_t index_samples;
+  uint32_t reserved;
+} cw_rec_header_t;
+
+typedef struct {
+  uint64_t time;            /* ms since recording start */
+  unsigned int stream;
+  uint64_t bytes;           /* received + uploaded */
+  uint64_t speed;           /* current speed (bytes/s) */
+  uint64_t total;           /* 0 if unknown */
+} cw_rec_sample_t;
+
+typedef struct cw_rec cw_rec_t;
+typedef struct cw_rec_reader cw_rec_reader_t;
+
+/* Recorder */
+cw_rec_t *cw_rec_create (const char *path, unsigned int streams);
+int cw_rec_append (cw_rec_t *rec, unsigned int stream, const cw_progress_t *result);
+void cw_rec_close (cw_rec_t *rec);
+
+/* Reader */
+cw_rec_reader_t *cw_rec_open (const char *path);
+unsigned int cw_rec_streams (const cw_rec_reader_t *r);
+uint64_t cw_rec_start (const cw_rec_reader_t *r);
+unsigned int cw_rec_chunks (const cw_rec_reader_t *r);
+int cw_rec_seek (cw_rec_reader_t *r, uint64_t time);
+int cw_rec_next (cw_rec_reader_t *r, cw_rec_sample_t *sample);
+void cw_rec_free (cw_rec_reader_t *r);
+
+#endif /* REC_H */
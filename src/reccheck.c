@@ -0,0 +1,227 @@
+/*
+ * cURL wrapper - progress recorder check
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Known samples are recorded then read back: whole file, seeks to chunk
+ * edges (index blocks) and file truncated in its last index block (forward
+ * scan). Values are varint length edges and deltas of both signs, so
+ * varint and zigzag are checked on round trip (make check).
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "common.h"
+#include "rec.h"
+
+#define REC_STREAMS 3
+#define REC_SAMPLES (3 * CW_REC_INDEX_SAMPLES + 232)
+
+static const uint64_t values[] = {
+  0, 1, 127, 128, 16383, 16384, 42, UINT64_C(1) << 32,
+  (UINT64_C(1) << 63) - 1, UINT64_C(1) << 63, UINT64_MAX,
+};
+
+#define VALUES (sizeof(values)/sizeof(values[0]))
+
+static cw_rec_sample_t expected[REC_SAMPLES];
+static uint64_t times[REC_SAMPLES];
+
+static void sample_get (unsigned int i, cw_progress_t *result)
+{
+  memset(result, 0, sizeof(*result));
+  result->fields = CW_FIELD_METER;
+  result->received = values[(i * 7) % VALUES];
+  result->uploaded = (i & 1) ? 0 : 3;
+  result->speed = values[(i * 5 + 3) % VALUES];
+  result->total = values[(i / 10) % VALUES];
+}
+
+static int record (const char *path)
+{
+  struct timespec ms = { 0, 1000000 };
+  cw_progress_t result;
+  cw_rec_t *rec;
+  int ret = 0;
+
+  rec = cw_rec_create(path, REC_STREAMS);
+  if (!rec)
+    return -1;
+
+  for (unsigned int i = 0; i < REC_SAMPLES && ret == 0; i++) {
+    /* Several milliseconds per chunk: seek has something to skip */
+    if (i % 16 == 0)
+      nanosleep(&ms, NULL);
+
+    sample_get(i, &result);
+    expected[i].stream = i % REC_STREAMS;
+    expected[i].bytes = result.received + result.uploaded;
+    expected[i].speed = result.speed;
+    expected[i].total = result.total;
+    ret = cw_rec_append(rec, i % REC_STREAMS, &result);
+  }
+
+  cw_rec_close(rec);
+  return ret;
+}
+
+/* Remaining samples must be expected ones from first */
+static int read_from (cw_rec_reader_t *r, unsigned int first, const char *what)
+{
+  cw_rec_sample_t sample;
+  unsigned int i = first;
+  uint64_t last = 0;
+  int n;
+
+  while ((n = cw_rec_next(r, &sample)) == 1) {
+    if (i >= REC_SAMPLES || sample.stream != expected[i].stream ||
+        sample.bytes != expected[i].bytes || sample.speed != expected[i].speed ||
+        sample.total != expected[i].total || sample.time < last) {
+      fprintf(stderr, "%s: sample %u differs\n", what, i);
+      return -1;
+    }
+    last = sample.time;
+    times[i++] = sample.time;
+  }
+
+  if (n < 0 || i != REC_SAMPLES) {
+    fprintf(stderr, "%s: %u samples read, %u expected\n", what, i - first,
+        REC_SAMPLES - first);
+    return -1;
+  }
+
+  return 0;
+}
+
+/* Header fields are little endian whatever the host is */
+static int check_header (const char *path)
+{
+  static const uint8_t le[8] = { 1, 0, 0, 0, REC_STREAMS, 0, 0, 0 };
+  uint8_t buf[32];
+  FILE *fp;
+  int ret = -1;
+
+  fp = fopen(path, "rb");
+  if (fp) {
+    if (fread(buf, 1, sizeof(buf), fp) == sizeof(buf) &&
+        memcmp(buf, CW_REC_MAGIC, 8) == 0 && memcmp(&buf[8], le, 8) == 0)
+      ret = 0;
+    fclose(fp);
+  }
+
+  if (ret < 0)
+    fprintf(stderr, "header: unexpected layout\n");
+  return ret;
+}
+
+static int check_seek (cw_rec_reader_t *r)
+{
+  static const unsigned int at[] = { 0, 1, CW_REC_INDEX_SAMPLES - 1,
+    CW_REC_INDEX_SAMPLES, CW_REC_INDEX_SAMPLES + 1, 2 * CW_REC_INDEX_SAMPLES,
+    3 * CW_REC_INDEX_SAMPLES + 100, REC_SAMPLES - 1 };
+  cw_rec_sample_t sample;
+  unsigned int first;
+  char what[32];
+
+  for (size_t k = 0; k < sizeof(at)/sizeof(at[0]); k++) {
+    /* First sample at this time (several ones may share it) */
+    for (first = at[k]; first > 0 && times[first - 1] == times[at[k]]; first--)
+      ;
+    snprintf(what, sizeof(what), "seek %lu ms", (unsigned long)times[at[k]]);
+    cw_rec_seek(r, times[at[k]]);
+    if (read_from(r, first, what) < 0)
+      return -1;
+  }
+
+  cw_rec_seek(r, times[REC_SAMPLES - 1] + 1);
+  if (cw_rec_next(r, &sample) != 0) {
+    fprintf(stderr, "seek after end: sample read\n");
+    return -1;
+  }
+
+  return 0;
+}
+
+static int check (const char *path, unsigned int chunks, const char *what)
+{
+  cw_rec_reader_t *r;
+  int ret = 0;
+
+  r = cw_rec_open(path);
+  if (!r)
+    return -1;
+
+  if (cw_rec_streams(r) != REC_STREAMS || cw_rec_chunks(r) != chunks) {
+    fprintf(stderr, "%s: %u streams, %u chunks\n", what, cw_rec_streams(r),
+        cw_rec_chunks(r));
+    ret = -1;
+  } else if (read_from(r, 0, what) < 0 || check_seek(r) < 0) {
+    ret = -1;
+  }
+
+  printf("%-10s %u samples, %u chunks: %s\n", what, REC_SAMPLES,
+      cw_rec_chunks(r), (ret == 0) ? "ok" : "FAILED");
+  cw_rec_free(r);
+  return ret;
+}
+
+int main (void)
+{
+  const char *dir = getenv("TMPDIR");
+  char path[256];
+  long size;
+  FILE *fp;
+  int fd, ret;
+
+  snprintf(path, sizeof(path), "%s/reccheck.XXXXXX", (dir) ? dir : "/tmp");
+  fd = mkstemp(path);
+  if (fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    return 1;
+  }
+  close(fd);
+
+  ret = record(path);
+  if (ret == 0)
+    ret = check_header(path);
+  if (ret == 0)
+    ret = check(path, (REC_SAMPLES + CW_REC_INDEX_SAMPLES - 1) /
+        CW_REC_INDEX_SAMPLES, "indexed");
+
+  /* Recorder killed while writing last index block: samples are kept */
+  if (ret == 0 && (fp = fopen(path, "rb")) != NULL) {
+    fseek(fp, 0, SEEK_END);
+    size = ftell(fp);
+    fclose(fp);
+    if (truncate(path, size - 3) == -1) {
+      CW_ERROR_ERRNO(errno, "%s", path);
+      ret = -1;
+    } else {
+      ret = check(path, REC_SAMPLES / CW_REC_INDEX_SAMPLES + 1, "truncated");
+    }
+  }
+
+  unlink(path);
+  return (ret == 0) ? 0 : 1;
+}
+
+/* vim: set et sw=2 ts=4: */
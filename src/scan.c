@@ -0,0 +1,151 @@
+/*
+ * cURL wrapper - end of line scanning
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "scan.h"
+
+#ifdef HAVE_X86_SIMD
+#include <immintrin.h>
+#endif
+
+static const char *scan_resolve (const char *buffer, size_t length);
+
+/* Selected implementation, resolved on first call. Accessed atomically:
+ * parsers may run in several threads and resolve it concurrently (any
+ * thread stores the same value). */
+static cw_scan_func_t scan_impl = scan_resolve;
+
+#define scan_impl_set(f) __atomic_store_n(&scan_impl, (f), __ATOMIC_RELAXED)
+#define scan_impl_get()  __atomic_load_n(&scan_impl, __ATOMIC_RELAXED)
+
+/**
+ * Seek first end of line character (\r or \n), one byte at a time.
+ *
+ * \param[in] buffer input data
+ * \param[in] length number of bytes of buffer
+ * \return pointer to delimiter or NULL if there is none
+ */
+const char *cw_scan_eol_scalar (const char *buffer, size_t length)
+{
+  const char *end = buffer + length;
+
+  for (; buffer < end; buffer++)
+    if (*buffer == '\r' || *buffer == '\n')
+      return buffer;
+
+  return NULL;
+}
+
+#ifdef HAVE_X86_SIMD
+/* Same as cw_scan_eol_scalar(), 16 bytes at a time */
+__attribute__((target("sse2")))
+const char *cw_scan_eol_sse2 (const char *buffer, size_t length)
+{
+  const __m128i cr = _mm_set1_epi8('\r');
+  const __m128i lf = _mm_set1_epi8('\n');
+  __m128i v;
+  unsigned int mask;
+
+  while (length >= 16) {
+    v = _mm_loadu_si128((const __m128i *)buffer);
+    mask = (unsigned int)_mm_movemask_epi8(_mm_or_si128(
+          _mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, lf)));
+    if (mask)
+      return buffer + __builtin_ctz(mask);
+    buffer += 16;
+    length -= 16;
+  }
+
+  return cw_scan_eol_scalar(buffer, length);
+}
+
+/* Same as cw_scan_eol_scalar(), 32 bytes at a time */
+__attribute__((target("avx2")))
+const char *cw_scan_eol_avx2 (const char *buffer, size_t length)
+{
+  const __m256i cr = _mm256_set1_epi8('\r');
+  const __m256i lf = _mm256_set1_epi8('\n');
+  __m256i v;
+  unsigned int mask;
+
+  while (length >= 32) {
+    v = _mm256_loadu_si256((const __m256i *)buffer);
+    mask = (unsigned int)_mm256_movemask_epi8(_mm256_or_si256(
+          _mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, lf)));
+    if (mask)
+      return buffer + __builtin_ctz(mask);
+    buffer += 32;
+    length -= 32;
+  }
+
+  return cw_scan_eol_sse2(buffer, length);
+}
+#endif /* HAVE_X86_SIMD */
+
+/**
+ * Choose scanner implementation.
+ *
+ * \param[in] name "scalar", "sse2", "avx2" or NULL for best one supported by CPU
+ * \return selected implementation name, NULL if requested one is unavailable
+ */
+const char *cw_scan_select (const char *name)
+{
+#ifdef HAVE_X86_SIMD
+  __builtin_cpu_init();
+
+  if ((!name || strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2")) {
+    scan_impl_set(cw_scan_eol_avx2);
+    return "avx2";
+  }
+  if ((!name || strcmp(name, "sse2") == 0) && __builtin_cpu_supports("sse2")) {
+    scan_impl_set(cw_scan_eol_sse2);
+    return "sse2";
+  }
+#endif
+  if (!name || strcmp(name, "scalar") == 0) {
+    scan_impl_set(cw_scan_eol_scalar);
+    return "scalar";
+  }
+
+  return NULL;
+}
+
+/* First call: pick implementation (CW_SIMD environment variable can force one) */
+static const char *scan_resolve (const char *buffer, size_t length)
+{
+  if (!cw_scan_select(getenv("CW_SIMD")))
+    cw_scan_select(NULL);
+
+  return scan_impl_get()(buffer, length);
+}
+
+/**
+ * Seek first end of line character (\r or \n).
+ *
+ * \param[in] buffer input data
+ * \param[in] length number of bytes of buffer
+ * \return pointer to delimiter or NULL if there is none
+ */
+const char *cw_scan_eol (const char *buffer, size_t length)
+{
+  return scan_impl_get()(buffer, length);
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,40 @@
+/*
+ * cURL wrapper - end of line scanning
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+/* Scanner signature: return pointer to first \r or \n character, NULL if none */
+typedef const char *(*cw_scan_func_t)(const char *buffer, size_t length);
+
+/* Library internal prototypes */
+const char *cw_scan_eol (const char *buffer, size_t length);
+const char *cw_scan_eol_scalar (const char *buffer, size_t length);
+#ifdef HAVE_X86_SIMD
+const char *cw_scan_eol_sse2 (const char *buffer, size_t length);
+const char *cw_scan_eol_avx2 (const char *buffer, size_t length);
+#endif
+const char *cw_scan_select (const char *name);
+
+#endif /* SCAN_H */
@@ -0,0 +1,193 @@
+/*
+ * cURL wrapper - input path microbenchmark
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+
+#include "common.h"
+#include "libcw.h"
+#include "scan.h"
+
+#define MiB (1024 * 1024)
+
+static double now (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/*
+ * Fake "curl -v" stderr: verbose text lines ending with \n, and a progress
+ * meter update (starting with \r) every 64 lines.
+ */
+static char *generate (size_t size)
+{
+  static const char meter[] =
+      "\r 28 20.0M   28 5936k    0     0  2970k      0  0:00:06  0:00:01  0:00:05 2969k\n";
+  char *buffer = malloc(size);
+  size_t off = 0, n;
+  unsigned int line = 0;
+
+  if (!buffer)
+    return NULL;
+
+  srand(1);
+  while (off < size) {
+    if ((++line % 64) == 0) {
+      n = sizeof(meter) - 1;
+      if (n > size - off)
+        n = size - off;
+      memcpy(&buffer[off], meter, n);
+    } else {
+      n = 40 + rand() % 80;
+      if (n > size - off)
+        n = size - off;
+      memset(&buffer[off], '<', n);
+      buffer[off + n - 1] = '\n';
+    }
+    off += n;
+  }
+
+  return buffer;
+}
+
+/* Scanner alone (data in memory) */
+static void bench_scan (const char *name, const char *buffer, size_t size)
+{
+  const char *p, *end = buffer + size;
+  unsigned long lines = 0;
+  double t;
+
+  if (!cw_scan_select(name)) {
+    printf("%-8s %-6s %14s\n", "scan", name, "unsupported");
+    return;
+  }
+
+  t = now();
+  for (int i = 0; i < 8; i++)
+    for (p = buffer; (p = cw_scan_eol(p, end - p)) != NULL; p++)
+      lines++;
+  t = now() - t;
+
+  printf("%-8s %-6s %8s %10.1f MiB/s (%lu lines)\n", "scan", name, "-",
+      8.0 * size / MiB / t, lines / 8);
+}
+
+/* Complete input path: pipe, read() and parser */
+static void bench_read (const char *name, const char *buffer, size_t size,
+    size_t read_size)
+{
+  cw_parser_t *parser;
+  cw_progress_t result;
+  unsigned long reads = 0, results = 0;
+  int apipe[2];
+  char *rbuf;
+  ssize_t len;
+  size_t n;
+  double t;
+  pid_t pid;
+
+  if (!cw_scan_select(name))
+    return;
+
+  if (pipe(apipe) == -1) {
+    CW_ERROR_ERRNO(errno, "pipe");
+    return;
+  }
+
+  pid = fork();
+  if (pid == 0) {
+    close(apipe[0]);
+    for (size_t off = 0; off < size; off += (size_t)len) {
+      len = write(apipe[1], buffer + off, size - off);
+      if (len <= 0)
+        break;
+    }
+    _exit(0);
+  }
+  close(apipe[1]);
+
+  rbuf = malloc(read_size);
+  parser = cw_parser_new(CW_FORMAT_METER);
+
+  t = now();
+  while ((len = read(apipe[0], rbuf, read_size)) > 0) {
+    const char *p = rbuf;
+    reads++;
+    while (len > 0) {
+      n = cw_parser_push(parser, p, (size_t)len);
+      while (cw_parser_pull(parser, &result))
+        results++;
+      p += n;
+      len -= n;
+    }
+  }
+  t = now() - t;
+
+  printf("%-8s %-6s %8zu %10.1f MiB/s (%lu reads, %lu results)\n", "read",
+      name, read_size, (double)size / MiB / t, reads, results);
+
+  cw_parser_free(parser);
+  free(rbuf);
+  close(apipe[0]);
+  waitpid(pid, NULL, 0);
+}
+
+int main (int argc, char *argv[])
+{
+  static const char *impls[] = { "scalar", "sse2", "avx2" };
+  size_t size = 64;
+  char *buffer;
+
+  if (argc > 1)
+    size = strtoul(argv[1], NULL, 10);
+  if (size == 0) {
+    fprintf(stderr, "Usage: scanbench [MiB]\n");
+    return 1;
+  }
+  size *= MiB;
+
+  buffer = generate(size);
+  if (!buffer) {
+    CW_ERROR("out of memory");
+    return 1;
+  }
+
+  printf("%-8s %-6s %8s %16s\n", "test", "impl", "chunk", "throughput");
+
+  for (size_t i = 0; i < sizeof(impls)/sizeof(impls[0]); i++)
+    bench_scan(impls[i], buffer, size);
+
+  /* Before: byte loop and 256 bytes reads. After: SIMD and large reads */
+  bench_read("scalar", buffer, size, 256);
+  bench_read("scalar", buffer, size, READ_BUFFER_SIZE);
+  bench_read(cw_scan_select(NULL), buffer, size, 256);
+  bench_read(cw_scan_select(NULL), buffer, size, READ_BUFFER_SIZE);
+
+  free(buffer);
+  return 0;
+}
+
+/* vim: set et sw=2 ts=4: */
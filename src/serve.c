@@ -0,0 +1,606 @@
+/*
+ * Zenity cURL wrapper - resident download daemon
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * A long-lived c2z performs in-process transfers for clients connected to
+ * a Unix socket. All transfers run in a single libcurl multi handle: its
+ * connection cache (and shared DNS and TLS session caches) makes requests
+ * to a same host reuse warm connections, no process is spawned.
+ *
+ * Request: number of curl arguments (in-process subset, see
+ * inproc_parse()), then each argument: its length and its bytes (lengths
+ * are uint32_t, host byte order). Payload output fd (opened by client) is
+ * attached (SCM_RIGHTS).
+ *
+ * Response: progress in c2z format (same as in-process transfer), then a
+ * status line "!CODE MESSAGE" (curl exit code), then connection is closed.
+ * Client sockets are not blocking, the socket send buffer holds progress
+ * not read yet: a client too far behind is dropped (transfer is aborted).
+ */
+
+#define _GNU_SOURCE
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <linux/sockios.h>
+
+#include "serve.h"
+#include "inproc.h"
+
+#ifdef HAVE_LIBCURL
+
+#define SERVE_BACKLOG 64
+#define SERVE_MAX_ARGS 64
+#define SERVE_STATUS '!'
+#define SERVE_SNDBUF (256 * 1024) /* client progress backlog (kernel doubles it) */
+
+typedef struct {
+  int fd;                   /* client connection, -1 for free slot */
+  int out_fd;               /* payload output (received from client) */
+  int backlog_max;          /* unsent bytes limit: client is too slow */
+  size_t len;               /* request bytes received */
+  char request[SERVE_REQUEST_MAX];
+  CURL *curl;               /* NULL until request is complete */
+  FILE *fp;
+  inproc_t t;
+  char errbuf[CURL_ERROR_SIZE];
+} serve_client_t;
+
+typedef struct {
+  int listen_fd;
+  CURLM *multi;
+  CURLSH *share;
+  const cw_options_t *opts;
+  unsigned int count;       /* connected clients */
+  serve_client_t clients[SERVE_MAX_CLIENTS];
+} serve_t;
+
+static int listen_socket (const char *path)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  struct stat st;
+  int fd;
+
+  if (strlen(path) >= sizeof(addr.sun_path)) {
+    CW_ERROR("%s: socket path too long", path);
+    return -1;
+  }
+  strcpy(addr.sun_path, path);
+
+  /* Stale socket of a previous instance */
+  if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+    unlink(path);
+
+  /* Owner only (whatever the umask): connections are refused until listen() */
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd == -1 || bind(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1 ||
+      chmod(path, S_IRUSR | S_IWUSR) == -1 || listen(fd, SERVE_BACKLOG) == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+
+  return fd;
+}
+
+/* Release a client slot, transfer (if any) is aborted */
+static void client_close (serve_t *s, serve_client_t *c)
+{
+  if (c->curl) {
+    curl_multi_remove_handle(s->multi, c->curl);
+    curl_easy_cleanup(c->curl);
+    c->curl = NULL;
+  }
+  cw_writer_free(c->t.writer);
+  c->t.writer = NULL;
+  if (c->fp) {
+    fclose(c->fp);
+    c->fp = NULL;
+  }
+  if (c->out_fd >= 0)
+    close(c->out_fd);
+  close(c->fd);
+  c->fd = c->out_fd = -1;
+  s->count--;
+}
+
+/* Send status line and close connection */
+static void client_status (serve_t *s, serve_client_t *c, int code,
+    const char *msg)
+{
+  dprintf(c->fd, "%c%d %s\n", SERVE_STATUS, code, msg);
+  client_close(s, c);
+}
+
+static void serve_accept (serve_t *s)
+{
+  int fd, size = SERVE_SNDBUF;
+  socklen_t len = sizeof(size);
+  serve_client_t *c;
+
+  while (s->count < SERVE_MAX_CLIENTS) {
+    fd = accept4(s->listen_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+    if (fd == -1) {
+      if (errno != EAGAIN && errno != EINTR)
+        CW_ERROR_ERRNO(errno, "accept");
+      return;
+    }
+
+    /* Progress writes never block: half of the buffer is kept for them */
+    setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size));
+    if (getsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, &len) == -1)
+      size = SERVE_SNDBUF;
+
+    for (c = s->clients; c->fd >= 0; c++)
+      ;
+    c->fd = fd;
+    c->out_fd = -1;
+    c->backlog_max = size / 2;
+    c->len = 0;
+    s->count++;
+  }
+}
+
+/**
+ * Decode a request: number of arguments, then length and bytes of each
+ * one (empty ones included).
+ *
+ * \param[in,out] c client, arguments are NUL terminated in place once
+ *                  request is complete
+ * \param[out] argv arguments (argv[0] is "curl"), SERVE_MAX_ARGS + 2 slots
+ * \return number of arguments, 0 if request is incomplete, -1 if invalid
+ */
+static int request_args (serve_client_t *c, char *argv[])
+{
+  uint32_t count, lens[SERVE_MAX_ARGS];
+  size_t off = sizeof(count);
+
+  if (c->len < off)
+    return 0;
+  memcpy(&count, c->request, sizeof(count));
+  if (count > SERVE_MAX_ARGS)
+    return -1;
+
+  for (uint32_t i = 0; i < count; i++) {
+    if (c->len - off < sizeof(lens[i]))
+      return 0;
+    memcpy(&lens[i], c->request + off, sizeof(lens[i]));
+    off += sizeof(lens[i]);
+    /* Room is left for the last terminator */
+    if (lens[i] >= sizeof(c->request) - off)
+      return -1;
+    if (lens[i] > c->len - off)
+      return 0;
+    argv[i + 1] = c->request + off;
+    off += lens[i];
+  }
+
+  if (off != c->len)
+    return -1;
+
+  /* Terminators overwrite length of next argument, all have been read */
+  for (uint32_t i = 0; i < count; i++)
+    argv[i + 1][lens[i]] = '\0';
+  argv[0] = "curl";
+  argv[count + 1] = NULL;
+  return (int)count + 1;
+}
+
+/**
+ * Start transfer of a complete request.
+ *
+ * \param[in] s daemon
+ * \param[in] c client
+ * \param[in] argc number of arguments
+ * \param[in] argv curl arguments (argv[0] is ignored)
+ */
+static void serve_start (serve_t *s, serve_client_t *c, int argc, char *argv[])
+{
+  inproc_request_t req;
+
+  if (!inproc_parse(argc, argv, &req)) {
+    client_status(s, c, CURLE_FAILED_INIT, "unsupported command-line");
+    return;
+  }
+
+  if (c->out_fd < 0) {
+    client_status(s, c, CURLE_FAILED_INIT, "no output");
+    return;
+  }
+
+  c->fp = fdopen(c->out_fd, "wb");
+  if (!c->fp) {
+    client_status(s, c, CURLE_WRITE_ERROR, strerror(errno));
+    return;
+  }
+  c->out_fd = -1;
+
+  c->t.writer = cw_writer_new(c->fd, s->opts);
+  c->curl = curl_easy_init();
+  if (!c->t.writer || !c->curl) {
+    client_status(s, c, CURLE_FAILED_INIT, "out of memory");
+    return;
+  }
+
+  c->errbuf[0] = '\0';
+  curl_easy_setopt(c->curl, CURLOPT_SHARE, s->share);
+  curl_easy_setopt(c->curl, CURLOPT_PRIVATE, c);
+  inproc_setup(c->curl, &req, &c->t, c->fp, c->errbuf);
+  curl_multi_add_handle(s->multi, c->curl);
+}
+
+/**
+ * Read (part of) a request. Once a transfer is running, client is not
+ * expected to write anything: readable means connection has been closed.
+ *
+ * \param[in] s daemon
+ * \param[in] c client
+ */
+static void serve_read (serve_t *s, serve_client_t *c)
+{
+  char cbuf[CMSG_SPACE(sizeof(int))], *argv[SERVE_MAX_ARGS + 2];
+  struct iovec iov;
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+  ssize_t n;
+  int fd, argc;
+
+  if (c->curl) {
+    client_close(s, c);
+    return;
+  }
+
+  iov.iov_base = c->request + c->len;
+  iov.iov_len = sizeof(c->request) - c->len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+
+  n = recvmsg(c->fd, &msg, MSG_CMSG_CLOEXEC);
+  if (n < 0 && (errno == EAGAIN || errno == EINTR))
+    return;
+  if (n <= 0) {
+    client_close(s, c);
+    return;
+  }
+
+  for (cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+    if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_RIGHTS) {
+      memcpy(&fd, CMSG_DATA(cmsg), sizeof(fd));
+      if (c->out_fd >= 0)
+        close(fd);
+      else
+        c->out_fd = fd;
+    }
+  }
+
+  c->len += (size_t)n;
+
+  argc = request_args(c, argv);
+  if (argc > 0)
+    serve_start(s, c, argc, argv);
+  else if (argc < 0)
+    client_status(s, c, CURLE_FAILED_INIT, "invalid request");
+  else if (c->len == sizeof(c->request))
+    client_status(s, c, CURLE_FAILED_INIT, "request too long");
+}
+
+/* Drop clients not reading their progress, before their buffer is full */
+static void serve_backlog (serve_t *s)
+{
+  serve_client_t *c;
+  int queued;
+
+  for (unsigned int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+    c = &s->clients[i];
+    if (c->fd >= 0 && c->curl && ioctl(c->fd, SIOCOUTQ, &queued) == 0 &&
+        queued > c->backlog_max) {
+      CW_WARNING("client doesn't read its progress, transfer aborted");
+      client_close(s, c);
+    }
+  }
+}
+
+/* Transfer is over: send latency breakdown and status */
+static void serve_done (serve_t *s, serve_client_t *c, CURLcode code)
+{
+  FILE *fp = c->fp;
+
+  c->fp = NULL;
+  if (fclose(fp) != 0 && code == CURLE_OK)
+    code = CURLE_WRITE_ERROR;
+
+  if (code == CURLE_OK && c->t.writer)
+    inproc_done(c->curl, &c->t);
+
+  /* Held back result is written before status */
+  cw_writer_free(c->t.writer);
+  c->t.writer = NULL;
+
+  client_status(s, c, (int)code, (c->errbuf[0]) ? c->errbuf :
+      curl_easy_strerror(code));
+}
+
+/**
+ * Run download daemon (until SIGINT, SIGTERM or SIGHUP).
+ *
+ * \param[in] path Unix socket to listen to
+ * \param[in] opts progress output options
+ * \return 0 on success, -1 on error
+ */
+int serve_run (const char *path, const cw_options_t *opts)
+{
+  struct curl_waitfd wfds[SERVE_MAX_CLIENTS + 1];
+  serve_client_t *slots[SERVE_MAX_CLIENTS + 1];
+  struct timespec ts = {0};
+  serve_t *s;
+  sigset_t mask;
+  CURLMsg *msg;
+  int running, left, ret = -1;
+  unsigned int n;
+
+  s = calloc(1, sizeof(serve_t));
+  if (!s) {
+    CW_ERROR_ERRNO(errno, "calloc");
+    return -1;
+  }
+  for (unsigned int i = 0; i < SERVE_MAX_CLIENTS; i++)
+    s->clients[i].fd = s->clients[i].out_fd = -1;
+  s->opts = opts;
+
+  if (curl_global_init(CURL_GLOBAL_DEFAULT) != CURLE_OK) {
+    free(s);
+    return -1;
+  }
+
+  s->listen_fd = listen_socket(path);
+  s->multi = curl_multi_init();
+  s->share = curl_share_init();
+  if (s->listen_fd < 0 || !s->multi || !s->share)
+    goto out;
+
+  curl_multi_setopt(s->multi, CURLMOPT_MAXCONNECTS, (long)SERVE_MAX_CONNECTS);
+  curl_share_setopt(s->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(s->share, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+
+  sigemptyset(&mask);
+  sigaddset(&mask, SIGINT);
+  sigaddset(&mask, SIGTERM);
+  sigaddset(&mask, SIGHUP);
+  sigprocmask(SIG_BLOCK, &mask, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  while (sigtimedwait(&mask, NULL, &ts) == -1) {
+    n = 0;
+    if (s->count < SERVE_MAX_CLIENTS) {
+      wfds[n].fd = s->listen_fd;
+      wfds[n].events = CURL_WAIT_POLLIN;
+      wfds[n].revents = 0;
+      slots[n++] = NULL;
+    }
+    for (unsigned int i = 0; i < SERVE_MAX_CLIENTS; i++) {
+      if (s->clients[i].fd >= 0) {
+        wfds[n].fd = s->clients[i].fd;
+        wfds[n].events = CURL_WAIT_POLLIN;
+        wfds[n].revents = 0;
+        slots[n++] = &s->clients[i];
+      }
+    }
+
+    /* Returns earlier if libcurl has timeouts to handle */
+    if (curl_multi_wait(s->multi, wfds, n, 1000, NULL) != CURLM_OK) {
+      CW_ERROR("curl_multi_wait failed");
+      goto out;
+    }
+
+    for (unsigned int i = 0; i < n; i++) {
+      if (!wfds[i].revents)
+        continue;
+      if (slots[i])
+        serve_read(s, slots[i]);
+      else
+        serve_accept(s);
+    }
+
+    serve_backlog(s);
+    curl_multi_perform(s->multi, &running);
+
+    while ((msg = curl_multi_info_read(s->multi, &left))) {
+      char *c;
+
+      if (msg->msg != CURLMSG_DONE)
+        continue;
+      curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &c);
+      serve_done(s, (serve_client_t *)c, msg->data.result);
+    }
+  }
+
+  ret = 0;
+
+out:
+  for (unsigned int i = 0; i < SERVE_MAX_CLIENTS; i++)
+    if (s->clients[i].fd >= 0)
+      client_close(s, &s->clients[i]);
+  if (s->multi)
+    curl_multi_cleanup(s->multi);
+  if (s->share)
+    curl_share_cleanup(s->share);
+  if (s->listen_fd >= 0) {
+    close(s->listen_fd);
+    unlink(path);
+  }
+  curl_global_cleanup();
+  free(s);
+  return ret;
+}
+
+/* Write a whole buffer, -1 on error */
+static int write_full (int fd, const char *buf, size_t len)
+{
+  ssize_t n;
+
+  while (len > 0) {
+    n = write(fd, buf, len);
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      return -1;
+    }
+    buf += n;
+    len -= (size_t)n;
+  }
+
+  return 0;
+}
+
+/**
+ * Send a request to download daemon and relay its progress.
+ *
+ * \param[in] path daemon Unix socket
+ * \param[in] argc number of arguments
+ * \param[in] argv curl arguments (in-process subset, argv[0] is ignored)
+ * \param[in] out_fd output fd to write progress to
+ * \return curl exit code (0 for success), -1 if daemon can't be reached
+ */
+int serve_request (const char *path, int argc, char *argv[], int out_fd)
+{
+  struct sockaddr_un addr = { .sun_family = AF_UNIX };
+  char request[SERVE_REQUEST_MAX], buf[4096], line[512];
+  uint32_t count = (uint32_t)(argc - 1), l;
+  char cbuf[CMSG_SPACE(sizeof(int))] = {0};
+  struct iovec iov;
+  struct msghdr msg = {0};
+  struct cmsghdr *cmsg;
+  inproc_request_t req;
+  const char *output;
+  size_t len = 0, pos = 0;
+  int fd, file_fd, code = -1;
+  ssize_t n;
+
+  if (strlen(path) >= sizeof(addr.sun_path) || !inproc_parse(argc, argv, &req))
+    return -1;
+  strcpy(addr.sun_path, path);
+
+  /* Daemon keeps one byte to terminate last argument */
+  memcpy(request, &count, sizeof(count));
+  len = sizeof(count);
+  for (int i = 1; i < argc; i++) {
+    l = (uint32_t)strlen(argv[i]);
+    if (len + sizeof(l) + l >= sizeof(request)) {
+      CW_ERROR("command-line too long for daemon");
+      return -1;
+    }
+    memcpy(request + len, &l, sizeof(l));
+    memcpy(request + len + sizeof(l), argv[i], l);
+    len += sizeof(l) + l;
+  }
+
+  fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+  if (fd == -1 || connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+    if (fd != -1)
+      close(fd);
+    return -1;
+  }
+
+  /* Output is opened here: relative path and permissions are the client's */
+  if (inproc_output(&req, &output) < 0) {
+    close(fd);
+    return CURLE_WRITE_ERROR;
+  }
+  file_fd = (output) ? open(output, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0666) :
+      STDOUT_FILENO;
+  if (file_fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", output);
+    close(fd);
+    return CURLE_WRITE_ERROR;
+  }
+
+  iov.iov_base = request;
+  iov.iov_len = len;
+  msg.msg_iov = &iov;
+  msg.msg_iovlen = 1;
+  msg.msg_control = cbuf;
+  msg.msg_controllen = sizeof(cbuf);
+  cmsg = CMSG_FIRSTHDR(&msg);
+  cmsg->cmsg_level = SOL_SOCKET;
+  cmsg->cmsg_type = SCM_RIGHTS;
+  cmsg->cmsg_len = CMSG_LEN(sizeof(int));
+  memcpy(CMSG_DATA(cmsg), &file_fd, sizeof(int));
+
+  n = sendmsg(fd, &msg, MSG_NOSIGNAL);
+  if (file_fd != STDOUT_FILENO)
+    close(file_fd);
+  if (n != (ssize_t)len) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    close(fd);
+    return CURLE_SEND_ERROR;
+  }
+
+  /* Relay progress lines, status line is the last one */
+  while ((n = read(fd, buf, sizeof(buf))) != 0) {
+    if (n < 0) {
+      if (errno == EINTR)
+        continue;
+      break;
+    }
+
+    for (ssize_t i = 0; i < n; i++) {
+      /* Long lines are truncated */
+      if (pos < sizeof(line) - 1 || buf[i] == '\n')
+        line[pos++] = buf[i];
+      if (buf[i] != '\n')
+        continue;
+
+      if (line[0] == SERVE_STATUS) {
+        char *msg_text;
+
+        line[pos - 1] = '\0';
+        code = (int)strtol(line + 1, &msg_text, 10);
+        if (code != 0)
+          CW_ERROR("curl: (%d) %s", code, (*msg_text) ? msg_text + 1 : "");
+      } else if (out_fd >= 0) {
+        write_full(out_fd, line, pos);
+      }
+      pos = 0;
+    }
+  }
+
+  close(fd);
+
+  if (code < 0) {
+    CW_ERROR("%s: daemon closed connection", path);
+    code = CURLE_RECV_ERROR;
+  }
+
+  return code;
+}
+#endif /* HAVE_LIBCURL */
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,33 @@
+/*
+ * Zenity cURL wrapper - resident download daemon
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include "common.h"
+
+#define SERVE_MAX_CLIENTS 64      /* concurrent requests */
+#define SERVE_MAX_CONNECTS 32     /* idle connections kept open */
+#define SERVE_REQUEST_MAX 8192    /* request size (arguments) */
+
+#ifdef HAVE_LIBCURL
+int serve_run (const char *path, const cw_options_t *opts);
+int serve_request (const char *path, int argc, char *argv[], int out_fd);
+#endif
+
+#endif /* SERVE_H */
@@ -0,0 +1,243 @@
+/*
+ * cURL wrapper - shared memory progress export
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "common.h"
+#include "shm.h"
+
+#define CW_SHM_VERSION 1
+#define SEQLOCK_RETRIES 1000
+
+_Static_assert(sizeof(cw_shm_header_t) == 64, "cw_shm_header_t layout");
+_Static_assert(sizeof(cw_shm_record_t) == 128, "cw_shm_record_t layout");
+
+struct cw_shm {
+  cw_shm_header_t *header;
+  cw_shm_record_t *records;
+  size_t size;
+};
+
+static uint64_t wall_ms (void)
+{
+  struct timespec ts;
+
+  clock_gettime(CLOCK_REALTIME, &ts);
+  return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static cw_shm_t *shm_map (int fd, size_t size, int prot)
+{
+  cw_shm_t *shm = malloc(sizeof(cw_shm_t));
+  void *p;
+
+  if (!shm)
+    return NULL;
+
+  p = mmap(NULL, size, prot, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED) {
+    free(shm);
+    return NULL;
+  }
+
+  shm->header = p;
+  shm->records = (cw_shm_record_t *)(shm->header + 1);
+  shm->size = size;
+  return shm;
+}
+
+/**
+ * Create (or truncate) export file.
+ *
+ * \param[in] path file path, /dev/shm is a good place (tmpfs)
+ * \param[in] count number of streams
+ * \return instance or NULL
+ */
+cw_shm_t *cw_shm_create (const char *path, unsigned int count)
+{
+  size_t size = sizeof(cw_shm_header_t) + count * sizeof(cw_shm_record_t);
+  cw_shm_t *shm;
+  int fd;
+
+  fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+  if (fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    return NULL;
+  }
+
+  if (ftruncate(fd, (off_t)size) == -1 ||
+      !(shm = shm_map(fd, size, PROT_READ | PROT_WRITE))) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    close(fd);
+    return NULL;
+  }
+  close(fd);
+
+  /* File is zero filled: records are idle */
+  shm->header->version = CW_SHM_VERSION;
+  shm->header->count = count;
+  shm->header->record_size = sizeof(cw_shm_record_t);
+  shm->header->pid = (int32_t)getpid();
+  __atomic_store_n(&shm->header->magic, CW_SHM_MAGIC, __ATOMIC_RELEASE);
+
+  return shm;
+}
+
+/**
+ * Update a record (wait-free, readers don't slow writer down).
+ *
+ * \param[in] shm export instance
+ * \param[in] index stream number
+ * \param[in] result last parsed result
+ * \param[in] avg_speed smoothed speed, 0 if unknown
+ * \param[in] state CW_SHM_RUNNING or CW_SHM_STALLED
+ */
+void cw_shm_publish (cw_shm_t *shm, unsigned int index, const cw_progress_t *result,
+    uint64_t avg_speed, uint32_t state)
+{
+  cw_shm_record_t *r = &shm->records[index];
+  uint32_t seq = r->seq;
+
+  __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+
+  r->state = state;
+  r->fields = result->fields;
+  r->percent = result->percent;
+  r->total = result->total;
+  r->received = result->received;
+  r->uploaded = result->uploaded;
+  r->speed = result->speed;
+  r->avg_speed = avg_speed;
+  r->time_spent = (result->fields & CW_FIELD_METER) ? result->time_spent : -1;
+  r->time_left = (result->fields & CW_FIELD_METER) ? result->time_left : -1;
+  r->updated = wall_ms();
+
+  __atomic_store_n(&r->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Change record state only (stream closed for example) */
+void cw_shm_set_state (cw_shm_t *shm, unsigned int index, uint32_t state)
+{
+  cw_shm_record_t *r = &shm->records[index];
+  uint32_t seq = r->seq;
+
+  __atomic_store_n(&r->seq, seq + 1, __ATOMIC_RELAXED);
+  __atomic_thread_fence(__ATOMIC_RELEASE);
+  r->state = state;
+  r->updated = wall_ms();
+  __atomic_store_n(&r->seq, seq + 2, __ATOMIC_RELEASE);
+}
+
+/* Unmap file (file is kept: last state remains readable) */
+void cw_shm_close (cw_shm_t *shm)
+{
+  if (shm) {
+    munmap(shm->header, shm->size);
+    free(shm);
+  }
+}
+
+/**
+ * Map an export file (read only).
+ *
+ * \param[in] path file path
+ * \return instance or NULL
+ */
+cw_shm_t *cw_shm_open (const char *path)
+{
+  cw_shm_header_t header;
+  cw_shm_t *shm = NULL;
+  struct stat st;
+  int fd;
+
+  fd = open(path, O_RDONLY | O_CLOEXEC);
+  if (fd == -1) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    return NULL;
+  }
+
+  if (fstat(fd, &st) == -1 || (size_t)st.st_size < sizeof(header) ||
+      pread(fd, &header, sizeof(header), 0) != sizeof(header)) {
+    CW_ERROR("%s: not a cw export file", path);
+    goto out;
+  }
+
+  if (header.magic != CW_SHM_MAGIC || header.version != CW_SHM_VERSION ||
+      header.record_size != sizeof(cw_shm_record_t) ||
+      (size_t)st.st_size < sizeof(header) + header.count * sizeof(cw_shm_record_t)) {
+    CW_ERROR("%s: not a cw export file (or unsupported version)", path);
+    goto out;
+  }
+
+  shm = shm_map(fd, sizeof(header) + header.count * sizeof(cw_shm_record_t),
+      PROT_READ);
+  if (!shm)
+    CW_ERROR_ERRNO(errno, "mmap");
+
+out:
+  close(fd);
+  return shm;
+}
+
+unsigned int cw_shm_count (const cw_shm_t *shm)
+{
+  return shm->header->count;
+}
+
+int cw_shm_pid (const cw_shm_t *shm)
+{
+  return shm->header->pid;
+}
+
+/**
+ * Get a consistent copy of a record.
+ *
+ * \param[in] shm export instance (reader)
+ * \param[in] index stream number
+ * \param[out] record record copy
+ * \return true on success, false if writer kept updating record
+ */
+bool cw_shm_read (const cw_shm_t *shm, unsigned int index, cw_shm_record_t *record)
+{
+  const cw_shm_record_t *r = &shm->records[index];
+  uint32_t seq1, seq2;
+
+  for (int i = 0; i < SEQLOCK_RETRIES; i++) {
+    seq1 = __atomic_load_n(&r->seq, __ATOMIC_ACQUIRE);
+    if (seq1 & 1)
+      continue;
+
+    memcpy(record, (const void *)r, sizeof(*record));
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+
+    seq2 = __atomic_load_n(&r->seq, __ATOMIC_RELAXED);
+    if (seq1 == seq2)
+      return true;
+  }
+
+  return false;
+}
+
+/* vim: set et sw=2 ts=4: */
@@ -0,0 +1,82 @@
+/*
+ * cURL wrapper - shared memory progress export
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef SHM_H
+#define SHM_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "libcw.h"
+
+/*
+ * File layout (native byte order): one header then one record per
+ * stream. Each record is protected by a sequence counter (seqlock):
+ * odd while writer updates it. Readers never block the writer, they
+ * retry when counter is odd or has changed during their copy.
+ */
+#define CW_SHM_MAGIC   0x314D485357430000ULL /* "\0\0CWSHM1" */
+
+enum {
+  CW_SHM_IDLE = 0,          /* nothing parsed yet */
+  CW_SHM_RUNNING,
+  CW_SHM_STALLED,
+  CW_SHM_DONE,              /* stream closed */
+};
+
+typedef struct {
+  uint64_t magic;           /* written last: file is complete */
+  uint32_t version;
+  uint32_t count;           /* number of records */
+  uint32_t record_size;
+  int32_t pid;              /* writer process */
+  uint8_t pad[40];
+} cw_shm_header_t;
+
+typedef struct {
+  uint32_t seq;             /* seqlock counter */
+  uint32_t state;           /* CW_SHM_* */
+  uint32_t fields;          /* CW_FIELD_* mask */
+  int32_t percent;
+  uint64_t total;
+  uint64_t received;
+  uint64_t uploaded;
+  uint64_t speed;           /* current speed (bytes/s) */
+  uint64_t avg_speed;       /* smoothed speed, 0 if statistics are disabled */
+  int64_t time_spent;       /* seconds, -1 if unknown */
+  int64_t time_left;        /* seconds, -1 if unknown */
+  uint64_t updated;         /* wall clock (ms since Epoch) */
+  uint8_t pad[48];
+} cw_shm_record_t;          /* two cache lines */
+
+typedef struct cw_shm cw_shm_t;
+
+/* Writer */
+cw_shm_t *cw_shm_create (const char *path, unsigned int count);
+void cw_shm_publish (cw_shm_t *shm, unsigned int index, const cw_progress_t *result,
+    uint64_t avg_speed, uint32_t state);
+void cw_shm_set_state (cw_shm_t *shm, unsigned int index, uint32_t state);
+void cw_shm_close (cw_shm_t *shm);
+
+/* Reader */
+cw_shm_t *cw_shm_open (const char *path);
+unsigned int cw_shm_count (const cw_shm_t *shm);
+int cw_shm_pid (const cw_shm_t *shm);
+bool cw_shm_read (const cw_shm_t *shm, unsigned int index, cw_shm_record_t *record);
+
+#endif /* SHM_H */
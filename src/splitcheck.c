@@ -0,0 +1,196 @@
+/*
+ * cURL wrapper - incremental parser check
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Recorded curl outputs (samples directory) are pushed in two pieces, at
+ * every split point: results, timing record and counters must be the same
+ * as when pushed at once. Run with each line scanner (make check).
+ */
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "common.h"
+#include "libcw.h"
+#include "scan.h"
+
+#define SPLIT_RESULTS_MAX 64
+
+/* Everything a parser tells about a sample */
+typedef struct {
+  cw_progress_t results[SPLIT_RESULTS_MAX];
+  unsigned int count;
+  cw_timing_t timing;
+  unsigned int timings;
+  cw_counters_t counters;
+} outcome_t;
+
+static char *load (const char *name, size_t *size)
+{
+  const char *dir = getenv("srcdir");
+  char path[256], *buffer;
+  long len;
+  FILE *fp;
+
+  snprintf(path, sizeof(path), "%s/samples/%s", (dir) ? dir : ".", name);
+  fp = fopen(path, "rb");
+  if (!fp) {
+    CW_ERROR_ERRNO(errno, "%s", path);
+    return NULL;
+  }
+
+  fseek(fp, 0, SEEK_END);
+  len = ftell(fp);
+  rewind(fp);
+  buffer = (len > 0) ? malloc((size_t)len) : NULL;
+  if (!buffer || fread(buffer, 1, (size_t)len, fp) != (size_t)len) {
+    CW_ERROR("%s: can't read sample", path);
+    free(buffer);
+    buffer = NULL;
+  }
+
+  fclose(fp);
+  *size = (size_t)len;
+  return buffer;
+}
+
+/* Push data, collect results as the filter does */
+static void feed (cw_parser_t *p, const char *buf, size_t len, outcome_t *o)
+{
+  cw_progress_t result;
+  size_t n;
+
+  while (len > 0) {
+    n = cw_parser_push(p, buf, len);
+    while (cw_parser_pull(p, &result))
+      if (o->count < SPLIT_RESULTS_MAX)
+        o->results[o->count++] = result;
+    if (cw_parser_timing(p, &o->timing))
+      o->timings++;
+    buf += n;
+    len -= n;
+  }
+}
+
+static int run (cw_format_t format, const char *buf, size_t len, size_t split,
+    outcome_t *o)
+{
+  cw_parser_t *p = cw_parser_new(format);
+
+  if (!p)
+    return -1;
+
+  memset(o, 0, sizeof(*o));
+  feed(p, buf, split, o);
+  feed(p, buf + split, len - split, o);
+  cw_parser_counters(p, &o->counters);
+  cw_parser_free(p);
+  return 0;
+}
+
+static bool same_progress (const cw_progress_t *a, const cw_progress_t *b)
+{
+  return a->fields == b->fields && a->percent == b->percent &&
+      a->total == b->total && a->received_percent == b->received_percent &&
+      a->received == b->received && a->uploaded_percent == b->uploaded_percent &&
+      a->uploaded == b->uploaded && a->dl_speed == b->dl_speed &&
+      a->ul_speed == b->ul_speed && a->time_total == b->time_total &&
+      a->time_spent == b->time_spent && a->time_left == b->time_left &&
+      a->speed == b->speed && a->transfers == b->transfers && a->live == b->live;
+}
+
+/* First difference between two outcomes, NULL if there is none */
+static const char *compare (const outcome_t *a, const outcome_t *b)
+{
+  if (a->count != b->count)
+    return "number of results";
+  for (unsigned int i = 0; i < a->count; i++)
+    if (!same_progress(&a->results[i], &b->results[i]))
+      return "result";
+  if (a->timings != b->timings || (a->timings &&
+        memcmp(&a->timing, &b->timing, sizeof(a->timing)) != 0))
+    return "timing record";
+  if (memcmp(&a->counters, &b->counters, sizeof(a->counters)) != 0)
+    return "counters";
+  return NULL;
+}
+
+/**
+ * Check a sample at every split point.
+ *
+ * \param[in] impl line scanner in use
+ * \param[in] name sample file name
+ * \param[in] format input data format
+ * \param[in] expected minimum number of results of whole sample
+ * \return 0 on success, -1 on failure
+ */
+static int check (const char *impl, const char *name, cw_format_t format,
+    unsigned int expected)
+{
+  outcome_t whole, split;
+  const char *diff;
+  size_t len;
+  char *buf;
+  int ret = 0;
+
+  buf = load(name, &len);
+  if (!buf)
+    return -1;
+
+  if (run(format, buf, len, len, &whole) < 0 || whole.count < expected) {
+    fprintf(stderr, "%s: %u results, %u expected at least\n", name, whole.count,
+        expected);
+    free(buf);
+    return -1;
+  }
+
+  for (size_t i = 0; i < len && ret == 0; i++) {
+    if (run(format, buf, len, i, &split) < 0) {
+      ret = -1;
+    } else if ((diff = compare(&whole, &split)) != NULL) {
+      fprintf(stderr, "%s: %s differs when split at offset %zu\n", name, diff, i);
+      ret = -1;
+    }
+  }
+
+  printf("%-8s %-12s %5zu bytes, %2u results: %s\n", impl, name,
+      len, whole.count, (ret == 0) ? "ok" : "FAILED");
+  free(buf);
+  return ret;
+}
+
+int main (void)
+{
+  static const char *impls[] = { "scalar", "sse2", "avx2" };
+  int ret = 0;
+
+  for (size_t i = 0; i < sizeof(impls)/sizeof(impls[0]); i++) {
+    if (!cw_scan_select(impls[i]))
+      continue;
+    ret |= check(impls[i], "meter.txt", CW_FORMAT_METER, 3);
+    ret |= check(impls[i], "bar.txt", CW_FORMAT_BAR, 3);
+    ret |= check(impls[i], "parallel.txt", CW_FORMAT_METER, 9);
+    ret |= check(impls[i], "parallel.txt", CW_FORMAT_PARALLEL, 9);
+  }
+
+  return (ret == 0) ? 0 : 1;
+}
+
+/* vim: set et sw=2 ts=4: */
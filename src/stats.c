@@ -0,0 +1,160 @@
+/*
+ * cURL wrapper - transfer statistics engine
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_CONFIG_H
+#include "config.h"
+#endif
+
+#include "libcw.h"
+
+#define WINDOW_MS_DEFAULT  10000
+#define STALL_SECS_DEFAULT 10
+#define WINDOW_SAMPLES     256   /* cURL updates its meter every second */
+#define EWMA_TAU_MS        5000  /* smoothing time constant */
+
+typedef struct {
+  uint64_t t;               /* timestamp (ms) */
+  uint64_t speed;           /* instantaneous speed (bytes/s) */
+} sample_t;
+
+struct cw_stats {
+  unsigned int window_ms;
+  uint64_t stall_ms;
+
+  /* Sliding window (ring buffer, oldest sample overwritten when full) */
+  sample_t ring[WINDOW_SAMPLES];
+  unsigned int head, count;
+
+  double ewma;
+  uint64_t last_t;          /* timestamp of last sample */
+  uint64_t progress_t;      /* timestamp of last byte progress */
+  uint64_t transferred, total;
+  uint64_t min, max;
+  unsigned long samples;
+};
+
+cw_stats_t *cw_stats_new (unsigned int window_ms, unsigned int stall_secs)
+{
+  cw_stats_t *st = calloc(1, sizeof(cw_stats_t));
+
+  if (st) {
+    st->window_ms = (window_ms) ? window_ms : WINDOW_MS_DEFAULT;
+    st->stall_ms = (uint64_t)((stall_secs) ? stall_secs : STALL_SECS_DEFAULT) * 1000;
+  }
+
+  return st;
+}
+
+void cw_stats_free (cw_stats_t *st)
+{
+  free(st);
+}
+
+void cw_stats_update (cw_stats_t *st, const cw_progress_t *result, uint64_t now_ms)
+{
+  uint64_t bytes, dt;
+
+  if (!(result->fields & CW_FIELD_METER))
+    return;
+
+  bytes = result->received + result->uploaded;
+
+  /* Transfer not started yet */
+  if (st->samples == 0 && bytes == 0 && result->speed == 0)
+    return;
+
+  if (st->samples == 0) {
+    st->ewma = (double)result->speed;
+    st->min = st->max = result->speed;
+    st->progress_t = now_ms;
+  } else {
+    /* Irregular sampling: weight depends on elapsed time */
+    dt = (now_ms > st->last_t) ? now_ms - st->last_t : 0;
+    st->ewma += ((double)result->speed - st->ewma) * dt / (EWMA_TAU_MS + dt);
+
+    if (result->speed < st->min)
+      st->min = result->speed;
+    if (result->speed > st->max)
+      st->max = result->speed;
+    if (bytes > st->transferred)
+      st->progress_t = now_ms;
+  }
+
+  st->ring[(st->head + st->count) % WINDOW_SAMPLES] = (sample_t){ now_ms, result->speed };
+  if (st->count < WINDOW_SAMPLES)
+    st->count++;
+  else
+    st->head = (st->head + 1) % WINDOW_SAMPLES;
+
+  st->transferred = bytes;
+  st->total = result->total;
+  st->last_t = now_ms;
+  st->samples++;
+}
+
+void cw_stats_get (const cw_stats_t *st, uint64_t now_ms, cw_summary_t *summary)
+{
+  uint64_t speeds[WINDOW_SAMPLES], sum = 0, v;
+  unsigned int n = 0, i, j;
+  const sample_t *sample;
+
+  memset(summary, 0, sizeof(*summary));
+  summary->eta = -1;
+
+  if (st->samples == 0)
+    return;
+
+  /* Samples of window, sorted (insertion sort, a few samples only) */
+  for (i = 0; i < st->count; i++) {
+    sample = &st->ring[(st->head + i) % WINDOW_SAMPLES];
+    if (sample->t + st->window_ms < now_ms)
+      continue;
+
+    v = sample->speed;
+    sum += v;
+    for (j = n++; j > 0 && speeds[j - 1] > v; j--)
+      speeds[j] = speeds[j - 1];
+    speeds[j] = v;
+  }
+
+  if (n > 0) {
+    summary->window = (double)sum / n;
+    summary->p50 = speeds[(n - 1) * 50 / 100];
+    summary->p95 = speeds[(n - 1) * 95 / 100];
+  }
+
+  summary->transferred = st->transferred;
+  summary->ewma = st->ewma;
+  summary->min = st->min;
+  summary->max = st->max;
+  summary->samples = st->samples;
+
+  if (st->total > st->transferred && st->ewma >= 1.0)
+    summary->eta = (int64_t)((st->total - st->transferred) / st->ewma);
+  else if (st->total > 0 && st->total <= st->transferred)
+    summary->eta = 0;
+
+  summary->idle = (now_ms > st->progress_t) ? (int64_t)(now_ms - st->progress_t) / 1000 : 0;
+  summary->stalled = (now_ms >= st->progress_t + st->stall_ms &&
+      (st->total == 0 || st->transferred < st->total));
+}
+
+/* vim: set et sw=2 ts=4: */
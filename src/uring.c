@@ -0,0 +1,301 @@
+/*
+ * cURL wrapper - minimal io_uring interface (raw syscalls)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+/*
+ * Just what the io_uring I/O wait backend needs (no liburing dependency):
+ * ring setup, submission, completion and one provided buffer ring.
+ */
+
+#define _GNU_SOURCE
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "uring.h"
+
+#define load_acquire(p)     __atomic_load_n((p), __ATOMIC_ACQUIRE)
+#define store_release(p, v) __atomic_store_n((p), (v), __ATOMIC_RELEASE)
+
+static int sys_io_uring_setup (unsigned int entries, struct io_uring_params *p)
+{
+  return (int)syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter (int fd, unsigned int to_submit,
+    unsigned int min_complete, unsigned int flags, const void *arg, size_t argsz)
+{
+  return (int)syscall(__NR_io_uring_enter, fd, to_submit, min_complete,
+      flags, arg, argsz);
+}
+
+static int sys_io_uring_register (int fd, unsigned int opcode, const void *arg,
+    unsigned int nr_args)
+{
+  return (int)syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/**
+ * Create a ring. Completions are processed by this thread only
+ * (single issuer, deferred task work) when kernel allows it.
+ *
+ * \param[out] r ring
+ * \param[in] entries submission queue size
+ * \param[in] cq_entries completion queue size
+ * \return 0 on success, negative errno on failure
+ */
+int cw_uring_init (cw_uring_t *r, unsigned int entries, unsigned int cq_entries)
+{
+  struct io_uring_params p;
+  int err;
+
+  memset(r, 0, sizeof(*r));
+
+  memset(&p, 0, sizeof(p));
+  p.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER |
+      IORING_SETUP_DEFER_TASKRUN;
+  p.cq_entries = cq_entries;
+  r->fd = sys_io_uring_setup(entries, &p);
+  if (r->fd < 0 && errno == EINVAL) { /* before Linux 6.1 */
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_CQSIZE;
+    p.cq_entries = cq_entries;
+    r->fd = sys_io_uring_setup(entries, &p);
+  }
+  if (r->fd < 0)
+    return -errno;
+
+  /* Timeout and signal mask given together to io_uring_enter (Linux 5.11) */
+  if (!(p.features & IORING_FEAT_EXT_ARG)) {
+    close(r->fd);
+    r->fd = -1;
+    return -ENOSYS;
+  }
+
+  r->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+  r->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    if (r->cq_size > r->sq_size)
+      r->sq_size = r->cq_size;
+    r->cq_size = r->sq_size;
+  }
+
+  r->sq_ptr = mmap(NULL, r->sq_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+  if (r->sq_ptr == MAP_FAILED)
+    goto fail;
+
+  if (p.features & IORING_FEAT_SINGLE_MMAP) {
+    r->cq_ptr = r->sq_ptr;
+  } else {
+    r->cq_ptr = mmap(NULL, r->cq_size, PROT_READ | PROT_WRITE,
+        MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    if (r->cq_ptr == MAP_FAILED)
+      goto fail;
+  }
+
+  r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+  r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+  if (r->sqes == MAP_FAILED)
+    goto fail;
+
+  r->sq_head = (unsigned int *)((char *)r->sq_ptr + p.sq_off.head);
+  r->sq_tail = (unsigned int *)((char *)r->sq_ptr + p.sq_off.tail);
+  r->sq_array = (unsigned int *)((char *)r->sq_ptr + p.sq_off.array);
+  r->sq_mask = *(unsigned int *)((char *)r->sq_ptr + p.sq_off.ring_mask);
+  r->sq_entries = p.sq_entries;
+
+  r->cq_head = (unsigned int *)((char *)r->cq_ptr + p.cq_off.head);
+  r->cq_tail = (unsigned int *)((char *)r->cq_ptr + p.cq_off.tail);
+  r->cq_mask = *(unsigned int *)((char *)r->cq_ptr + p.cq_off.ring_mask);
+  r->cqes = (struct io_uring_cqe *)((char *)r->cq_ptr + p.cq_off.cqes);
+  r->sq_local_tail = *r->sq_tail;
+
+  return 0;
+
+fail:
+  err = -errno;
+  if (r->sq_ptr == MAP_FAILED)
+    r->sq_ptr = NULL;
+  if (r->cq_ptr == MAP_FAILED)
+    r->cq_ptr = NULL;
+  if (r->sqes == MAP_FAILED)
+    r->sqes = NULL;
+  cw_uring_free(r);
+  return err;
+}
+
+/* Release ring: pending requests are cancelled, buffers are unregistered */
+void cw_uring_free (cw_uring_t *r)
+{
+  if (r->sqes)
+    munmap(r->sqes, r->sqes_size);
+  if (r->cq_ptr && r->cq_ptr != r->sq_ptr)
+    munmap(r->cq_ptr, r->cq_size);
+  if (r->sq_ptr)
+    munmap(r->sq_ptr, r->sq_size);
+  if (r->fd >= 0)
+    close(r->fd);
+
+  /* Buffers are released last: kernel must not use them anymore */
+  if (r->br)
+    munmap(r->br, r->br_size);
+  free(r->buffers);
+
+  memset(r, 0, sizeof(*r));
+  r->fd = -1;
+}
+
+/**
+ * Get a free submission entry (zeroed). It will be submitted by next
+ * cw_uring_wait() call.
+ *
+ * \return entry, NULL if submission queue is full
+ */
+struct io_uring_sqe *cw_uring_sqe (cw_uring_t *r)
+{
+  unsigned int tail = r->sq_local_tail;
+  struct io_uring_sqe *sqe;
+
+  if (tail - load_acquire(r->sq_head) >= r->sq_entries)
+    return NULL;
+
+  sqe = &r->sqes[tail & r->sq_mask];
+  memset(sqe, 0, sizeof(*sqe));
+  r->sq_array[tail & r->sq_mask] = tail & r->sq_mask;
+  r->sq_local_tail++;
+  return sqe;
+}
+
+/**
+ * Submit pending entries and wait for at least one completion, in a single
+ * system call.
+ *
+ * \param[in] r ring
+ * \param[in] ms timeout in milliseconds
+ * \param[in] sigmask signal mask during wait (like ppoll)
+ * \return 0 on success (completion or timeout), negative errno on failure
+ */
+int cw_uring_wait (cw_uring_t *r, int ms, const sigset_t *sigmask)
+{
+  struct __kernel_timespec ts = { .tv_sec = ms / 1000, .tv_nsec = (ms % 1000) * 1000000L };
+  struct io_uring_getevents_arg arg = {
+    .sigmask = (uint64_t)(uintptr_t)sigmask,
+    .sigmask_sz = _NSIG / 8,
+    .ts = (uint64_t)(uintptr_t)&ts,
+  };
+
+  /* Entries not consumed by kernel (head to tail) are submitted again */
+  store_release(r->sq_tail, r->sq_local_tail);
+
+  if (sys_io_uring_enter(r->fd, r->sq_local_tail - load_acquire(r->sq_head), 1,
+        IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG, &arg, sizeof(arg)) < 0)
+    return (errno == ETIME) ? 0 : -errno;
+
+  return 0;
+}
+
+/**
+ * Pop a completion entry.
+ *
+ * \param[in] r ring
+ * \param[out] cqe completion entry
+ * \return true if an entry has been copied, false if queue is empty
+ */
+bool cw_uring_cqe (cw_uring_t *r, struct io_uring_cqe *cqe)
+{
+  unsigned int head = *r->cq_head;
+
+  if (head == load_acquire(r->cq_tail))
+    return false;
+
+  *cqe = r->cqes[head & r->cq_mask];
+  store_release(r->cq_head, head + 1);
+  return true;
+}
+
+/**
+ * Register a provided buffer ring (Linux 5.19) and fill it.
+ *
+ * \param[in] r ring
+ * \param[in] count number of buffers (power of 2)
+ * \param[in] size size of each buffer
+ * \param[in] bgid buffer group id
+ * \return 0 on success, negative errno on failure
+ */
+int cw_uring_buffers (cw_uring_t *r, unsigned int count, size_t size,
+    unsigned short bgid)
+{
+  struct io_uring_buf_reg reg;
+
+  r->br_size = count * sizeof(struct io_uring_buf);
+  r->br = mmap(NULL, r->br_size, PROT_READ | PROT_WRITE,
+      MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (r->br == MAP_FAILED) {
+    r->br = NULL;
+    return -errno;
+  }
+
+  r->buffers = malloc(count * size);
+  if (!r->buffers)
+    return -ENOMEM;
+
+  memset(&reg, 0, sizeof(reg));
+  reg.ring_addr = (uint64_t)(uintptr_t)r->br;
+  reg.ring_entries = count;
+  reg.bgid = bgid;
+  if (sys_io_uring_register(r->fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+    int err = -errno;
+    munmap(r->br, r->br_size);
+    r->br = NULL;
+    return err;
+  }
+
+  r->buffer_size = size;
+  r->buffer_count = count;
+  r->bgid = bgid;
+
+  for (unsigned int bid = 0; bid < count; bid++)
+    cw_uring_buffer_return(r, bid);
+
+  return 0;
+}
+
+char *cw_uring_buffer (cw_uring_t *r, unsigned int bid)
+{
+  return r->buffers + (size_t)bid * r->buffer_size;
+}
+
+/* Give a buffer back to kernel once its data has been consumed */
+void cw_uring_buffer_return (cw_uring_t *r, unsigned int bid)
+{
+  unsigned short tail = r->br->tail;
+  struct io_uring_buf *buf = &r->br->bufs[tail & (r->buffer_count - 1)];
+
+  buf->addr = (uint64_t)(uintptr_t)cw_uring_buffer(r, bid);
+  buf->len = (unsigned int)r->buffer_size;
+  buf->bid = (unsigned short)bid;
+  store_release(&r->br->tail, (unsigned short)(tail + 1));
+}
+
+/* vim: set et sw=2 ts=4: */
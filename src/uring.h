@@ -0,0 +1,70 @@
+/*
+ * cURL wrapper - minimal io_uring interface (raw syscalls)
+ * Copyright (C) 2016  Matthieu Crapet <mcrapet@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#ifndef URING_H
+#define URING_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <signal.h>
+#include <linux/io_uring.h>
+
+/* Linux 6.7, not in older headers */
+#ifndef IORING_OP_READ_MULTISHOT
+#define IORING_OP_READ_MULTISHOT 49
+#endif
+
+typedef struct {
+  int fd;
+
+  /* Submission queue */
+  unsigned int *sq_head, *sq_tail, *sq_array;
+  unsigned int sq_mask, sq_entries;
+  unsigned int sq_local_tail;          /* entries filled (published on submit) */
+  struct io_uring_sqe *sqes;
+
+  /* Completion queue */
+  unsigned int *cq_head, *cq_tail;
+  unsigned int cq_mask;
+  struct io_uring_cqe *cqes;
+
+  void *sq_ptr, *cq_ptr;
+  size_t sq_size, cq_size, sqes_size;
+
+  /* Provided buffers (one group) */
+  struct io_uring_buf_ring *br;
+  size_t br_size;
+  char *buffers;
+  size_t buffer_size;
+  unsigned int buffer_count;
+  unsigned short bgid;
+} cw_uring_t;
+
+int cw_uring_init (cw_uring_t *r, unsigned int entries, unsigned int cq_entries);
+void cw_uring_free (cw_uring_t *r);
+
+struct io_uring_sqe *cw_uring_sqe (cw_uring_t *r);
+int cw_uring_wait (cw_uring_t *r, int ms, const sigset_t *sigmask);
+bool cw_uring_cqe (cw_uring_t *r, struct io_uring_cqe *cqe);
+
+int cw_uring_buffers (cw_uring_t *r, unsigned int count, size_t size,
+    unsigned short bgid);
+char *cw_uring_buffer (cw_uring_t *r, unsigned int bid);
+void cw_uring_buffer_return (cw_uring_t *r, unsigned int bid);
+
+#endif /* URING_H */